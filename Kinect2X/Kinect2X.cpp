@@ -6,6 +6,8 @@
 
 #include "Kinect2X.h"
 
+#include <chrono>
+
 using namespace kcv;
 
 /*!
@@ -25,11 +27,399 @@ inline void SafeRelease(Interface *& pInterfaceToRelease)
 }
 
 /*!
-Constructs a KCV_sensor object.
+Returns if \a coordinates is a non-empty continuous per pixel map of \a type , as the kernels index it by pixel.
+*/
+static bool isCoordinateMap(const cv::Mat &coordinates, int type)
+{
+	return !coordinates.empty() && coordinates.type() == type && coordinates.isContinuous();
+}
+
+/*!
+Returns S_OK when \a mapping has color and depth coordinates of a \a nDepthWidth x \a nDepthHeight depth frame and,
+unless \a nColorWidth is zero, of a \a nColorWidth x \a nColorHeight color grid. E_PENDING while no mapping has them,
+E_INVALIDARG when the frames differ in size from the mapped ones.
+*/
+static HRESULT checkMapping(const KCV_mappingView &mapping, int nDepthWidth, int nDepthHeight, int nColorWidth = 0, int nColorHeight = 0)
+{
+	if (!mapping.isValid() || !mapping.isColorMapped())
+	{
+		return E_PENDING;
+	}
+	if (mapping.depthFrame().cols != nDepthWidth || mapping.depthFrame().rows != nDepthHeight ||
+		(nColorWidth != 0 && mapping.colorSize() != cv::Size(nColorWidth, nColorHeight)))
+	{
+		return E_INVALIDARG;
+	}
+	return S_OK;
+}
+
+/*!
+Copy row \a y of \a output to the following rows of its \a step high block.
+*/
+static void repeatRow(cv::Mat &output, int y, int step)
+{
+	const int yEnd = y + step < output.rows ? y + step : output.rows;
+	for (int r = y + 1; r < yEnd; ++r)
+	{
+		memcpy(output.ptr(r), output.ptr(y), output.cols * output.elemSize());
+	}
+}
+
+/*!
+Align source pixels of type \a T to every pixel of \a output through the color space points in \a p_ColorPoints
+with \a nDepthWidth x \a nDepthHeight , nearest point is sampled when \a output has other size.
+\a p_Source with \a sourceStep bytes per row has \a nSourceWidth x \a nSourceHeight pixels, unmapped pixels are set to zero.
+With \a step above one only the first pixel of every \a step x \a step block is aligned and repeated over the block.
+*/
+template<typename T>
+static void alignColorKernel(const ColorSpacePoint *p_ColorPoints, int nDepthWidth, int nDepthHeight,
+	const uchar *p_Source, size_t sourceStep, int nSourceWidth, int nSourceHeight, cv::Mat &output, int step = 1)
+{
+	const T empty = T();
+	// 16.16 fixed point sampling step of the mapping grid
+	const int xStep = (nDepthWidth << 16) / output.cols;
+	const int yStep = (nDepthHeight << 16) / output.rows;
+	for (int y = 0; y < output.rows; y += step)
+	{
+		const ColorSpacePoint *p_Row = p_ColorPoints + ((y * yStep) >> 16) * nDepthWidth;
+		T *p_Output = output.ptr<T>(y);
+		for (int x = 0; x < output.cols; x += step)
+		{
+			const T* pSrc = &empty;
+
+			ColorSpacePoint p = p_Row[(x * xStep) >> 16];
+
+			// Values that are negative infinity means it is an invalid color to depth mapping
+			if (p.X != -std::numeric_limits<float>::infinity() && p.Y != -std::numeric_limits<float>::infinity())
+			{
+				int colorX = static_cast<int>(p.X + 0.5f);
+				int colorY = static_cast<int>(p.Y + 0.5f);
+
+				if ((colorX >= 0 && colorX < nSourceWidth) && (colorY >= 0 && colorY < nSourceHeight))
+				{
+					pSrc = reinterpret_cast<const T*>(p_Source + colorY * sourceStep) + colorX;
+				}
+			}
+
+			const int xEnd = x + step < output.cols ? x + step : output.cols;
+			for (int i = x; i < xEnd; ++i)
+			{
+				p_Output[i] = *pSrc;
+			}
+		}
+		repeatRow(output, y, step);
+	}
+}
+
+/*!
+Align depth to every pixel of \a output through the depth space points in \a p_DepthPoints with \a nColorWidth x \a nColorHeight ,
+nearest point is sampled when \a output has other size. \a p_DepthBuffer with \a depthStep bytes per row has
+\a nDepthWidth x \a nDepthHeight pixels, \a invalidDepth is written where no depth is mapped.
+With \a step above one only the first pixel of every \a step x \a step block is aligned and repeated over the block.
+*/
+static void alignDepthKernel(const DepthSpacePoint *p_DepthPoints, int nColorWidth, int nColorHeight,
+	const uchar *p_DepthBuffer, size_t depthStep, int nDepthWidth, int nDepthHeight, UINT16 invalidDepth, cv::Mat &output,
+	int step = 1)
+{
+	// 16.16 fixed point sampling step of the mapping grid
+	const int xStep = (nColorWidth << 16) / output.cols;
+	const int yStep = (nColorHeight << 16) / output.rows;
+	for (int y = 0; y < output.rows; y += step)
+	{
+		const DepthSpacePoint *p_Row = p_DepthPoints + ((y * yStep) >> 16) * nColorWidth;
+		UINT16 *p_Output = output.ptr<UINT16>(y);
+		for (int x = 0; x < output.cols; x += step)
+		{
+			UINT16 pSrc = 0;
+
+			DepthSpacePoint p = p_Row[(x * xStep) >> 16];
+
+			int depthX = static_cast<int>(p.X + 0.5f);
+			int depthY = static_cast<int>(p.Y + 0.5f);
+
+			if ((depthX >= 0 && depthX < nDepthWidth) && (depthY >= 0 && depthY < nDepthHeight))
+			{
+				pSrc = reinterpret_cast<const UINT16*>(p_DepthBuffer + depthY * depthStep)[depthX];
+			}
+
+			const UINT16 value = pSrc != 0 ? pSrc : invalidDepth;
+			const int xEnd = x + step < output.cols ? x + step : output.cols;
+			for (int i = x; i < xEnd; ++i)
+			{
+				p_Output[i] = value;
+			}
+		}
+		repeatRow(output, y, step);
+	}
+}
+
+/*!
+Align source pixels of type \a T to the pixels of \a runs on the depth grid of \a output through the color space points
+in \a p_ColorPoints . \a p_Source with \a sourceStep bytes per row has \a nSourceWidth x \a nSourceHeight pixels,
+other pixels of \a output are left untouched.
+*/
+template<typename T>
+static void alignColorRunsKernel(const ColorSpacePoint *p_ColorPoints, const std::vector<KCV_run> &runs,
+	const uchar *p_Source, size_t sourceStep, int nSourceWidth, int nSourceHeight, cv::Mat &output)
+{
+	for (size_t i = 0; i < runs.size(); ++i)
+	{
+		const KCV_run &run = runs[i];
+		const ColorSpacePoint *p_Row = p_ColorPoints + run.y * output.cols;
+		T *p_Output = output.ptr<T>(run.y);
+		for (int x = run.begin; x < run.end; ++x)
+		{
+			ColorSpacePoint p = p_Row[x];
+			if (p.X == -std::numeric_limits<float>::infinity() || p.Y == -std::numeric_limits<float>::infinity())
+				continue;
+
+			int colorX = static_cast<int>(p.X + 0.5f);
+			int colorY = static_cast<int>(p.Y + 0.5f);
+			if ((colorX >= 0 && colorX < nSourceWidth) && (colorY >= 0 && colorY < nSourceHeight))
+			{
+				p_Output[x] = reinterpret_cast<const T*>(p_Source + colorY * sourceStep)[colorX];
+			}
+		}
+	}
+}
+
+/*!
+Align foreground depth to \a output on the color grid. Only color pixels inside the color bounding boxes of the blobs,
+found through \a p_ColorPoints of the runs, are visited and written when their depth space point in \a p_DepthPoints
+is a foreground pixel of \a p_DepthBuffer with \a depthStep bytes per row. Other pixels of \a output are left untouched.
+*/
+static void alignDepthRunsKernel(const DepthSpacePoint *p_DepthPoints, const ColorSpacePoint *p_ColorPoints,
+	const uchar *p_DepthBuffer, size_t depthStep, const KCV_foreground &foreground, cv::Mat &output)
+{
+	const int nDepthWidth = foreground.mask.cols, nDepthHeight = foreground.mask.rows;
+	const int nColorWidth = output.cols, nColorHeight = output.rows;
+
+	// color bounding boxes of the blobs
+	std::vector<cv::Vec4i> boxes(foreground.blobs.size(), cv::Vec4i(INT_MAX, INT_MAX, INT_MIN, INT_MIN));
+	for (size_t i = 0; i < foreground.runs.size(); ++i)
+	{
+		const KCV_run &run = foreground.runs[i];
+		cv::Vec4i &box = boxes[run.blob];
+		const ColorSpacePoint *p_Row = p_ColorPoints + run.y * nDepthWidth;
+		for (int x = run.begin; x < run.end; ++x)
+		{
+			ColorSpacePoint p = p_Row[x];
+			if (p.X == -std::numeric_limits<float>::infinity() || p.Y == -std::numeric_limits<float>::infinity())
+				continue;
+			int colorX = static_cast<int>(p.X + 0.5f);
+			int colorY = static_cast<int>(p.Y + 0.5f);
+			box[0] = std::min(box[0], colorX);
+			box[1] = std::min(box[1], colorY);
+			box[2] = std::max(box[2], colorX);
+			box[3] = std::max(box[3], colorY);
+		}
+	}
+
+	// a depth pixel covers a few color pixels around its mapped center, rounding adds as many
+	const int border = 2 * ((nColorWidth + nDepthWidth - 1) / nDepthWidth);
+	for (size_t b = 0; b < boxes.size(); ++b)
+	{
+		const cv::Vec4i &box = boxes[b];
+		const int x0 = std::max(box[0] - border, 0), y0 = std::max(box[1] - border, 0);
+		const int x1 = std::min(box[2] + border + 1, nColorWidth), y1 = std::min(box[3] + border + 1, nColorHeight);
+		for (int y = y0; y < y1; ++y)
+		{
+			const DepthSpacePoint *p_Row = p_DepthPoints + y * nColorWidth;
+			UINT16 *p_Output = output.ptr<UINT16>(y);
+			for (int x = x0; x < x1; ++x)
+			{
+				DepthSpacePoint p = p_Row[x];
+				int depthX = static_cast<int>(p.X + 0.5f);
+				int depthY = static_cast<int>(p.Y + 0.5f);
+				if ((depthX >= 0 && depthX < nDepthWidth) && (depthY >= 0 && depthY < nDepthHeight) &&
+					foreground.mask.ptr<UCHAR>(depthY)[depthX] != 0)
+				{
+					p_Output[x] = reinterpret_cast<const UINT16*>(p_DepthBuffer + depthY * depthStep)[depthX];
+				}
+			}
+		}
+	}
+}
+
+/*!
+Writes the KCV_rgbd record of every depth pixel, as part of a KCV_rgbdPoint when \a p_CameraPoints is given.
+Depth and infrared, when given, are read in place and color is sampled once through \a p_ColorPoints ,
+rows are split across cores.
+*/
+class KCV_rgbdBody : public cv::ParallelLoopBody
+{
+public:
+	KCV_rgbdBody(const ColorSpacePoint *p_ColorPoints, const CameraSpacePoint *p_CameraPoints, const uchar *p_DepthBuffer, size_t depthStep,
+		const uchar *p_ColorBuffer, size_t colorStep, int nColorWidth, int nColorHeight, const uchar *p_InfraredBuffer, size_t infraredStep,
+		cv::Mat &output)
+		: m_ColorPoints(p_ColorPoints), m_CameraPoints(p_CameraPoints), m_DepthBuffer(p_DepthBuffer), m_DepthStep(depthStep),
+		m_ColorBuffer(p_ColorBuffer), m_ColorStep(colorStep), m_ColorWidth(nColorWidth), m_ColorHeight(nColorHeight),
+		m_InfraredBuffer(p_InfraredBuffer), m_InfraredStep(infraredStep), m_Output(output)
+	{
+	}
+
+	void operator()(const cv::Range &range) const
+	{
+		const int width = m_Output.cols;
+		const size_t recordSize = m_Output.elemSize();
+		for (int y = range.start; y < range.end; ++y)
+		{
+			const ColorSpacePoint *p_Color = m_ColorPoints + y * width;
+			const UINT16 *p_Depth = reinterpret_cast<const UINT16*>(m_DepthBuffer + y * m_DepthStep);
+			const UINT16 *p_Infrared = m_InfraredBuffer != NULL ? reinterpret_cast<const UINT16*>(m_InfraredBuffer + y * m_InfraredStep) : NULL;
+			uchar *p_Output = m_Output.ptr(y);
+			for (int x = 0; x < width; ++x, p_Output += recordSize)
+			{
+				KCV_rgbd record = KCV_rgbd();
+				const UINT16 depth = p_Depth[x];
+				if (depth != 0 && depth != USHRT_MAX)
+				{
+					record.depth = depth;
+					record.flags |= KCV_RGBD_DEPTH;
+				}
+				if (p_Infrared != NULL)
+				{
+					record.infrared = p_Infrared[x];
+					record.flags |= KCV_RGBD_INFRARED;
+				}
+
+				// Values that are negative infinity means it is an invalid color to depth mapping
+				const ColorSpacePoint p = p_Color[x];
+				if (p.X != -std::numeric_limits<float>::infinity() && p.Y != -std::numeric_limits<float>::infinity())
+				{
+					int colorX = static_cast<int>(p.X + 0.5f);
+					int colorY = static_cast<int>(p.Y + 0.5f);
+					if ((colorX >= 0 && colorX < m_ColorWidth) && (colorY >= 0 && colorY < m_ColorHeight))
+					{
+						const RGBQUAD &color = reinterpret_cast<const RGBQUAD*>(m_ColorBuffer + colorY * m_ColorStep)[colorX];
+						record.b = color.rgbBlue;
+						record.g = color.rgbGreen;
+						record.r = color.rgbRed;
+						record.flags |= KCV_RGBD_COLOR;
+					}
+				}
+
+				if (m_CameraPoints != NULL)
+				{
+					const CameraSpacePoint &q = m_CameraPoints[y * width + x];
+					if (q.Z > 0.0f && q.Z != std::numeric_limits<float>::infinity())
+						record.flags |= KCV_RGBD_POINT;
+					KCV_rgbdPoint *p_Point = reinterpret_cast<KCV_rgbdPoint*>(p_Output);
+					p_Point->x = q.X;
+					p_Point->y = q.Y;
+					p_Point->z = q.Z;
+				}
+				*reinterpret_cast<KCV_rgbd*>(p_Output) = record;
+			}
+		}
+	}
+
+private:
+	const ColorSpacePoint *m_ColorPoints;
+	const CameraSpacePoint *m_CameraPoints;
+	const uchar *m_DepthBuffer;
+	size_t m_DepthStep;
+	const uchar *m_ColorBuffer;
+	size_t m_ColorStep;
+	int m_ColorWidth;
+	int m_ColorHeight;
+	const uchar *m_InfraredBuffer;
+	size_t m_InfraredStep;
+	cv::Mat &m_Output;
+};
+
+// JET colors of the 256 visualised depth levels, see jetColors()
+static std::once_flag g_JetOnce;
+static cv::Mat g_JetColors;
+
+/*!
+Returns JET colors of the 256 visualised depth levels, built once by the first caller.
+Function local statics are not initialised thread safe by VS2013, call_once is.
+*/
+static const cv::Vec3b *jetColors()
+{
+	std::call_once(g_JetOnce, []()
+	{
+		cv::Mat ramp(1, 256, CV_8UC1);
+		for (int i = 0; i < 256; ++i)
+			ramp.at<uchar>(i) = static_cast<uchar>(i);
+		applyColorMap(ramp, g_JetColors, cv::COLORMAP_JET);
+	});
+	return g_JetColors.ptr<cv::Vec3b>();
+}
+
+/*!
+Add time since \a start to \a cost of \a budget , when given, and restart \a start .
+*/
+static void recordCost(KCV_budget *budget, KCV_cost cost, int64 &start)
+{
+	int64 now = cv::getTickCount();
+	if (budget != NULL)
+	{
+		budget->record(cost, (now - start) * 1000.0 / cv::getTickFrequency());
+	}
+	start = now;
+}
+
+/*!
+Copy the frame of \a p_Reference to \a frame (CV_16U), its storage is reused when the size matches.
+*/
+template<typename Reference, typename Frame>
+static HRESULT copyFrame(Reference *p_Reference, cv::Mat &frame)
+{
+	Frame *p_Frame = NULL;
+	IFrameDescription *p_FrameDescription = NULL;
+	int nWidth = 0;
+	int nHeight = 0;
+
+	HRESULT hr = p_Reference->AcquireFrame(&p_Frame);
+	if (SUCCEEDED(hr))
+	{
+		hr = p_Frame->get_FrameDescription(&p_FrameDescription);
+	}
+	if (SUCCEEDED(hr))
+	{
+		hr = p_FrameDescription->get_Width(&nWidth);
+	}
+	if (SUCCEEDED(hr))
+	{
+		hr = p_FrameDescription->get_Height(&nHeight);
+	}
+	if (SUCCEEDED(hr))
+	{
+		if (!frame.isContinuous())
+			frame.release();
+		frame.create(nHeight, nWidth, CV_16U);
+		hr = p_Frame->CopyFrameDataToArray(nHeight * nWidth, reinterpret_cast<UINT16*>(frame.data));
+	}
+
+	SafeRelease(p_FrameDescription);
+	SafeRelease(p_Frame);
+	return hr;
+}
+
+/*!
+Constructs a KCV_sensor object, the device is opened when \a open is true.
+*/
+KCV_sensor::KCV_sensor(bool open)
+	: m_DepthFrameReader(NULL), m_ColorFrameReader(NULL), m_MultiSourceFrameReader(NULL), m_KinectSensor(NULL),
+	m_CoordinateMapper(NULL), m_Published(-1), m_MappingSequence(0), m_EstimateNormals(false), m_EstimateCurvature(false),
+	m_FrameSources(FrameSourceTypes::FrameSourceTypes_Depth | FrameSourceTypes::FrameSourceTypes_Color), m_UseSynthetic(false)
+{
+	this->status = open ? initialize() : E_PENDING;
+}
+
+/*!
+Open the device when the sensor was created without it. Loaded calibration and mapCoordinates()
+work without the device, loadCalibration() then needs the serial.
 */
-KCV_sensor::KCV_sensor()
+HRESULT KCV_sensor::openDevice()
 {
-	this->status = initialize();
+	if (m_KinectSensor == NULL)
+	{
+		this->status = initialize();
+	}
+	return this->status;
 }
 
 /*!
@@ -57,9 +447,13 @@ Basic sensor initialisation.
 HRESULT KCV_sensor::initSensor()
 {
 
-	m_DepthCoordinates = NULL;
-	m_ColorCoordinates = NULL;
-	m_CameraCoordinates = NULL;
+	for (int i = 0; i < KCV_MAPPING_SLOTS; ++i)
+	{
+		m_Mappings[i].depthCoordinates = NULL;
+		m_Mappings[i].colorCoordinates = NULL;
+		m_Mappings[i].cameraCoordinates = NULL;
+	}
+	m_Published = -1;
 
 	//this->status = this->initialize();
 	return this->status;
@@ -70,9 +464,18 @@ Init sensor with provided information about color \a c_width , \a c_height and d
 */
 HRESULT KCV_sensor::initSensor(int c_width, int c_height, int d_width, int d_height)
 {
-	m_DepthCoordinates = new DepthSpacePoint[1920 * 1080];
-	m_ColorCoordinates = new ColorSpacePoint[512 * 424];
-	m_CameraCoordinates = new CameraSpacePoint[512 * 424];
+	for (int i = 0; i < KCV_MAPPING_SLOTS; ++i)
+	{
+		// kept when closeAll() left them to views still held
+		if (m_Mappings[i].depthCoordinates == NULL)
+		{
+			m_Mappings[i].depthCoordinates = new DepthSpacePoint[1920 * 1080];
+			m_Mappings[i].colorCoordinates = new ColorSpacePoint[512 * 424];
+			m_Mappings[i].cameraCoordinates = new CameraSpacePoint[512 * 424];
+		}
+		m_Mappings[i].sequence = 0;
+	}
+	m_Published = -1;
 	coordMapped = false;
 
 	this->c_frame_width_scale = (float)(1920.0f / (float)c_width);
@@ -119,8 +522,7 @@ HRESULT KCV_sensor::openMultiStream()
 
 		if (SUCCEEDED(hr))
 		{
-			hr = m_KinectSensor->OpenMultiSourceFrameReader(
-				FrameSourceTypes::FrameSourceTypes_Depth | FrameSourceTypes::FrameSourceTypes_Color, &m_MultiSourceFrameReader);
+			hr = m_KinectSensor->OpenMultiSourceFrameReader(m_FrameSources, &m_MultiSourceFrameReader);
 		}
 	}
 
@@ -226,10 +628,106 @@ HRESULT KCV_sensor::openDepthStream()
 }
 
 /*!
-Acquire depth \a depth_frame and color \a color_frame images from the sensor.
+Acquire depth \a depth_frame and color \a color_frame images from the sensor and map their coordinates.
+Every call returns the images in new buffers, images of earlier calls kept by the caller are never overwritten;
+acquireRawImages reuses the storage instead. The cost of every part is measured by the frame budget, see getBudget().
+When the budget is exceeded \a color_frame may keep the image of an earlier call. Without a color frame, with the
+color stream disabled, only camera coordinates are mapped, see KCV_mappingView::isColorMapped().
+Returns E_PENDING, the images acquired but not mapped, while views of the older mappings are held, see acquireMapping().
 */
 HRESULT KCV_sensor::acquireImages(cv::Mat &depth_frame, cv::Mat &color_frame)
 {
+	return acquireMapped(depth_frame, color_frame, NULL, NULL);
+}
+
+/*!
+Acquire depth \a depth_frame , color \a color_frame , infrared \a infrared_frame and long exposure infrared
+\a long_exposure_frame images from the sensor and map their coordinates. Infrared images are empty unless
+their streams are enabled by setFrameSources(), they share the depth grid and need no mapping.
+*/
+HRESULT KCV_sensor::acquireImages(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat &infrared_frame, cv::Mat &long_exposure_frame)
+{
+	return acquireMapped(depth_frame, color_frame, &infrared_frame, &long_exposure_frame);
+}
+
+/*!
+Acquire images like acquireImages, infrared images are acquired when \a p_InfraredFrame and \a p_LongExposureFrame are given.
+*/
+HRESULT KCV_sensor::acquireMapped(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat *p_InfraredFrame, cv::Mat *p_LongExposureFrame)
+{
+	m_Budget.beginFrame();
+	bool acquire_color = color_frame.empty() || m_Budget.acquireColor();
+
+	// detach from the buffers of earlier calls, acquireFrames then allocates new ones
+	depth_frame.release();
+	if (acquire_color)
+		color_frame.release();
+	if (p_InfraredFrame != NULL)
+		p_InfraredFrame->release();
+	if (p_LongExposureFrame != NULL)
+		p_LongExposureFrame->release();
+
+	int64 start = cv::getTickCount();
+	HRESULT hr = acquireFrames(depth_frame, color_frame, p_InfraredFrame, p_LongExposureFrame, acquire_color);
+	recordCost(&m_Budget, KCV_COST_ACQUIRE, start);
+	if (FAILED(hr))
+	{
+		m_Budget.discardFrame();
+		return hr;
+	}
+	hr = coordinateMapper(reinterpret_cast<UINT16*>(depth_frame.data), depth_frame.cols, depth_frame.rows,
+		reinterpret_cast<RGBQUAD*>(color_frame.data), color_frame.cols, color_frame.rows, &m_Budget);
+	if (FAILED(hr))
+	{
+		// a frame left unmapped, e.g. E_PENDING while views hold the slots, is not accounted
+		m_Budget.discardFrame();
+	}
+	return hr;
+}
+
+/*!
+Acquire depth \a depth_frame and color \a color_frame images from the sensor without mapping.
+Frame data is copied straight into the images, their storage is reused when the size matches.
+\a color_frame is left untouched unless \a acquire_color is set.
+*/
+HRESULT KCV_sensor::acquireRawImages(cv::Mat &depth_frame, cv::Mat &color_frame, bool acquire_color)
+{
+	return acquireFrames(depth_frame, color_frame, NULL, NULL, acquire_color);
+}
+
+/*!
+Acquire depth \a depth_frame , color \a color_frame , infrared \a infrared_frame and long exposure infrared
+\a long_exposure_frame images from the sensor without mapping, see acquireRawImages.
+*/
+HRESULT KCV_sensor::acquireRawImages(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat &infrared_frame,
+	cv::Mat &long_exposure_frame, bool acquire_color)
+{
+	return acquireFrames(depth_frame, color_frame, &infrared_frame, &long_exposure_frame, acquire_color);
+}
+
+/*!
+Acquire images of the enabled streams from the device or the synthetic source, infrared images are acquired
+when \a p_InfraredFrame and \a p_LongExposureFrame are given and released when their stream is off.
+*/
+HRESULT KCV_sensor::acquireFrames(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat *p_InfraredFrame, cv::Mat *p_LongExposureFrame,
+	bool acquire_color)
+{
+	acquire_color = acquire_color && (m_FrameSources & FrameSourceTypes::FrameSourceTypes_Color) != 0;
+	if (p_InfraredFrame != NULL && !(m_FrameSources & FrameSourceTypes::FrameSourceTypes_Infrared))
+	{
+		p_InfraredFrame->release();
+		p_InfraredFrame = NULL;
+	}
+	if (p_LongExposureFrame != NULL && !(m_FrameSources & FrameSourceTypes::FrameSourceTypes_LongExposureInfrared))
+	{
+		p_LongExposureFrame->release();
+		p_LongExposureFrame = NULL;
+	}
+
+	if (m_UseSynthetic)
+	{
+		return m_Synthetic.acquire(depth_frame, color_frame, p_InfraredFrame, p_LongExposureFrame, acquire_color);
+	}
 	if (!this->m_MultiSourceFrameReader)
 	{
 		return E_FAIL;
@@ -254,7 +752,7 @@ HRESULT KCV_sensor::acquireImages(cv::Mat &depth_frame, cv::Mat &color_frame)
 		SafeRelease(p_DepthFrameReference);
 	}
 
-	if (SUCCEEDED(hr))
+	if (SUCCEEDED(hr) && acquire_color)
 	{
 		IColorFrameReference* p_ColorFrameReference = NULL;
 
@@ -272,17 +770,10 @@ HRESULT KCV_sensor::acquireImages(cv::Mat &depth_frame, cv::Mat &color_frame)
 		IFrameDescription *p_DepthFrameDescription = NULL;
 		int nDepthWidth = 0;
 		int nDepthHeight = 0;
-		UINT nDepthBufferSize = 0;
-		UINT16 *p_DepthBuffer = NULL;
-		USHORT nDepthMinReliableDistance = 0;
-		USHORT nDepthMaxReliableDistance = 0;
 
 		IFrameDescription* p_ColorFrameDescription = NULL;
 		int nColorWidth = 0;
 		int nColorHeight = 0;
-		ColorImageFormat imageFormat = ColorImageFormat_None;
-		UINT nColorBufferSize = 0;
-		RGBQUAD *p_ColorBuffer = NULL;
 
 		// get depth frame data
 
@@ -290,14 +781,6 @@ HRESULT KCV_sensor::acquireImages(cv::Mat &depth_frame, cv::Mat &color_frame)
 		{
 			hr = p_DepthFrame->get_FrameDescription(&p_DepthFrameDescription);
 		}
-		if (SUCCEEDED(hr))
-		{
-			hr = p_DepthFrame->get_DepthMinReliableDistance(&nDepthMinReliableDistance);
-			if (SUCCEEDED(hr))
-			{
-				hr = p_DepthFrame->get_DepthMaxReliableDistance(&nDepthMaxReliableDistance);
-			}
-		}
 
 		if (SUCCEEDED(hr))
 		{
@@ -311,65 +794,63 @@ HRESULT KCV_sensor::acquireImages(cv::Mat &depth_frame, cv::Mat &color_frame)
 
 		if (SUCCEEDED(hr))
 		{
-			p_DepthBuffer = new UINT16[nDepthWidth * nDepthHeight];
-			p_DepthFrame->CopyFrameDataToArray(nDepthHeight * nDepthWidth, p_DepthBuffer);
-		}
-		// for depth map visualisation
-		if (SUCCEEDED(hr))
-		{
-			cv::Mat depthMap = cv::Mat(nDepthHeight, nDepthWidth, CV_16U, p_DepthBuffer);
-			depth_frame = depthMap.clone();
+			if (!depth_frame.isContinuous())
+				depth_frame.release();
+			depth_frame.create(nDepthHeight, nDepthWidth, CV_16U);
+			hr = p_DepthFrame->CopyFrameDataToArray(nDepthHeight * nDepthWidth, reinterpret_cast<UINT16*>(depth_frame.data));
 		}
 
 		// get color frame data
 
-		if (SUCCEEDED(hr))
+		if (SUCCEEDED(hr) && acquire_color)
 		{
 			hr = p_ColorFrame->get_FrameDescription(&p_ColorFrameDescription);
 		}
 
-		if (SUCCEEDED(hr))
+		if (SUCCEEDED(hr) && acquire_color)
 		{
 			hr = p_ColorFrameDescription->get_Width(&nColorWidth);
 		}
 
-		if (SUCCEEDED(hr))
+		if (SUCCEEDED(hr) && acquire_color)
 		{
 			hr = p_ColorFrameDescription->get_Height(&nColorHeight);
 		}
 
-		if (SUCCEEDED(hr))
+		if (SUCCEEDED(hr) && acquire_color)
 		{
-			p_ColorBuffer = new RGBQUAD[nColorHeight * nColorWidth];
+			if (!color_frame.isContinuous())
+				color_frame.release();
+			color_frame.create(nColorHeight, nColorWidth, CV_8UC4);
 			hr = p_ColorFrame->CopyConvertedFrameDataToArray(nColorHeight * nColorWidth * sizeof(RGBQUAD),
-				reinterpret_cast<BYTE*>(p_ColorBuffer), ColorImageFormat_Bgra);
-		}
-		if (SUCCEEDED(hr))
-		{
-			cv::Mat image(nColorHeight, nColorWidth, CV_8UC4,
-				reinterpret_cast<void*>(p_ColorBuffer));
-			color_frame = image.clone();
+				reinterpret_cast<BYTE*>(color_frame.data), ColorImageFormat_Bgra);
 		}
+
+		SafeRelease(p_DepthFrameDescription);
+		SafeRelease(p_ColorFrameDescription);
+	}
+
+	// infrared shares the depth grid and is copied as it is
+	if (SUCCEEDED(hr) && p_InfraredFrame != NULL)
+	{
+		IInfraredFrameReference *p_InfraredFrameReference = NULL;
+		hr = p_MultiSourceFrame->get_InfraredFrameReference(&p_InfraredFrameReference);
 		if (SUCCEEDED(hr))
 		{
-			hr = coordinateMapper(p_DepthBuffer, nDepthWidth, nDepthHeight,
-				p_ColorBuffer, nColorWidth, nColorHeight);
+			hr = copyFrame<IInfraredFrameReference, IInfraredFrame>(p_InfraredFrameReference, *p_InfraredFrame);
 		}
+		SafeRelease(p_InfraredFrameReference);
+	}
 
-		// release buffers
-		if (p_ColorBuffer != NULL)
-		{
-			delete[] p_ColorBuffer;
-			p_ColorBuffer = NULL;
-		}
-		if (p_DepthBuffer != NULL)
+	if (SUCCEEDED(hr) && p_LongExposureFrame != NULL)
+	{
+		ILongExposureInfraredFrameReference *p_LongExposureFrameReference = NULL;
+		hr = p_MultiSourceFrame->get_LongExposureInfraredFrameReference(&p_LongExposureFrameReference);
+		if (SUCCEEDED(hr))
 		{
-			delete[] p_DepthBuffer;
-			p_DepthBuffer = NULL;
+			hr = copyFrame<ILongExposureInfraredFrameReference, ILongExposureInfraredFrame>(p_LongExposureFrameReference, *p_LongExposureFrame);
 		}
-
-		SafeRelease(p_DepthFrameDescription);
-		SafeRelease(p_ColorFrameDescription);
+		SafeRelease(p_LongExposureFrameReference);
 	}
 
 	SafeRelease(p_DepthFrame);
@@ -380,262 +861,852 @@ HRESULT KCV_sensor::acquireImages(cv::Mat &depth_frame, cv::Mat &color_frame)
 }
 
 /*!
-Visualise \a depth_frame to 8 bit \a depth_frame_vis.
+Visualise \a depth_frame to 8 bit \a depth_frame_vis , its storage is reused when the size matches.
 */
-void KCV_sensor::visualiseDepthMap(cv::Mat depth_frame, cv::Mat &depth_frame_vis)
+void KCV_sensor::visualiseDepthMap(cv::InputArray depth_frame, cv::OutputArray depth_frame_vis)
 {
-	cv::Mat img0 = cv::Mat::zeros(depth_frame.rows, depth_frame.cols, CV_8UC1);
+	cv::Mat depth = depth_frame.getMat();
+	depth_frame_vis.create(depth.rows, depth.cols, CV_8UC3);
+	cv::Mat vis = depth_frame_vis.getMat();
 
-	double scale = 255.0 / (4500 -
+	const float scale = 255.0f / (4500 -
 		500); // 50 cm a 4.5 m
-	depth_frame.convertTo(img0, CV_8UC1, scale);
-	applyColorMap(img0, depth_frame_vis, cv::COLORMAP_JET);
+	const cv::Vec3b *colors = jetColors();
+	for (int y = 0; y < depth.rows; ++y)
+	{
+		const UINT16 *p_Depth = depth.ptr<UINT16>(y);
+		cv::Vec3b *p_Vis = vis.ptr<cv::Vec3b>(y);
+		for (int x = 0; x < depth.cols; ++x)
+		{
+			p_Vis[x] = colors[cv::saturate_cast<uchar>(p_Depth[x] * scale)];
+		}
+	}
 }
 
 /*!
 Set coordinate mapper for given \a p_DepthBuffer , \a nDepthWidth , \a nDepthHeight , \a p_colorBuffer , \a nColorWidth and \a nColorHeight.
+With \a budget the mapping parts are measured and the color to depth mapping of the previous frame may be reused.
+Returns E_PENDING, publishing nothing, while views hold every spare mapping slot.
 */
 HRESULT KCV_sensor::coordinateMapper(const UINT16* p_DepthBuffer, int nDepthWidth, int nDepthHeight,
-	const RGBQUAD* p_ColorBuffer, int nColorWidth, int nColorHeight)
+	const RGBQUAD* p_ColorBuffer, int nColorWidth, int nColorHeight, KCV_budget *budget)
 {
-	HRESULT hr = m_CoordinateMapper->MapDepthFrameToColorSpace(nDepthWidth * nDepthHeight, (UINT16*)p_DepthBuffer, nDepthWidth * nDepthHeight, m_ColorCoordinates);
-	if (SUCCEEDED(hr))
-		hr = m_CoordinateMapper->MapColorFrameToDepthSpace(nDepthWidth * nDepthHeight, (UINT16*)p_DepthBuffer, nColorWidth * nColorHeight, m_DepthCoordinates);
+	std::lock_guard<std::mutex> lock(m_MappingMutex);
+	KCV_mapping *mapping;
+	HRESULT hr = beginMapping(mapping);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	// without a color frame, e.g. with its stream disabled, only camera coordinates are mapped
+	const bool color = p_ColorBuffer != NULL && nColorWidth > 0 && nColorHeight > 0;
+	const cv::Size colorSize = color ? cv::Size(nColorWidth, nColorHeight) : cv::Size();
+	if (!color)
+	{
+		nColorWidth = m_Calibration.colorWidth();
+		nColorHeight = m_Calibration.colorHeight();
+	}
+
+	// the published slot is never written while the mapping mutex is held
+	KCV_mapping *previous = m_Published >= 0 ? &m_Mappings[m_Published] : NULL;
+	bool reuse = color && budget != NULL && previous != NULL && previous->colorMapped && previous->colorSize == colorSize &&
+		budget->skipColorToDepth();
+
+	hr = mapFrame(p_DepthBuffer, nDepthWidth, nDepthHeight, nColorWidth, nColorHeight, color ? mapping->colorCoordinates : NULL,
+		color && !reuse ? mapping->depthCoordinates : NULL, mapping->cameraCoordinates, budget);
+	if (SUCCEEDED(hr) && reuse)
+	{
+		int64 start = cv::getTickCount();
+		memcpy(mapping->depthCoordinates, previous->depthCoordinates, colorSize.area() * sizeof(DepthSpacePoint));
+		recordCost(budget, KCV_COST_COLOR_TO_DEPTH, start);
+	}
 	if (SUCCEEDED(hr))
-		hr = m_CoordinateMapper->MapDepthFrameToCameraSpace(nDepthWidth * nDepthHeight, (UINT16*)p_DepthBuffer, nDepthWidth * nDepthHeight, m_CameraCoordinates);
+	{
+		cv::Mat(nDepthHeight, nDepthWidth, CV_16U, const_cast<UINT16*>(p_DepthBuffer)).copyTo(mapping->depth);
+		mapping->colorSize = colorSize;
+		mapping->colorMapped = color;
+		estimateNormals(mapping, nDepthWidth, nDepthHeight, budget);
+		publishMapping(mapping);
+	}
 	return hr;
 }
 
 /*!
-Maps \a depthImage with set \a nDepthWidth and \a nDepthHeight to camera space.
+Map \a p_DepthBuffer with \a nDepthWidth and \a nDepthHeight to color space \a p_ColorPoints ,
+color frame with \a nColorWidth and \a nColorHeight to depth space \a p_DepthPoints and
+depth frame to camera space \a p_CameraPoints . Depth to color and color to depth mappings are skipped when
+\a p_ColorPoints and \a p_DepthPoints are NULL, the cost of every mapping is recorded to \a budget when given.
 */
-HRESULT KCV_sensor::mapDepthFrameToCameraSpace(cv::Mat depthImage, int nDepthWidth, int nDepthHeight)
+HRESULT KCV_sensor::mapFrame(const UINT16* p_DepthBuffer, int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight,
+	ColorSpacePoint *p_ColorPoints, DepthSpacePoint *p_DepthPoints, CameraSpacePoint *p_CameraPoints, KCV_budget *budget)
 {
-	UINT16 *p_DepthBuffer = (UINT16*)depthImage.data;
-	HRESULT hr = m_CoordinateMapper->MapDepthFrameToCameraSpace(nDepthWidth * nDepthHeight, (UINT16*)p_DepthBuffer, nDepthWidth * nDepthHeight, m_CameraCoordinates);
-	return hr;
-}
+	bool calibrated = useCalibration(nDepthWidth, nDepthHeight, nColorWidth, nColorHeight);
+	if (!calibrated && m_CoordinateMapper == NULL)
+	{
+		return E_FAIL;
+	}
 
-/*!
-Align intensity frame \a aligned_intensity_frame with specified \a aligned_frame_width and \a aligned_frame_height based on
-\a intensity_frame with specified \a nIntensityWidth and \a nIntensityHeight with provided \a nDepthWidth and \a nDepthHeight .
-*/
-void KCV_sensor::alignIntensityFrame(int nDepthWidth, int nDepthHeight,
-	cv::Mat intensity_frame, int nIntensityWidth, int nIntensityHeight, cv::Mat &aligned_intensity_frame, int aligned_frame_width, int aligned_frame_height)
-{
-	UCHAR *m_pOutputX = new UCHAR[nDepthWidth * nDepthHeight];
-	UCHAR *buffer = intensity_frame.data;
+	const UINT nDepthPoints = nDepthWidth * nDepthHeight;
+	int64 start = cv::getTickCount();
 
-	for (int intensityIndex = 0; intensityIndex < (nDepthWidth * nDepthHeight); ++intensityIndex)
+	HRESULT hr = S_OK;
+	if (p_ColorPoints != NULL)
 	{
+		hr = calibrated ? m_Calibration.mapDepthFrameToColorSpace(p_DepthBuffer, p_ColorPoints)
+			: m_CoordinateMapper->MapDepthFrameToColorSpace(nDepthPoints, (UINT16*)p_DepthBuffer, nDepthPoints, p_ColorPoints);
+		recordCost(budget, KCV_COST_DEPTH_TO_COLOR, start);
+	}
 
-		UCHAR pSrc = NULL;
-
-		ColorSpacePoint p = m_ColorCoordinates[intensityIndex];
+	if (SUCCEEDED(hr) && p_DepthPoints != NULL)
+	{
+		hr = calibrated ? m_Calibration.mapColorFrameToDepthSpace(p_DepthBuffer, p_DepthPoints)
+			: m_CoordinateMapper->MapColorFrameToDepthSpace(nDepthPoints, (UINT16*)p_DepthBuffer, nColorWidth * nColorHeight, p_DepthPoints);
+		recordCost(budget, KCV_COST_COLOR_TO_DEPTH, start);
+	}
 
-		// Values that are negative infinity means it is an invalid color to depth mapping 
-		if (p.X != -std::numeric_limits<float>::infinity() && p.Y != -std::numeric_limits<float>::infinity())
-		{
-			int intensityX = static_cast<int>(p.X + 0.5f);
-			int intensityY = static_cast<int>(p.Y + 0.5f);
+	if (SUCCEEDED(hr))
+	{
+		hr = calibrated ? m_Calibration.mapDepthFrameToCameraSpace(p_DepthBuffer, p_CameraPoints)
+			: m_CoordinateMapper->MapDepthFrameToCameraSpace(nDepthPoints, (UINT16*)p_DepthBuffer, nDepthPoints, p_CameraPoints);
+		recordCost(budget, KCV_COST_DEPTH_TO_CAMERA, start);
+	}
+	return hr;
+}
 
-			if ((intensityX >= 0 && intensityX < nIntensityWidth) && (intensityY >= 0 && intensityY < nIntensityHeight))
-			{
-				// set source for copy to the pixel
-				pSrc = buffer[intensityY*nIntensityWidth + intensityX];
-			}
-		}
+/*!
+Map \a depth_frame to per frame \a color_coordinates (CV_32FC2, depth grid), \a depth_coordinates
+(CV_32FC2, \a nColorWidth x \a nColorHeight color grid) and \a camera_coordinates (CV_32FC3, depth grid).
+Without a color frame, \a nColorWidth or \a nColorHeight zero, \a depth_coordinates is released and only the depth grid is mapped.
+Does not touch the sensor coordinate buffers, so several frames can be mapped concurrently.
+*/
+HRESULT KCV_sensor::mapCoordinates(const cv::Mat &depth_frame, int nColorWidth, int nColorHeight,
+	cv::Mat &color_coordinates, cv::Mat &depth_coordinates, cv::Mat &camera_coordinates)
+{
+	if (depth_frame.empty() || depth_frame.type() != CV_16U || !depth_frame.isContinuous())
+	{
+		return E_INVALIDARG;
+	}
+	const bool color = nColorWidth > 0 && nColorHeight > 0;
+	color_coordinates.create(depth_frame.rows, depth_frame.cols, CV_32FC2);
+	camera_coordinates.create(depth_frame.rows, depth_frame.cols, CV_32FC3);
+	if (color)
+	{
+		depth_coordinates.create(nColorHeight, nColorWidth, CV_32FC2);
+	}
+	else
+	{
+		// the depth grid is mapped against the color camera of the calibration, when loaded
+		depth_coordinates.release();
+		nColorWidth = m_Calibration.colorWidth();
+		nColorHeight = m_Calibration.colorHeight();
+	}
+
+	return mapFrame(reinterpret_cast<const UINT16*>(depth_frame.data), depth_frame.cols, depth_frame.rows, nColorWidth, nColorHeight,
+		reinterpret_cast<ColorSpacePoint*>(color_coordinates.data), color ? reinterpret_cast<DepthSpacePoint*>(depth_coordinates.data) : NULL,
+		reinterpret_cast<CameraSpacePoint*>(camera_coordinates.data));
+}
 
-		// write output
-		if (pSrc != NULL)
+/*!
+Maps \a depthImage with set \a nDepthWidth and \a nDepthHeight to camera space. When it is the depth frame of the
+published mapping, its color and depth coordinates are kept, otherwise the new mapping has none,
+see KCV_mappingView::isColorMapped(), and functions needing them return E_PENDING.
+Returns E_PENDING, publishing nothing, while views hold every spare mapping slot.
+*/
+HRESULT KCV_sensor::mapDepthFrameToCameraSpace(cv::Mat depthImage, int nDepthWidth, int nDepthHeight)
+{
+	if (depthImage.type() != CV_16U || depthImage.cols != nDepthWidth || depthImage.rows != nDepthHeight ||
+		!depthImage.isContinuous() || nDepthWidth * nDepthHeight > 512 * 424)
+	{
+		return E_INVALIDARG;
+	}
+	UINT16 *p_DepthBuffer = (UINT16*)depthImage.data;
+	bool calibrated = useCalibration(nDepthWidth, nDepthHeight, m_Calibration.colorWidth(), m_Calibration.colorHeight());
+	if (!calibrated && m_CoordinateMapper == NULL)
+	{
+		return E_FAIL;
+	}
+
+	std::lock_guard<std::mutex> lock(m_MappingMutex);
+	KCV_mapping *mapping;
+	HRESULT hr = beginMapping(mapping);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	if (calibrated)
+		hr = m_Calibration.mapDepthFrameToCameraSpace(p_DepthBuffer, mapping->cameraCoordinates);
+	else
+		hr = m_CoordinateMapper->MapDepthFrameToCameraSpace(nDepthWidth * nDepthHeight, (UINT16*)p_DepthBuffer, nDepthWidth * nDepthHeight, mapping->cameraCoordinates);
+	if (SUCCEEDED(hr))
+	{
+		// the color maps of the published frame still hold when the same depth frame is mapped again,
+		// the slot's own belong to an older frame
+		const KCV_mapping *previous = m_Published >= 0 ? &m_Mappings[m_Published] : NULL;
+		mapping->colorMapped = previous != NULL && previous->colorMapped && previous->depth.size() == depthImage.size() &&
+			memcmp(previous->depth.data, depthImage.data, nDepthWidth * nDepthHeight * sizeof(UINT16)) == 0;
+		if (mapping->colorMapped)
 		{
-			m_pOutputX[intensityIndex] = pSrc;
+			memcpy(mapping->colorCoordinates, previous->colorCoordinates, nDepthWidth * nDepthHeight * sizeof(ColorSpacePoint));
+			memcpy(mapping->depthCoordinates, previous->depthCoordinates, previous->colorSize.area() * sizeof(DepthSpacePoint));
+			mapping->colorSize = previous->colorSize;
 		}
-		else
-			m_pOutputX[intensityIndex] = 0;
+		depthImage.copyTo(mapping->depth);
+		estimateNormals(mapping, nDepthWidth, nDepthHeight, NULL);
+		publishMapping(mapping);
 	}
-	// write image
-	cv::Mat image(nDepthHeight, nDepthWidth, CV_8UC1, reinterpret_cast<void*>(m_pOutputX));
-	cv::resize(image, aligned_intensity_frame, cv::Size(aligned_frame_width, aligned_frame_height));
-	image.release();
+	return hr;
+}
 
-	delete[] m_pOutputX;
-	m_pOutputX = NULL;
+/*!
+Constructs an empty mapping slot.
+*/
+KCV_mapping::KCV_mapping()
+	: depthCoordinates(NULL), colorCoordinates(NULL), cameraCoordinates(NULL), sequence(0), colorMapped(false), readers(0)
+{
 }
 
 /*!
-Align color frame to \a aligned_color_frame with \a aligned_frame_width and \a aligned_frame_height 
-based on \a color_frame with \a nColorWidth and \a nColorHeight from color stream 
-and \a nDepthWidth and \a nDepthHeight from depth stream
+Constructs view of published \a mapping , the caller already registered as its reader.
+*/
+KCV_mappingView::KCV_mappingView(KCV_mapping *mapping)
+	: m_Mapping(mapping)
+{
+}
+
+/*!
+Moves the view from \a other .
 */
-void KCV_sensor::alignColorFrame(int nDepthWidth, int nDepthHeight,
-	cv::Mat color_frame, int nColorWidth, int nColorHeight, cv::Mat &aligned_color_frame, int aligned_frame_width, int aligned_frame_height)
+KCV_mappingView::KCV_mappingView(KCV_mappingView &&other)
+	: m_Mapping(other.m_Mapping)
 {
-	RGBQUAD *m_pOutputRGBX = new RGBQUAD[nDepthWidth * nDepthHeight];
-	uchar *buffer = color_frame.data;
+	other.m_Mapping = NULL;
+}
 
-	for (int colorIndex = 0; colorIndex < (nDepthWidth * nDepthHeight); ++colorIndex)
+/*!
+Moves the view from \a other , releasing the current one.
+*/
+KCV_mappingView& KCV_mappingView::operator=(KCV_mappingView &&other)
+{
+	if (this != &other)
 	{
-		const RGBQUAD* pSrc = NULL;
+		release();
+		m_Mapping = other.m_Mapping;
+		other.m_Mapping = NULL;
+	}
+	return *this;
+}
 
-		ColorSpacePoint p = m_ColorCoordinates[colorIndex];
+/*!
+Destructor, the mapping may be reused afterwards.
+*/
+KCV_mappingView::~KCV_mappingView()
+{
+	release();
+}
 
-		// Values that are negative infinity means it is an invalid color to depth mapping
-		if (p.X != -std::numeric_limits<float>::infinity() && p.Y != -std::numeric_limits<float>::infinity())
-		{
-			int colorX = static_cast<int>(p.X + 0.5f);
-			int colorY = static_cast<int>(p.Y + 0.5f);
+/*!
+Stop reading the mapping.
+*/
+void KCV_mappingView::release()
+{
+	if (m_Mapping != NULL)
+	{
+		m_Mapping->readers--;
+		m_Mapping = NULL;
+	}
+}
 
-			if ((colorX >= 0 && colorX < nColorWidth) && (colorY >= 0 && colorY < nColorHeight))
-			{
-				// set source for copy to the color pixel
-				RGBQUAD *q;
-				q->rgbBlue = buffer[colorY*nColorWidth + colorX];
-				q->rgbGreen = buffer[colorY*nColorWidth + colorX + 1];
-				q->rgbRed = buffer[colorY*nColorWidth + colorX + 2];
-				q->rgbReserved = buffer[colorY*nColorWidth + colorX + 3];
-				pSrc = q;
-			}
+/*!
+Returns view of the last published mapping, invalid when nothing was mapped yet.
+Lock-free, the mapping stays unchanged while the view lives.
+*/
+KCV_mappingView KCV_sensor::acquireMapping()
+{
+	for (;;)
+	{
+		int published = m_Published;
+		if (published < 0)
+		{
+			return KCV_mappingView();
 		}
-
-		// write output
-		if (pSrc != NULL)
+		KCV_mapping *mapping = &m_Mappings[published];
+		mapping->readers++;
+		// the slot may have been replaced before we registered, retry then
+		if (m_Published == published)
 		{
-			m_pOutputRGBX[colorIndex] = *pSrc;
+			return KCV_mappingView(mapping);
 		}
+		mapping->readers--;
 	}
-	// write image
-	cv::Mat image(nDepthHeight, nDepthWidth, CV_8UC4, reinterpret_cast<void*>(m_pOutputRGBX));
-	cv::resize(image, aligned_color_frame, cv::Size(aligned_frame_width, aligned_frame_height));
-	image.release();
+}
+
+/*!
+Turn estimation of \a normals and \a curvature with window half size \a radius on or off for the next mappings.
+*/
+void KCV_sensor::setNormalEstimation(bool normals, bool curvature, int radius)
+{
+	std::lock_guard<std::mutex> lock(m_MappingMutex);
+	m_EstimateNormals = normals || curvature;
+	m_EstimateCurvature = curvature;
+	m_Normals.setRadius(radius);
+}
 
-	delete[] m_pOutputRGBX;
-	m_pOutputRGBX = NULL;
+/*!
+Set streams of the multi source reader to \a sources , FrameSourceTypes bits. Depth is always read, the reader is
+reopened when the streams change. Not to be called while frames are acquired.
+*/
+HRESULT KCV_sensor::setFrameSources(DWORD sources)
+{
+	sources |= FrameSourceTypes::FrameSourceTypes_Depth;
+	if (m_MultiSourceFrameReader != NULL && sources != m_FrameSources)
+	{
+		IMultiSourceFrameReader *p_MultiSourceFrameReader = NULL;
+		HRESULT hr = m_KinectSensor->OpenMultiSourceFrameReader(sources, &p_MultiSourceFrameReader);
+		if (FAILED(hr))
+		{
+			return hr;
+		}
+		SafeRelease(m_MultiSourceFrameReader);
+		m_MultiSourceFrameReader = p_MultiSourceFrameReader;
+	}
+	m_FrameSources = sources;
+	return S_OK;
 }
 
 /*!
-Align color frame to \a aligned_color_frame with \a nColorWidth and \a nColorHeight
-based on \a p_ColorBuffer from color stream
-and \a p_DepthBuffer with \a nDepthWidth and \a nDepthHeight from depth stream.
+Acquire frames of the synthetic source instead of the device when \a synthetic is set, the enabled streams apply to both.
+Enabling loads the calibration of the synthetic cameras in place of a loaded one, disabling drops it again, so synthetic
+frames are mapped and aligned consistently without the device. Not to be called while frames are acquired.
 */
-void KCV_sensor::alignColorFrame(const UINT16* p_DepthBuffer, int nDepthWidth, int nDepthHeight,
-	const RGBQUAD* p_ColorBuffer, int nColorWidth, int nColorHeight, cv::Mat &aligned_color_frame)
+void KCV_sensor::setSynthetic(bool synthetic)
 {
-	RGBQUAD *m_pOutputRGBX = new RGBQUAD[nDepthWidth * nDepthHeight];
+	if (synthetic && !m_UseSynthetic)
+	{
+		m_Synthetic.reset();
+		m_Synthetic.calibration(m_Calibration);
+	}
+	else if (!synthetic && m_UseSynthetic && m_Calibration.serial() == KCV_SYNTHETIC_SERIAL)
+	{
+		m_Calibration.release();
+	}
+	m_UseSynthetic = synthetic;
+}
 
-	for (int colorIndex = 0; colorIndex < (nDepthWidth * nDepthHeight); ++colorIndex)
+/*!
+Estimate normals of the camera coordinates in \a mapping with \a nDepthWidth and \a nDepthHeight ,
+the cost is recorded to \a budget when given. Called with mapping mutex held, before publishing.
+*/
+void KCV_sensor::estimateNormals(KCV_mapping *mapping, int nDepthWidth, int nDepthHeight, KCV_budget *budget)
+{
+	if (!m_EstimateNormals)
+	{
+		mapping->normals.release();
+		mapping->curvature.release();
+		return;
+	}
+	if (!m_EstimateCurvature)
 	{
-		const RGBQUAD* pSrc = NULL;
+		mapping->curvature.release();
+	}
 
-		ColorSpacePoint p = m_ColorCoordinates[colorIndex];
+	int64 start = cv::getTickCount();
+	cv::Mat points(nDepthHeight, nDepthWidth, CV_32FC3, mapping->cameraCoordinates);
+	if (m_EstimateCurvature)
+		m_Normals.compute(points, mapping->normals, mapping->curvature);
+	else
+		m_Normals.compute(points, mapping->normals);
+	recordCost(budget, KCV_COST_NORMALS, start);
+}
 
-		// Values that are negative infinity means it is an invalid color to depth mapping
-		if (p.X != -std::numeric_limits<float>::infinity() && p.Y != -std::numeric_limits<float>::infinity())
-		{
-			int colorX = static_cast<int>(p.X + 0.5f);
-			int colorY = static_cast<int>(p.Y + 0.5f);
+/*!
+Build \a pyramid of \a depth_frame with the camera coordinates of \a mapping , or without them when the view is empty.
+Level 0 of the camera pyramid references the mapping, the view must outlive its use. With a mapping the depth frame
+must have the 512 x 424 size of the mapped frames.
+*/
+HRESULT KCV_sensor::buildPyramid(KCV_pyramid &pyramid, cv::InputArray depth_frame, const KCV_mappingView &mapping)
+{
+	if (!mapping.isValid())
+	{
+		return pyramid.build(depth_frame);
+	}
+	cv::Mat depth = depth_frame.getMat();
+	if (depth.cols != 512 || depth.rows != 424)
+	{
+		return E_INVALIDARG;
+	}
+	cv::Mat points(depth.rows, depth.cols, CV_32FC3, const_cast<CameraSpacePoint*>(mapping.cameraCoordinates()));
+	return pyramid.build(depth, points);
+}
 
-			if ((colorX >= 0 && colorX < nColorWidth) && (colorY >= 0 && colorY < nColorHeight))
+/*!
+Stores in \a mapping the slot for the next mapping, neither published nor read. Called with mapping mutex held.
+Views holding every spare slot are waited for KCV_MAPPING_WAIT_MS at most, as they may belong to the calling thread,
+E_PENDING is returned then. E_FAIL without mapping buffers.
+*/
+HRESULT KCV_sensor::beginMapping(KCV_mapping *&mapping)
+{
+	mapping = NULL;
+	if (m_Mappings[0].depthCoordinates == NULL)
+	{
+		return E_FAIL;
+	}
+	const int published = m_Published;
+	const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(KCV_MAPPING_WAIT_MS);
+	for (;;)
+	{
+		for (int i = 0; i < KCV_MAPPING_SLOTS; ++i)
+		{
+			if (i != published && m_Mappings[i].readers == 0)
 			{
-				// set source for copy to the color pixel
-				pSrc = p_ColorBuffer + colorY*nColorWidth + colorX;
+				mapping = &m_Mappings[i];
+				return S_OK;
 			}
 		}
-
-		// write output
-		if (pSrc != NULL)
+		// every spare slot still has readers
+		if (std::chrono::steady_clock::now() >= deadline)
 		{
-			m_pOutputRGBX[colorIndex] = *pSrc;
+			return E_PENDING;
 		}
+		std::this_thread::yield();
 	}
-	// write image
-	cv::Mat image(nDepthHeight, nDepthWidth, CV_8UC4, reinterpret_cast<void*>(m_pOutputRGBX));
-	aligned_color_frame = image.clone();
-	image.release();
+}
 
-	delete[] m_pOutputRGBX;
-	m_pOutputRGBX = NULL;
+/*!
+Make \a mapping the current one. Called with mapping mutex held.
+*/
+void KCV_sensor::publishMapping(KCV_mapping *mapping)
+{
+	mapping->sequence = ++m_MappingSequence;
+	m_Published = (int)(mapping - m_Mappings);
 }
 
 /*!
-Align depth frame to \a aligned_depth_frame with \a aligned_frame_width and \a aligned_frame_height
-based on \a nColorWidth and \a nColorHeight from color stream
-and \a depth_frame with \a nDepthWidth and \a nDepthHeight from depth stream.
+Returns if mapping of \a nDepthWidth x \a nDepthHeight depth and \a nColorWidth x \a nColorHeight color frames
+goes through the loaded calibration cache instead of the live coordinate mapper.
+*/
+bool KCV_sensor::useCalibration(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight)
+{
+	return m_Calibration.isLoaded() &&
+		m_Calibration.depthWidth() == nDepthWidth && m_Calibration.depthHeight() == nDepthHeight &&
+		m_Calibration.colorWidth() == nColorWidth && m_Calibration.colorHeight() == nColorHeight;
+}
+
+/*!
+Store unique id of the connected device in \a serial .
 */
-void KCV_sensor::alignDepthFrame(cv::Mat depth_frame, int nDepthWidth, int nDepthHeight,
-	int nColorWidth, int nColorHeight, cv::Mat &aligned_depth_frame, int aligned_frame_width, int aligned_frame_height)
+HRESULT KCV_sensor::getSerial(std::wstring &serial)
 {
-	UINT16 *m_pOutputDepth = new UINT16[nColorWidth * nColorHeight];
-	UINT16 *buffer = (UINT16*)depth_frame.data;
-	for (int depthIndex = 0; depthIndex < (nColorWidth * nColorHeight); ++depthIndex)
+	if (m_KinectSensor == NULL)
+	{
+		return E_FAIL;
+	}
+	WCHAR id[256] = { 0 };
+	HRESULT hr = m_KinectSensor->get_UniqueKinectId(256, id);
+	if (SUCCEEDED(hr))
 	{
-		UINT16 pSrc = 0;
+		serial = id;
+		if (serial.empty())
+			hr = E_PENDING;
+	}
+	return hr;
+}
 
-		DepthSpacePoint p = m_DepthCoordinates[depthIndex];
+/*!
+Build calibration cache from the live coordinate mapper. Returns E_PENDING until the device provided its calibration.
+Not to be called while frames are acquired or mapped.
+*/
+HRESULT KCV_sensor::buildCalibration()
+{
+	std::wstring serial;
+	HRESULT hr = getSerial(serial);
+	if (SUCCEEDED(hr))
+	{
+		hr = m_Calibration.build(m_CoordinateMapper, serial, 512, 424, 1920, 1080);
+	}
+	return hr;
+}
 
-		int depthX = static_cast<int>(p.X + 0.5f);
-		int depthY = static_cast<int>(p.Y + 0.5f);
+/*!
+Save calibration cache to \a directory , the file is keyed by device serial.
+*/
+HRESULT KCV_sensor::saveCalibration(const std::wstring &directory)
+{
+	if (!m_Calibration.isLoaded())
+	{
+		return E_FAIL;
+	}
+	return m_Calibration.save(KCV_calibration::cacheFileName(directory, m_Calibration.serial()));
+}
 
-		if ((depthX >= 0 && depthX < nDepthWidth) && (depthY >= 0 && depthY < nDepthHeight))
-		{
-			pSrc = buffer[depthY*nDepthWidth + depthX];
-		}
+/*!
+Load calibration cache of device \a serial from \a directory , connected device is used when \a serial is empty.
+All mapping functions use the cache afterwards, also without the device. A cache of another device or frame size
+is rejected. Not to be called while frames are acquired or mapped.
+*/
+HRESULT KCV_sensor::loadCalibration(const std::wstring &directory, const std::wstring &serial)
+{
+	std::wstring key = serial;
+	HRESULT hr = S_OK;
+	if (key.empty())
+	{
+		hr = getSerial(key);
+	}
+	if (SUCCEEDED(hr))
+	{
+		hr = m_Calibration.load(KCV_calibration::cacheFileName(directory, key), key, 512, 424, 1920, 1080);
+	}
+	return hr;
+}
 
-		// write output
-		if (pSrc != 0)
-		{
-			m_pOutputDepth[depthIndex] = pSrc;
-		}
-		else
-		{
-			m_pOutputDepth[depthIndex] = USHRT_MAX;
-		}
+/*!
+Drop calibration cache, mapping goes through the live coordinate mapper again.
+Not to be called while frames are acquired or mapped.
+*/
+void KCV_sensor::releaseCalibration()
+{
+	m_Calibration.release();
+}
 
-	}
-	// write image
-	cv::Mat image(nColorHeight, nColorWidth, CV_16U, reinterpret_cast<void*>(m_pOutputDepth));
-	cv::resize(image, aligned_depth_frame, cv::Size(aligned_frame_width, aligned_frame_height));
-	image.release();
+/*!
+Returns if calibration cache is loaded.
+*/
+bool KCV_sensor::isCalibrated()
+{
+	return m_Calibration.isLoaded();
+}
 
-	delete[] m_pOutputDepth;
-	m_pOutputDepth = NULL;
+/*!
+Align intensity frame \a aligned_intensity_frame with specified \a aligned_frame_width and \a aligned_frame_height based on
+\a intensity_frame with specified \a nIntensityWidth and \a nIntensityHeight with provided \a nDepthWidth and \a nDepthHeight .
+Returns E_PENDING without a color mapped frame and E_INVALIDARG for frames of another size than the mapped ones.
+*/
+HRESULT KCV_sensor::alignIntensityFrame(int nDepthWidth, int nDepthHeight,
+	cv::InputArray intensity_frame, int nIntensityWidth, int nIntensityHeight, cv::OutputArray aligned_intensity_frame, int aligned_frame_width, int aligned_frame_height)
+{
+	KCV_mappingView mapping = acquireMapping();
+	HRESULT hr = checkMapping(mapping, nDepthWidth, nDepthHeight);
+	if (FAILED(hr))
+		return hr;
+	cv::Mat intensity = intensity_frame.getMat();
+	aligned_intensity_frame.create(aligned_frame_height, aligned_frame_width, CV_8UC1);
+	cv::Mat aligned = aligned_intensity_frame.getMat();
+	alignColorKernel<UCHAR>(mapping.colorCoordinates(), nDepthWidth, nDepthHeight,
+		intensity.data, intensity.step, nIntensityWidth, nIntensityHeight, aligned);
+	return S_OK;
+}
+
+/*!
+Align color frame to \a aligned_color_frame with \a aligned_frame_width and \a aligned_frame_height 
+based on \a color_frame with \a nColorWidth and \a nColorHeight from color stream 
+and \a nDepthWidth and \a nDepthHeight from depth stream
+Returns E_PENDING without a color mapped frame and E_INVALIDARG for frames of another size than the mapped ones.
+*/
+HRESULT KCV_sensor::alignColorFrame(int nDepthWidth, int nDepthHeight,
+	cv::InputArray color_frame, int nColorWidth, int nColorHeight, cv::OutputArray aligned_color_frame, int aligned_frame_width, int aligned_frame_height)
+{
+	KCV_mappingView mapping = acquireMapping();
+	HRESULT hr = checkMapping(mapping, nDepthWidth, nDepthHeight);
+	if (FAILED(hr))
+		return hr;
+	cv::Mat color = color_frame.getMat();
+	aligned_color_frame.create(aligned_frame_height, aligned_frame_width, CV_8UC4);
+	cv::Mat aligned = aligned_color_frame.getMat();
+	alignColorKernel<RGBQUAD>(mapping.colorCoordinates(), nDepthWidth, nDepthHeight,
+		color.data, color.step, nColorWidth, nColorHeight, aligned);
+	return S_OK;
+}
+
+/*!
+Align color frame to \a aligned_color_frame with \a nColorWidth and \a nColorHeight
+based on \a p_ColorBuffer from color stream
+and \a p_DepthBuffer with \a nDepthWidth and \a nDepthHeight from depth stream.
+Under the frame budget the output keeps its size, aligned at half resolution with every sample repeated over 2 x 2 pixels.
+Returns E_PENDING without a color mapped frame and E_INVALIDARG for frames of another size than the mapped ones.
+*/
+HRESULT KCV_sensor::alignColorFrame(const UINT16* p_DepthBuffer, int nDepthWidth, int nDepthHeight,
+	const RGBQUAD* p_ColorBuffer, int nColorWidth, int nColorHeight, cv::OutputArray aligned_color_frame)
+{
+	KCV_mappingView mapping = acquireMapping();
+	HRESULT hr = checkMapping(mapping, nDepthWidth, nDepthHeight);
+	if (FAILED(hr))
+		return hr;
+	int64 start = cv::getTickCount();
+	int step = m_Budget.alignStep();
+	aligned_color_frame.create(nDepthHeight, nDepthWidth, CV_8UC4);
+	cv::Mat aligned = aligned_color_frame.getMat();
+	alignColorKernel<RGBQUAD>(mapping.colorCoordinates(), nDepthWidth, nDepthHeight,
+		reinterpret_cast<const uchar*>(p_ColorBuffer), nColorWidth * sizeof(RGBQUAD), nColorWidth, nColorHeight, aligned, step);
+	recordCost(&m_Budget, KCV_COST_ALIGN, start);
+	return S_OK;
+}
+
+/*!
+Align depth frame to \a aligned_depth_frame with \a aligned_frame_width and \a aligned_frame_height
+based on \a nColorWidth and \a nColorHeight from color stream
+and \a depth_frame with \a nDepthWidth and \a nDepthHeight from depth stream.
+Unmapped pixels are set to USHRT_MAX.
+Returns E_PENDING without a color mapped frame and E_INVALIDARG for frames of another size than the mapped ones.
+*/
+HRESULT KCV_sensor::alignDepthFrame(cv::InputArray depth_frame, int nDepthWidth, int nDepthHeight,
+	int nColorWidth, int nColorHeight, cv::OutputArray aligned_depth_frame, int aligned_frame_width, int aligned_frame_height)
+{
+	KCV_mappingView mapping = acquireMapping();
+	HRESULT hr = checkMapping(mapping, nDepthWidth, nDepthHeight, nColorWidth, nColorHeight);
+	if (FAILED(hr))
+		return hr;
+	cv::Mat depth = depth_frame.getMat();
+	aligned_depth_frame.create(aligned_frame_height, aligned_frame_width, CV_16U);
+	cv::Mat aligned = aligned_depth_frame.getMat();
+	alignDepthKernel(mapping.depthCoordinates(), nColorWidth, nColorHeight,
+		depth.data, depth.step, nDepthWidth, nDepthHeight, USHRT_MAX, aligned);
+	return S_OK;
 }
 
 /*!
 Align depth frame to \a aligned_depth_frame with \a nColorWidth and \a nColorHeight
 based on \a p_DepthBuffer with \a nDepthWidth and \a nDepthHeight from depth stream.
+Under the frame budget the output keeps its size, aligned at half resolution with every sample repeated over 2 x 2 pixels.
+Returns E_PENDING without a color mapped frame and E_INVALIDARG for frames of another size than the mapped ones.
+*/
+HRESULT KCV_sensor::alignDepthFrame(const UINT16* p_DepthBuffer, int nDepthWidth, int nDepthHeight,
+	int nColorWidth, int nColorHeight, cv::OutputArray aligned_depth_frame)
+{
+	KCV_mappingView mapping = acquireMapping();
+	HRESULT hr = checkMapping(mapping, nDepthWidth, nDepthHeight, nColorWidth, nColorHeight);
+	if (FAILED(hr))
+		return hr;
+	int64 start = cv::getTickCount();
+	int step = m_Budget.alignStep();
+	aligned_depth_frame.create(nColorHeight, nColorWidth, CV_16U);
+	cv::Mat aligned = aligned_depth_frame.getMat();
+	alignDepthKernel(mapping.depthCoordinates(), nColorWidth, nColorHeight,
+		reinterpret_cast<const uchar*>(p_DepthBuffer), nDepthWidth * sizeof(UINT16), nDepthWidth, nDepthHeight, 0, aligned, step);
+	recordCost(&m_Budget, KCV_COST_ALIGN, start);
+	return S_OK;
+}
+
+/*!
+Align \a color_frame to \a aligned_color_frame on the depth grid using per frame \a color_coordinates from mapCoordinates.
+Returns E_INVALIDARG, with the output untouched, unless the coordinates are a continuous CV_32FC2 map and the color frame is CV_8UC4.
+*/
+HRESULT KCV_sensor::alignColorFrame(cv::InputArray color_coordinates, cv::InputArray color_frame, cv::OutputArray aligned_color_frame)
+{
+	cv::Mat coordinates = color_coordinates.getMat();
+	cv::Mat color = color_frame.getMat();
+	if (!isCoordinateMap(coordinates, CV_32FC2) || color.empty() || color.type() != CV_8UC4)
+	{
+		return E_INVALIDARG;
+	}
+	aligned_color_frame.create(coordinates.rows, coordinates.cols, CV_8UC4);
+	cv::Mat aligned = aligned_color_frame.getMat();
+	alignColorKernel<RGBQUAD>(reinterpret_cast<const ColorSpacePoint*>(coordinates.data), coordinates.cols, coordinates.rows,
+		color.data, color.step, color.cols, color.rows, aligned);
+	return S_OK;
+}
+
+/*!
+Align \a depth_frame to \a aligned_depth_frame on the color grid using per frame \a depth_coordinates from mapCoordinates.
+Unmapped pixels are set to USHRT_MAX. Returns E_INVALIDARG, with the output untouched, unless the coordinates are
+a continuous CV_32FC2 map and the depth frame is CV_16U.
 */
-void KCV_sensor::alignDepthFrame(const UINT16* p_DepthBuffer, int nDepthWidth, int nDepthHeight,
-	int nColorWidth, int nColorHeight, cv::Mat &aligned_depth_frame)
+HRESULT KCV_sensor::alignDepthFrame(cv::InputArray depth_coordinates, cv::InputArray depth_frame, cv::OutputArray aligned_depth_frame)
 {
-	UINT16 *m_pOutputDepth = new UINT16[nColorWidth * nColorHeight];
-	for (int depthIndex = 0; depthIndex < (nColorWidth * nColorHeight); ++depthIndex)
+	cv::Mat coordinates = depth_coordinates.getMat();
+	cv::Mat depth = depth_frame.getMat();
+	if (!isCoordinateMap(coordinates, CV_32FC2) || depth.empty() || depth.type() != CV_16U)
 	{
-		const UINT16* pSrc = NULL;
+		return E_INVALIDARG;
+	}
+	aligned_depth_frame.create(coordinates.rows, coordinates.cols, CV_16U);
+	cv::Mat aligned = aligned_depth_frame.getMat();
+	alignDepthKernel(reinterpret_cast<const DepthSpacePoint*>(coordinates.data), coordinates.cols, coordinates.rows,
+		depth.data, depth.step, depth.cols, depth.rows, USHRT_MAX, aligned);
+	return S_OK;
+}
 
-		DepthSpacePoint p = m_DepthCoordinates[depthIndex];
+/*!
+Create \a output of \a rows x \a cols and \a type in \a mat, zeroed only when new storage is allocated.
+A reused output keeps its pixels, as the foreground kernels write foreground pixels only.
+*/
+static void createForeground(cv::OutputArray output, int rows, int cols, int type, cv::Mat &mat)
+{
+	const uchar *p_Previous = output.empty() ? NULL : output.getMat().data;
+	output.create(rows, cols, type);
+	mat = output.getMat();
+	if (mat.data != p_Previous)
+	{
+		mat.setTo(cv::Scalar::all(0));
+	}
+}
 
-		int depthX = static_cast<int>(p.X + 0.5f);
-		int depthY = static_cast<int>(p.Y + 0.5f);
+/*!
+Returns if \a foreground is a segment of a \a nDepthWidth x \a nDepthHeight depth frame.
+*/
+static bool isForegroundOf(const KCV_foreground &foreground, int nDepthWidth, int nDepthHeight)
+{
+	return foreground.mask.type() == CV_8U && foreground.mask.cols == nDepthWidth && foreground.mask.rows == nDepthHeight;
+}
 
-		if ((depthX >= 0 && depthX < nDepthWidth) && (depthY >= 0 && depthY < nDepthHeight))
-		{
-			pSrc = p_DepthBuffer + depthY*nDepthWidth + depthX;
-		}
+/*!
+Align \a color_frame to \a aligned_color_frame on the depth grid of \a foreground using the last mapping,
+only foreground pixels are aligned. A new output is zeroed, a reused one keeps its other pixels,
+the caller clears the pixels of the previous foreground.
+Returns E_PENDING without a color mapped frame and E_INVALIDARG unless \a foreground is of a 512 x 424 mapped frame
+and the color frame is CV_8UC4.
+*/
+HRESULT KCV_sensor::alignColorFrame(const KCV_foreground &foreground, cv::InputArray color_frame, cv::OutputArray aligned_color_frame)
+{
+	if (!isForegroundOf(foreground, 512, 424))
+		return E_INVALIDARG;
+	KCV_mappingView mapping = acquireMapping();
+	HRESULT hr = checkMapping(mapping, foreground.mask.cols, foreground.mask.rows);
+	if (FAILED(hr))
+		return hr;
+	cv::Mat color = color_frame.getMat();
+	if (color.empty() || color.type() != CV_8UC4)
+		return E_INVALIDARG;
+	int64 start = cv::getTickCount();
+	cv::Mat aligned;
+	createForeground(aligned_color_frame, foreground.mask.rows, foreground.mask.cols, CV_8UC4, aligned);
+	alignColorRunsKernel<RGBQUAD>(mapping.colorCoordinates(), foreground.runs, color.data, color.step, color.cols, color.rows, aligned);
+	recordCost(&m_Budget, KCV_COST_ALIGN, start);
+	return S_OK;
+}
 
-		// write output
-		if (pSrc != NULL)
-		{
-			m_pOutputDepth[depthIndex] = *pSrc;
-		}
+/*!
+Align foreground of \a depth_frame to \a aligned_depth_frame with \a nColorWidth and \a nColorHeight using the last mapping,
+only color pixels around the blobs are visited and only foreground pixels are written. A new output is zeroed,
+a reused one keeps its other pixels, the caller clears the pixels of the previous foreground.
+Returns E_PENDING without a color mapped frame and E_INVALIDARG unless \a foreground and \a depth_frame are of
+a 512 x 424 mapped frame and the color size is the mapped one.
+*/
+HRESULT KCV_sensor::alignDepthFrame(const KCV_foreground &foreground, cv::InputArray depth_frame, int nColorWidth, int nColorHeight,
+	cv::OutputArray aligned_depth_frame)
+{
+	if (!isForegroundOf(foreground, 512, 424))
+		return E_INVALIDARG;
+	KCV_mappingView mapping = acquireMapping();
+	HRESULT hr = checkMapping(mapping, foreground.mask.cols, foreground.mask.rows, nColorWidth, nColorHeight);
+	if (FAILED(hr))
+		return hr;
+	cv::Mat depth = depth_frame.getMat();
+	if (depth.type() != CV_16U || depth.size() != foreground.mask.size())
+		return E_INVALIDARG;
+	int64 start = cv::getTickCount();
+	cv::Mat aligned;
+	createForeground(aligned_depth_frame, nColorHeight, nColorWidth, CV_16U, aligned);
+	alignDepthRunsKernel(mapping.depthCoordinates(), mapping.colorCoordinates(), depth.data, depth.step, foreground, aligned);
+	recordCost(&m_Budget, KCV_COST_ALIGN, start);
+	return S_OK;
+}
+
+/*!
+Align \a color_frame to \a aligned_color_frame on the depth grid using per frame \a color_coordinates from mapCoordinates,
+only pixels of \a foreground are aligned. A new output is zeroed, a reused one keeps its other pixels,
+the caller clears the pixels of the previous foreground.
+Returns E_INVALIDARG, with the output untouched, unless the coordinates are a continuous CV_32FC2 map of the size of
+the foreground mask and the color frame is CV_8UC4.
+*/
+HRESULT KCV_sensor::alignColorFrame(const KCV_foreground &foreground, cv::InputArray color_coordinates, cv::InputArray color_frame,
+	cv::OutputArray aligned_color_frame)
+{
+	cv::Mat coordinates = color_coordinates.getMat();
+	cv::Mat color = color_frame.getMat();
+	if (!isCoordinateMap(coordinates, CV_32FC2) || !isForegroundOf(foreground, coordinates.cols, coordinates.rows) ||
+		color.empty() || color.type() != CV_8UC4)
+	{
+		return E_INVALIDARG;
 	}
-	// write image
-	cv::Mat image(nColorHeight, nColorWidth, CV_16U, reinterpret_cast<void*>(m_pOutputDepth));
-	aligned_depth_frame = image.clone();
-	image.release();
+	cv::Mat aligned;
+	createForeground(aligned_color_frame, coordinates.rows, coordinates.cols, CV_8UC4, aligned);
+	alignColorRunsKernel<RGBQUAD>(reinterpret_cast<const ColorSpacePoint*>(coordinates.data), foreground.runs,
+		color.data, color.step, color.cols, color.rows, aligned);
+	return S_OK;
+}
 
-	delete[] m_pOutputDepth;
-	m_pOutputDepth = NULL;
+/*!
+Align foreground of \a depth_frame to \a aligned_depth_frame on the color grid using per frame \a depth_coordinates and
+\a color_coordinates from mapCoordinates, only color pixels around the blobs are visited and only foreground pixels are written.
+A new output is zeroed, a reused one keeps its other pixels, the caller clears the pixels of the previous foreground.
+Returns E_INVALIDARG, with the output untouched, unless both coordinates are continuous CV_32FC2 maps, the color coordinates
+and the CV_16U depth frame of the size of the foreground mask.
+*/
+HRESULT KCV_sensor::alignDepthFrame(const KCV_foreground &foreground, cv::InputArray depth_coordinates, cv::InputArray color_coordinates,
+	cv::InputArray depth_frame, cv::OutputArray aligned_depth_frame)
+{
+	cv::Mat depthCoordinates = depth_coordinates.getMat();
+	cv::Mat colorCoordinates = color_coordinates.getMat();
+	cv::Mat depth = depth_frame.getMat();
+	if (!isCoordinateMap(depthCoordinates, CV_32FC2) || !isCoordinateMap(colorCoordinates, CV_32FC2) ||
+		!isForegroundOf(foreground, colorCoordinates.cols, colorCoordinates.rows) ||
+		depth.type() != CV_16U || depth.size() != foreground.mask.size())
+	{
+		return E_INVALIDARG;
+	}
+	cv::Mat aligned;
+	createForeground(aligned_depth_frame, depthCoordinates.rows, depthCoordinates.cols, CV_16U, aligned);
+	alignDepthRunsKernel(reinterpret_cast<const DepthSpacePoint*>(depthCoordinates.data),
+		reinterpret_cast<const ColorSpacePoint*>(colorCoordinates.data), depth.data, depth.step, foreground, aligned);
+	return S_OK;
+}
+
+/*!
+Align \a p_ColorBuffer with \a nColorWidth and \a nColorHeight to \a p_DepthBuffer with \a nDepthWidth and \a nDepthHeight
+into \a rgbd_frame of KCV_rgbd records (KCV_RGBD_TYPE), or of KCV_rgbdPoint records (KCV_RGBD_POINT_TYPE) when \a camera_points is set.
+Infrared of \a p_InfraredBuffer , when given, is stored with the records.
+Returns E_PENDING without a color mapped frame and E_INVALIDARG for frames of another size than the mapped ones.
+*/
+HRESULT KCV_sensor::alignRGBDFrame(const UINT16* p_DepthBuffer, int nDepthWidth, int nDepthHeight,
+	const RGBQUAD* p_ColorBuffer, int nColorWidth, int nColorHeight, cv::OutputArray rgbd_frame, bool camera_points,
+	const UINT16* p_InfraredBuffer)
+{
+	KCV_mappingView mapping = acquireMapping();
+	HRESULT hr = checkMapping(mapping, nDepthWidth, nDepthHeight);
+	if (FAILED(hr))
+		return hr;
+	int64 start = cv::getTickCount();
+	rgbd_frame.create(nDepthHeight, nDepthWidth, camera_points ? KCV_RGBD_POINT_TYPE : KCV_RGBD_TYPE);
+	cv::Mat rgbd = rgbd_frame.getMat();
+	KCV_rgbdBody body(mapping.colorCoordinates(), camera_points ? mapping.cameraCoordinates() : NULL,
+		reinterpret_cast<const uchar*>(p_DepthBuffer), nDepthWidth * sizeof(UINT16),
+		reinterpret_cast<const uchar*>(p_ColorBuffer), nColorWidth * sizeof(RGBQUAD), nColorWidth, nColorHeight,
+		reinterpret_cast<const uchar*>(p_InfraredBuffer), nDepthWidth * sizeof(UINT16), rgbd);
+	cv::parallel_for_(cv::Range(0, nDepthHeight), body, nDepthHeight / 16.0);
+	recordCost(&m_Budget, KCV_COST_ALIGN, start);
+	return S_OK;
+}
+
+/*!
+Align \a color_frame to \a depth_frame into \a rgbd_frame using per frame \a color_coordinates and, when given,
+\a camera_coordinates from mapCoordinates. The records are KCV_rgbdPoint with camera coordinates, KCV_rgbd otherwise.
+Infrared of \a infrared_frame , when given, is stored with the records. Returns E_INVALIDARG, with the output untouched,
+unless the coordinates are a continuous CV_32FC2 map, camera coordinates a continuous CV_32FC3 map of the same size,
+the depth and infrared frames CV_16U of the same size and the color frame CV_8UC4.
+*/
+HRESULT KCV_sensor::alignRGBDFrame(cv::InputArray color_coordinates, cv::InputArray camera_coordinates, cv::InputArray depth_frame,
+	cv::InputArray color_frame, cv::OutputArray rgbd_frame, cv::InputArray infrared_frame)
+{
+	cv::Mat coordinates = color_coordinates.getMat();
+	cv::Mat camera = camera_coordinates.getMat();
+	cv::Mat depth = depth_frame.getMat();
+	cv::Mat color = color_frame.getMat();
+	cv::Mat infrared = infrared_frame.getMat();
+	if (!isCoordinateMap(coordinates, CV_32FC2) ||
+		(!camera.empty() && (!isCoordinateMap(camera, CV_32FC3) || camera.size() != coordinates.size())) ||
+		depth.type() != CV_16U || depth.size() != coordinates.size() ||
+		(!infrared.empty() && (infrared.type() != CV_16U || infrared.size() != coordinates.size())) ||
+		color.empty() || color.type() != CV_8UC4)
+	{
+		return E_INVALIDARG;
+	}
+	rgbd_frame.create(coordinates.rows, coordinates.cols, camera.empty() ? KCV_RGBD_TYPE : KCV_RGBD_POINT_TYPE);
+	cv::Mat rgbd = rgbd_frame.getMat();
+	KCV_rgbdBody body(reinterpret_cast<const ColorSpacePoint*>(coordinates.data), reinterpret_cast<const CameraSpacePoint*>(camera.data),
+		depth.data, depth.step, color.data, color.step, color.cols, color.rows, infrared.data, infrared.step, rgbd);
+	cv::parallel_for_(cv::Range(0, rgbd.rows), body, rgbd.rows / 16.0);
+	return S_OK;
 }
 
 /*!
@@ -645,7 +1716,22 @@ Store depth point information in \a depthPoint based on \a colorPoint , \a nColo
 bool KCV_sensor::getPointInDepth(cv::Point colorPoint, int nColorWidth, int nColorHeight,
 	int nDepthWidth, int nDepthHeight, cv::Point &depthPoint)
 {
-	DepthSpacePoint p = m_DepthCoordinates[(int)(((int)colorPoint.y) *nColorWidth*this->c_frame_width_scale) + (int)((int)colorPoint.x * this->c_frame_width_scale)];
+	return getPointInDepth(acquireMapping(), colorPoint, nColorWidth, nColorHeight, nDepthWidth, nDepthHeight, depthPoint);
+}
+
+/*!
+Store depth point information in \a depthPoint based on \a colorPoint in frame \a mapping .
+*/
+bool KCV_sensor::getPointInDepth(const KCV_mappingView &mapping, cv::Point colorPoint, int nColorWidth, int nColorHeight,
+	int nDepthWidth, int nDepthHeight, cv::Point &depthPoint)
+{
+	if (!mapping.isValid() || !mapping.isColorMapped())
+	{
+		depthPoint.x = -1;
+		depthPoint.y = -1;
+		return false;
+	}
+	DepthSpacePoint p = mapping.depthCoordinates()[(int)(((int)colorPoint.y) *nColorWidth*this->c_frame_width_scale) + (int)((int)colorPoint.x * this->c_frame_width_scale)];
 
 	int xDepth = -1;
 	int yDepth = -1;
@@ -672,11 +1758,21 @@ Store real point coordinates information in \a realPoint based on
 */
 bool KCV_sensor::getPointInReal(cv::Point depthPoint, int nDepthWidth, int nDepthHeight, cv::Point3f &realPoint)
 {
+	return getPointInReal(acquireMapping(), depthPoint, nDepthWidth, nDepthHeight, realPoint);
+}
+
+/*!
+Store real point coordinates information in \a realPoint based on \a depthPoint in frame \a mapping .
+*/
+bool KCV_sensor::getPointInReal(const KCV_mappingView &mapping, cv::Point depthPoint, int nDepthWidth, int nDepthHeight, cv::Point3f &realPoint)
+{
+	if (!mapping.isValid())
+		return false;
 	if (!(depthPoint.x >= 0 && depthPoint.x < nDepthWidth* this->d_frame_width_scale) && !(depthPoint.y >= 0 && depthPoint.y < nDepthHeight* this->d_frame_heigth_scale))
 		return false;
 	float a = this->c_frame_width_scale;
 	float b = this->c_frame_heigth_scale;
-	CameraSpacePoint p = m_CameraCoordinates[(int)(((int)depthPoint.y) *nDepthWidth * this->d_frame_width_scale) + (int)((int)depthPoint.x* this->d_frame_width_scale)];
+	CameraSpacePoint p = mapping.cameraCoordinates()[(int)(((int)depthPoint.y) *nDepthWidth * this->d_frame_width_scale) + (int)((int)depthPoint.x* this->d_frame_width_scale)];
 
 	float xDepth = 0.0f;
 	float yDepth = 0.0f;
@@ -706,7 +1802,11 @@ bool KCV_sensor::getPointFromReal(cv::Point3f realPoint, int nDepthWidth, int nD
 	p.Y = realPoint.y;
 	p.Z = realPoint.z;
 	DepthSpacePoint d;
-	m_CoordinateMapper->MapCameraPointToDepthSpace(p, &d);
+	d.X = d.Y = -std::numeric_limits<float>::infinity();
+	if (m_Calibration.isLoaded())
+		m_Calibration.mapCameraPointToDepthSpace(p, &d);
+	else if (m_CoordinateMapper != NULL)
+		m_CoordinateMapper->MapCameraPointToDepthSpace(p, &d);
 	if ((d.X >= 0 && d.X < nDepthWidth * this->d_frame_width_scale) && (d.Y >= 0 && d.Y < nDepthHeight* this->d_frame_heigth_scale))
 	{
 		depthPoint.x = d.X;
@@ -832,18 +1932,36 @@ HRESULT KCV_sensor::acquireColorImage(cv::Mat &color_frame)
 }
 
 /*!
-Close connection to kinect device.
+Close connection to kinect device. Returns the number of KCV_mappingView still held, the mapping buffers are freed
+only when it is zero and are left untouched, the last mapping still published, otherwise. Call again after releasing the views.
 */
-void KCV_sensor::closeAll()
+int KCV_sensor::closeAll()
 {
-	
-	if (m_DepthCoordinates != NULL)
-		delete[] m_DepthCoordinates;
-	if (m_ColorCoordinates != NULL)
-		delete[] m_ColorCoordinates;
-	if (m_CameraCoordinates != NULL)
-		delete[] m_CameraCoordinates;
-	m_DepthCoordinates = NULL;
-	m_ColorCoordinates = NULL;
-	m_CameraCoordinates = NULL;
+	std::lock_guard<std::mutex> lock(m_MappingMutex);
+	// views acquired from now on are invalid, those acquired before still read their slots
+	const int published = m_Published.exchange(-1);
+	int held = 0;
+	for (int i = 0; i < KCV_MAPPING_SLOTS; ++i)
+	{
+		held += m_Mappings[i].readers;
+	}
+	if (held != 0)
+	{
+		m_Published = published;
+		return held;
+	}
+	for (int i = 0; i < KCV_MAPPING_SLOTS; ++i)
+	{
+		if (m_Mappings[i].depthCoordinates != NULL)
+			delete[] m_Mappings[i].depthCoordinates;
+		if (m_Mappings[i].colorCoordinates != NULL)
+			delete[] m_Mappings[i].colorCoordinates;
+		if (m_Mappings[i].cameraCoordinates != NULL)
+			delete[] m_Mappings[i].cameraCoordinates;
+		m_Mappings[i].depthCoordinates = NULL;
+		m_Mappings[i].colorCoordinates = NULL;
+		m_Mappings[i].cameraCoordinates = NULL;
+		m_Mappings[i].depth.release();
+	}
+	return 0;
 }
\ No newline at end of file
@@ -9,6 +9,11 @@
 
 // Kinect2X.h
 
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
 // Kinect SDK
 #include <Kinect.h>
 
@@ -18,20 +23,106 @@
 #include <opencv2/contrib/contrib.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include "Kinect2XBackground.h"
+#include "Kinect2XBudget.h"
+#include "Kinect2XCalibration.h"
+#include "Kinect2XInfrared.h"
+#include "Kinect2XNormals.h"
+#include "Kinect2XPyramid.h"
+#include "Kinect2XSynthetic.h"
 
 namespace kcv
 {
+	// Validity bits of KCV_rgbd::flags
+	enum KCV_rgbdFlag
+	{
+		KCV_RGBD_DEPTH = 1,		// depth is measured
+		KCV_RGBD_COLOR = 2,		// pixel maps into the color frame
+		KCV_RGBD_POINT = 4,		// camera space point is finite
+		KCV_RGBD_INFRARED = 8	// infrared is set
+	};
+
+	// Registered RGB-D pixel on the depth grid, one 8 byte record
+	struct KCV_rgbd
+	{
+		UINT16 depth;		// mm, 0 when invalid
+		UCHAR b, g, r;		// black when not mapped
+		UCHAR flags;		// KCV_rgbdFlag bits
+		UINT16 infrared;	// active infrared, 0 when not given
+	};
+
+	// Registered RGB-D pixel with its camera space point, 20 bytes
+	struct KCV_rgbdPoint
+	{
+		KCV_rgbd rgbd;
+		float x, y, z;		// m, -infinity when invalid
+	};
+
+	// Record image types, rows are contiguous arrays of the records
+	const int KCV_RGBD_TYPE = CV_8UC(sizeof(KCV_rgbd));
+	const int KCV_RGBD_POINT_TYPE = CV_8UC(sizeof(KCV_rgbdPoint));
+
+	// Coordinate maps of one frame, published to readers as a whole
+	struct KCV_mapping
+	{
+		KCV_mapping();
+
+		DepthSpacePoint *depthCoordinates;
+		ColorSpacePoint *colorCoordinates;
+		CameraSpacePoint *cameraCoordinates;
+		cv::Mat normals;	// CV_32FC3, empty unless normal estimation is on
+		cv::Mat curvature;	// CV_32F, empty unless curvature estimation is on
+		cv::Mat depth;		// CV_16U, the mapped depth frame
+		cv::Size colorSize;	// color grid of depthCoordinates
+		unsigned long long sequence;
+		bool colorMapped;	// false when only camera coordinates were mapped, color and depth coordinates are stale
+		std::atomic<int> readers;
+	};
+
+	// Read access to one published mapping, the mapping is not overwritten while the view lives
+	class KCV_mappingView
+	{
+	public:
+		KCV_mappingView() : m_Mapping(NULL) {}
+		KCV_mappingView(KCV_mappingView &&other);
+		KCV_mappingView& operator=(KCV_mappingView &&other);
+		~KCV_mappingView();
+
+		void release();
+		bool isValid() const { return m_Mapping != NULL; }
+		unsigned long long sequence() const { return m_Mapping->sequence; }
+		bool isColorMapped() const { return m_Mapping->colorMapped; }
+		const DepthSpacePoint *depthCoordinates() const { return m_Mapping->depthCoordinates; }
+		const ColorSpacePoint *colorCoordinates() const { return m_Mapping->colorCoordinates; }
+		const CameraSpacePoint *cameraCoordinates() const { return m_Mapping->cameraCoordinates; }
+		const cv::Mat &normals() const { return m_Mapping->normals; }
+		const cv::Mat &curvature() const { return m_Mapping->curvature; }
+		const cv::Mat &depthFrame() const { return m_Mapping->depth; }
+		cv::Size colorSize() const { return m_Mapping->colorSize; }
+
+	private:
+		friend class KCV_sensor;
+		explicit KCV_mappingView(KCV_mapping *mapping);
+		KCV_mappingView(const KCV_mappingView&);
+		KCV_mappingView& operator=(const KCV_mappingView&);
+
+		KCV_mapping *m_Mapping;
+	};
+
 	class KCV_sensor
 	{
 	public:
-		static KCV_sensor *getInstance()
+		// The first call creates the sensor, with \a open false the device is not touched until openDevice()
+		static KCV_sensor *getInstance(bool open = true)
 		{
-			static KCV_sensor *instance = new KCV_sensor();
+			static KCV_sensor *instance = new KCV_sensor(open);
 			return instance;
 		}
+
+		HRESULT openDevice();
 		
 
-		void closeAll();
+		int closeAll();
 
 		HRESULT initSensor();
 		HRESULT initSensor(int c_width, int c_height, int d_width, int d_height);
@@ -51,29 +142,80 @@ namespace kcv
 		void acquireRealDepthImage(cv::Mat &depth_frame);
 		HRESULT acquireVisDepthImage(cv::Mat &depth_frame);
 		HRESULT acquireImages(cv::Mat &depth_frame, cv::Mat &color_frame);
-		void KCV_sensor::visualiseDepthMap(cv::Mat depth_frame, cv::Mat &depth_frame_vis);
+		HRESULT acquireRawImages(cv::Mat &depth_frame, cv::Mat &color_frame, bool acquire_color = true);
+		HRESULT acquireImages(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat &infrared_frame, cv::Mat &long_exposure_frame);
+		HRESULT acquireRawImages(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat &infrared_frame,
+			cv::Mat &long_exposure_frame, bool acquire_color = true);
+		void KCV_sensor::visualiseDepthMap(cv::InputArray depth_frame, cv::OutputArray depth_frame_vis);
 		bool isAvailable();
 
-		//KCV_sensor::
-		void alignColorFrame(const UINT16* pDepthBuffer, int nDepthWidth, int nDepthHeight,
-			const RGBQUAD* pColorBuffer, int nColorWidth, int nColorHeight, cv::Mat &aligned_color_frame);
-		void alignColorFrame(int nDepthWidth, int nDepthHeight, cv::Mat color_frame,
-			int nColorWidth, int nColorHeight, cv::Mat &aligned_color_frame, int aligned_frame_width, int aligned_frame_height);
-		void KCV_sensor::alignIntensityFrame(int nDepthWidth, int nDepthHeight,	cv::Mat intensity_frame, int nIntensityWidth, 
-			int nIntensityHeight, cv::Mat &aligned_intensity_frame, int aligned_frame_width, int aligned_frame_height);
-		void alignDepthFrame(cv::Mat depth_frame, int nDepthWidth, int nDepthHeight,
-			int nColorWidth, int nColorHeight, cv::Mat &aligned_depth_frame, int aligned_frame_width, int aligned_frame_height);
-		void alignDepthFrame(const UINT16* pDepthBuffer, int nDepthWidth, int nDepthHeight,
-			int nColorWidth, int nColorHeight, cv::Mat &aligned_depth_frame);
+		// Align functions write into the output images, their storage is reused when the size and type match
+		HRESULT alignColorFrame(const UINT16* pDepthBuffer, int nDepthWidth, int nDepthHeight,
+			const RGBQUAD* pColorBuffer, int nColorWidth, int nColorHeight, cv::OutputArray aligned_color_frame);
+		HRESULT alignColorFrame(int nDepthWidth, int nDepthHeight, cv::InputArray color_frame,
+			int nColorWidth, int nColorHeight, cv::OutputArray aligned_color_frame, int aligned_frame_width, int aligned_frame_height);
+		HRESULT KCV_sensor::alignIntensityFrame(int nDepthWidth, int nDepthHeight,	cv::InputArray intensity_frame, int nIntensityWidth, 
+			int nIntensityHeight, cv::OutputArray aligned_intensity_frame, int aligned_frame_width, int aligned_frame_height);
+		HRESULT alignDepthFrame(cv::InputArray depth_frame, int nDepthWidth, int nDepthHeight,
+			int nColorWidth, int nColorHeight, cv::OutputArray aligned_depth_frame, int aligned_frame_width, int aligned_frame_height);
+		HRESULT alignDepthFrame(const UINT16* pDepthBuffer, int nDepthWidth, int nDepthHeight,
+			int nColorWidth, int nColorHeight, cv::OutputArray aligned_depth_frame);
+		HRESULT alignColorFrame(cv::InputArray color_coordinates, cv::InputArray color_frame, cv::OutputArray aligned_color_frame);
+		HRESULT alignDepthFrame(cv::InputArray depth_coordinates, cv::InputArray depth_frame, cv::OutputArray aligned_depth_frame);
+		// Foreground alignment, only pixels of the foreground runs are written, the caller clears the previous foreground
+		HRESULT alignColorFrame(const KCV_foreground &foreground, cv::InputArray color_frame, cv::OutputArray aligned_color_frame);
+		HRESULT alignDepthFrame(const KCV_foreground &foreground, cv::InputArray depth_frame, int nColorWidth, int nColorHeight,
+			cv::OutputArray aligned_depth_frame);
+		HRESULT alignColorFrame(const KCV_foreground &foreground, cv::InputArray color_coordinates, cv::InputArray color_frame,
+			cv::OutputArray aligned_color_frame);
+		HRESULT alignDepthFrame(const KCV_foreground &foreground, cv::InputArray depth_coordinates, cv::InputArray color_coordinates,
+			cv::InputArray depth_frame, cv::OutputArray aligned_depth_frame);
+		// Fused alignment, depth, color, infrared and optionally camera space points of every depth pixel in one pass
+		HRESULT alignRGBDFrame(const UINT16* pDepthBuffer, int nDepthWidth, int nDepthHeight,
+			const RGBQUAD* pColorBuffer, int nColorWidth, int nColorHeight, cv::OutputArray rgbd_frame, bool camera_points = false,
+			const UINT16* pInfraredBuffer = NULL);
+		HRESULT alignRGBDFrame(cv::InputArray color_coordinates, cv::InputArray camera_coordinates, cv::InputArray depth_frame,
+			cv::InputArray color_frame, cv::OutputArray rgbd_frame, cv::InputArray infrared_frame = cv::noArray());
 		bool getPointInDepth(cv::Point colorPoint, int nColorWidth, int nColorHeight,
 			int nDepthWidth, int nDepthHeight, cv::Point &depthPoint);
 		bool getPointInReal(cv::Point depthPoint, int nDepthWidth, int nDepthHeight, cv::Point3f &realPoint);
+		bool getPointInDepth(const KCV_mappingView &mapping, cv::Point colorPoint, int nColorWidth, int nColorHeight,
+			int nDepthWidth, int nDepthHeight, cv::Point &depthPoint);
+		bool getPointInReal(const KCV_mappingView &mapping, cv::Point depthPoint, int nDepthWidth, int nDepthHeight, cv::Point3f &realPoint);
 		bool getPointFromReal(cv::Point3f realPoint, int nDepthWidth, int nDepthHeight, cv::Point &depthPoint);
 		HRESULT mapDepthFrameToCameraSpace(cv::Mat depthImage, int nDepthWidth, int nDepthHeight);
+		KCV_mappingView acquireMapping();
+		HRESULT mapCoordinates(const cv::Mat &depth_frame, int nColorWidth, int nColorHeight,
+			cv::Mat &color_coordinates, cv::Mat &depth_coordinates, cv::Mat &camera_coordinates);
+
+		// Calibration cache
+		HRESULT getSerial(std::wstring &serial);
+		HRESULT buildCalibration();
+		HRESULT saveCalibration(const std::wstring &directory);
+		HRESULT loadCalibration(const std::wstring &directory, const std::wstring &serial = L"");
+		void releaseCalibration();
+		bool isCalibrated();
+
+		// Normals and curvature of every mapping, see KCV_mappingView
+		void setNormalEstimation(bool normals, bool curvature = false, int radius = 2);
+
+		// Depth pyramid with the camera coordinates of a mapping
+		HRESULT buildPyramid(KCV_pyramid &pyramid, cv::InputArray depth_frame, const KCV_mappingView &mapping);
+
+		// Frame budget of acquireImages
+		KCV_budget &getBudget() { return m_Budget; }
+
+		// Streams of the multi source reader as FrameSourceTypes bits, depth is always read
+		HRESULT setFrameSources(DWORD sources);
+		DWORD getFrameSources() const { return m_FrameSources; }
+
+		// Synthetic frames in place of the device
+		void setSynthetic(bool synthetic);
+		bool isSynthetic() const { return m_UseSynthetic; }
 
 	private:
 		// Private Constructor
-		KCV_sensor();
+		KCV_sensor(bool open);
 		~KCV_sensor(); //virtual 
 
 		KCV_sensor(const KCV_sensor&);//KCV_sensor const& copy);
@@ -90,11 +232,24 @@ namespace kcv
 
 		// Kinect sensor
 		IKinectSensor *m_KinectSensor;
-		DepthSpacePoint *m_DepthCoordinates;
-		ColorSpacePoint *m_ColorCoordinates;
-		CameraSpacePoint *m_CameraCoordinates;
 		ICoordinateMapper *m_CoordinateMapper;
 
+		// Mapping slots, one published, the others written or still read
+		static const int KCV_MAPPING_SLOTS = 3;
+		static const int KCV_MAPPING_WAIT_MS = 5;	// longest wait for a spare slot
+		KCV_mapping m_Mappings[KCV_MAPPING_SLOTS];
+		std::atomic<int> m_Published;
+		std::mutex m_MappingMutex;
+		unsigned long long m_MappingSequence;
+		KCV_calibration m_Calibration;
+		KCV_budget m_Budget;
+		KCV_normals m_Normals;
+		bool m_EstimateNormals;
+		bool m_EstimateCurvature;
+		DWORD m_FrameSources;
+		bool m_UseSynthetic;
+		KCV_syntheticSource m_Synthetic;
+
 		// Images
 		IColorFrame *c_frame;
 		IFrameDescription *c_fd;
@@ -109,7 +264,16 @@ namespace kcv
 		bool coordMapped;
 
 		HRESULT coordinateMapper(const UINT16* p_DepthBuffer, int nDepthWidth, int nDepthHeight,
-			const RGBQUAD* p_ColorBuffer, int nColorWidth, int nColorHeight);
+			const RGBQUAD* p_ColorBuffer, int nColorWidth, int nColorHeight, KCV_budget *budget = NULL);
+		HRESULT mapFrame(const UINT16* p_DepthBuffer, int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight,
+			ColorSpacePoint *p_ColorPoints, DepthSpacePoint *p_DepthPoints, CameraSpacePoint *p_CameraPoints, KCV_budget *budget = NULL);
+		HRESULT acquireMapped(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat *p_InfraredFrame, cv::Mat *p_LongExposureFrame);
+		HRESULT acquireFrames(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat *p_InfraredFrame, cv::Mat *p_LongExposureFrame,
+			bool acquire_color);
+		void estimateNormals(KCV_mapping *mapping, int nDepthWidth, int nDepthHeight, KCV_budget *budget);
+		HRESULT beginMapping(KCV_mapping *&mapping);
+		void publishMapping(KCV_mapping *mapping);
+		bool useCalibration(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight);
 
 		HRESULT status;
 
@@ -0,0 +1,408 @@
+//    File: Kinect2XBackground.cpp
+
+#include "Kinect2XBackground.h"
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include <emmintrin.h>
+
+using namespace kcv;
+
+/*!
+\class KCV_background
+\brief The KCV_background class learns the static depth background and segments nearer foreground of every frame.
+
+Every pixel keeps the mean and variance of its background depth and the nearest background depth seen, which relaxes
+towards the mean at the update rate. A measured pixel is foreground when it is nearer than the nearest background by
+more than the given deviations and margin, or when no background was seen there. Depth 0 and USHRT_MAX is not
+measured. A pixel without background joins the model after learning when it keeps its depth within the margin for as
+many frames as the model learns, so background uncovered or first measured later is not foreground for ever.
+Classification and the update of background pixels run four pixels at once and rows are split across cores.
+Foreground is returned as a mask, as runs of every row and as 8-connected blobs, blobs below the minimum area are
+dropped as noise.
+*/
+
+namespace
+{
+	// Variance of a newly seen background pixel, mm^2
+	const float KCV_INITIAL_VARIANCE = 100.0f;
+
+	inline __m128 select(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	class KCV_backgroundBody : public cv::ParallelLoopBody
+	{
+	public:
+		KCV_backgroundBody(const cv::Mat &depth, cv::Mat &mean, cv::Mat &variance, cv::Mat &nearest, cv::Mat &candidate,
+			cv::Mat &count, cv::Mat &mask, std::vector<std::vector<KCV_run> > &rowRuns, float learnRate, float rate,
+			float deviations, float margin, float adoptFrames, bool learning, bool update)
+			: m_Depth(depth), m_Mean(mean), m_Variance(variance), m_Nearest(nearest), m_Candidate(candidate), m_Count(count),
+			m_Mask(mask), m_RowRuns(rowRuns), m_LearnRate(learnRate), m_Rate(rate), m_Deviations(deviations), m_Margin(margin),
+			m_AdoptFrames(adoptFrames), m_Learning(learning), m_Update(update)
+		{
+		}
+
+		void operator()(const cv::Range &range) const
+		{
+			const int width = m_Depth.cols;
+			for (int y = range.start; y < range.end; ++y)
+			{
+				const UINT16 *p_Depth = m_Depth.ptr<UINT16>(y);
+				float *p_Mean = m_Mean.ptr<float>(y);
+				float *p_Variance = m_Variance.ptr<float>(y);
+				float *p_Nearest = m_Nearest.ptr<float>(y);
+				float *p_Candidate = m_Candidate.ptr<float>(y);
+				float *p_Count = m_Count.ptr<float>(y);
+				UCHAR *p_Mask = m_Mask.ptr<UCHAR>(y);
+
+				const __m128i zero = _mm_setzero_si128();
+				int x = 0;
+				for (; x + 8 <= width; x += 8)
+				{
+					__m128i depth = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Depth + x));
+					__m128i lo = classify(_mm_unpacklo_epi16(depth, zero), p_Mean + x, p_Variance + x, p_Nearest + x,
+						p_Candidate + x, p_Count + x);
+					__m128i hi = classify(_mm_unpackhi_epi16(depth, zero), p_Mean + x + 4, p_Variance + x + 4, p_Nearest + x + 4,
+						p_Candidate + x + 4, p_Count + x + 4);
+					__m128i foreground = _mm_packs_epi32(lo, hi);
+					_mm_storel_epi64(reinterpret_cast<__m128i*>(p_Mask + x), _mm_packs_epi16(foreground, foreground));
+				}
+				for (; x < width; ++x)
+				{
+					p_Mask[x] = classify(p_Depth[x], p_Mean[x], p_Variance[x], p_Nearest[x], p_Candidate[x], p_Count[x]) ? 255 : 0;
+				}
+
+				extractRuns(y, p_Mask, width, m_RowRuns[y]);
+			}
+		}
+
+	private:
+		// Classify and update four pixels of depth \a d32 , returns all bits set on foreground
+		__m128i classify(__m128i d32, float *p_Mean, float *p_Variance, float *p_Nearest, float *p_Candidate, float *p_Count) const
+		{
+			const __m128 d = _mm_cvtepi32_ps(d32);
+			const __m128 valid = _mm_and_ps(_mm_cmpgt_ps(d, _mm_setzero_ps()), _mm_cmplt_ps(d, _mm_set1_ps((float)USHRT_MAX)));
+			const __m128 mean = _mm_loadu_ps(p_Mean);
+			const __m128 variance = _mm_loadu_ps(p_Variance);
+			const __m128 nearest = _mm_loadu_ps(p_Nearest);
+			const __m128 known = _mm_cmpgt_ps(mean, _mm_setzero_ps());
+
+			__m128 foreground = _mm_setzero_ps();
+			if (!m_Learning)
+			{
+				__m128 threshold = _mm_sub_ps(nearest,
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m_Deviations), _mm_sqrt_ps(variance)), _mm_set1_ps(m_Margin)));
+				__m128 nearer = _mm_or_ps(_mm_cmplt_ps(d, threshold), _mm_cmpeq_ps(known, _mm_setzero_ps()));
+				foreground = _mm_and_ps(valid, nearer);
+			}
+
+			if (m_Update && !m_Learning)
+			{
+				// unknown pixels count the frames their depth stays within the margin of the candidate
+				const __m128 unknown = _mm_andnot_ps(known, valid);
+				const __m128 candidate = _mm_loadu_ps(p_Candidate);
+				const __m128 count = _mm_loadu_ps(p_Count);
+				const __m128 distance = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(d, candidate));
+				const __m128 consistent = _mm_cmple_ps(distance, _mm_set1_ps(m_Margin));
+				const __m128 count1 = select(consistent, _mm_add_ps(count, _mm_set1_ps(1.0f)), _mm_set1_ps(1.0f));
+				const __m128 adopt = _mm_and_ps(unknown, _mm_cmpge_ps(count1, _mm_set1_ps(m_AdoptFrames)));
+
+				_mm_storeu_ps(p_Candidate, select(unknown, select(consistent, candidate, d), candidate));
+				_mm_storeu_ps(p_Count, select(unknown, _mm_andnot_ps(adopt, count1), count));
+				foreground = _mm_andnot_ps(adopt, foreground);
+			}
+
+			if (m_Update)
+			{
+				const __m128 background = _mm_andnot_ps(foreground, valid);
+				const __m128 tracked = _mm_and_ps(background, known);
+				const __m128 fresh = _mm_andnot_ps(known, background);
+				const __m128 learnRate = _mm_set1_ps(m_LearnRate);
+
+				__m128 diff = _mm_sub_ps(d, mean);
+				__m128 mean1 = _mm_add_ps(mean, _mm_mul_ps(learnRate, diff));
+				__m128 variance1 = _mm_add_ps(variance, _mm_mul_ps(learnRate, _mm_sub_ps(_mm_mul_ps(diff, diff), variance)));
+				__m128 nearest1 = _mm_min_ps(d, _mm_add_ps(nearest, _mm_mul_ps(_mm_set1_ps(m_Rate), _mm_sub_ps(mean1, nearest))));
+
+				_mm_storeu_ps(p_Mean, select(tracked, mean1, select(fresh, d, mean)));
+				_mm_storeu_ps(p_Variance, select(tracked, variance1, select(fresh, _mm_set1_ps(KCV_INITIAL_VARIANCE), variance)));
+				_mm_storeu_ps(p_Nearest, select(tracked, nearest1, select(fresh, d, nearest)));
+			}
+			return _mm_castps_si128(foreground);
+		}
+
+		// Scalar classify of one pixel
+		bool classify(UINT16 depth, float &mean, float &variance, float &nearest, float &candidate, float &count) const
+		{
+			const float d = depth;
+			const bool valid = depth != 0 && depth != USHRT_MAX;
+			const bool known = mean > 0.0f;
+			bool foreground = !m_Learning && valid &&
+				(!known || d < nearest - (m_Deviations * std::sqrt(variance) + m_Margin));
+
+			if (m_Update && !m_Learning && valid && !known)
+			{
+				if (std::fabs(d - candidate) <= m_Margin)
+				{
+					count += 1.0f;
+				}
+				else
+				{
+					candidate = d;
+					count = 1.0f;
+				}
+				if (count >= m_AdoptFrames)
+				{
+					count = 0.0f;
+					foreground = false;
+				}
+			}
+
+			if (m_Update && valid && !foreground)
+			{
+				if (known)
+				{
+					float diff = d - mean;
+					mean += m_LearnRate * diff;
+					variance += m_LearnRate * (diff * diff - variance);
+					nearest = std::min(d, nearest + m_Rate * (mean - nearest));
+				}
+				else
+				{
+					mean = d;
+					variance = KCV_INITIAL_VARIANCE;
+					nearest = d;
+				}
+			}
+			return foreground;
+		}
+
+		// Runs of row \a y of \a p_Mask , background is skipped sixteen pixels at once
+		static void extractRuns(int y, const UCHAR *p_Mask, int width, std::vector<KCV_run> &runs)
+		{
+			runs.clear();
+			int x = 0;
+			while (x < width)
+			{
+				while (x + 16 <= width && _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Mask + x))) == 0)
+					x += 16;
+				while (x < width && p_Mask[x] == 0)
+					++x;
+				if (x >= width)
+					break;
+
+				KCV_run run;
+				run.y = y;
+				run.begin = x;
+				while (x < width && p_Mask[x] != 0)
+					++x;
+				run.end = x;
+				run.blob = -1;
+				runs.push_back(run);
+			}
+		}
+
+		const cv::Mat &m_Depth;
+		cv::Mat &m_Mean;
+		cv::Mat &m_Variance;
+		cv::Mat &m_Nearest;
+		cv::Mat &m_Candidate;
+		cv::Mat &m_Count;
+		cv::Mat &m_Mask;
+		std::vector<std::vector<KCV_run> > &m_RowRuns;
+		float m_LearnRate;
+		float m_Rate;
+		float m_Deviations;
+		float m_Margin;
+		float m_AdoptFrames;
+		bool m_Learning;
+		bool m_Update;
+	};
+
+	int findRoot(std::vector<int> &parent, int i)
+	{
+		while (parent[i] != i)
+		{
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	}
+}
+
+/*!
+Constructs model that learns \a learnFrames frames before it reports foreground and then follows the background
+with \a rate . Foreground is nearer than the nearest background by \a deviations standard deviations and \a margin mm,
+blobs smaller than \a minBlobArea pixels are dropped.
+*/
+KCV_background::KCV_background(int learnFrames, float rate, float deviations, float margin, int minBlobArea)
+	: m_LearnFrames(1), m_Rate(0.0f), m_Deviations(deviations), m_Margin(margin), m_MinBlobArea(1), m_Frame(0)
+{
+	setLearnFrames(learnFrames);
+	setRate(rate);
+	setMinBlobArea(minBlobArea);
+}
+
+/*!
+Forget the background, the next frames are learned again.
+*/
+void KCV_background::reset()
+{
+	m_Frame = 0;
+	m_Mean.release();
+	m_Variance.release();
+	m_Nearest.release();
+	m_Candidate.release();
+	m_Count.release();
+}
+
+/*!
+Segment \a depth_frame (CV_16U) into \a foreground and, when \a update is set, learn its background pixels and count
+the consistent frames of pixels without background. The model is reset when the frame size changes. No foreground is
+reported while the model learns.
+*/
+HRESULT KCV_background::apply(cv::InputArray depth_frame, KCV_foreground &foreground, bool update)
+{
+	cv::Mat depth = depth_frame.getMat();
+	if (depth.type() != CV_16U || depth.empty())
+	{
+		return E_INVALIDARG;
+	}
+	if (m_Mean.size() != depth.size())
+	{
+		reset();
+		m_Mean.create(depth.size(), CV_32F);
+		m_Mean.setTo(cv::Scalar::all(0));
+		m_Variance.create(depth.size(), CV_32F);
+		m_Variance.setTo(cv::Scalar::all(0));
+		m_Nearest.create(depth.size(), CV_32F);
+		m_Nearest.setTo(cv::Scalar::all(0));
+		m_Candidate.create(depth.size(), CV_32F);
+		m_Candidate.setTo(cv::Scalar::all(0));
+		m_Count.create(depth.size(), CV_32F);
+		m_Count.setTo(cv::Scalar::all(0));
+	}
+	foreground.mask.create(depth.size(), CV_8U);
+	m_RowRuns.resize(depth.rows);
+
+	// cumulative average while learning
+	const bool learning = !isLearned();
+	const float learnRate = learning ? std::max(1.0f / (m_Frame + 1), m_Rate) : m_Rate;
+	KCV_backgroundBody body(depth, m_Mean, m_Variance, m_Nearest, m_Candidate, m_Count, foreground.mask, m_RowRuns,
+		learnRate, m_Rate, m_Deviations, m_Margin, (float)m_LearnFrames, learning, update);
+	cv::parallel_for_(cv::Range(0, depth.rows), body, depth.rows / 16.0);
+	if (update && learning)
+	{
+		++m_Frame;
+	}
+
+	foreground.runs.clear();
+	for (int y = 0; y < depth.rows; ++y)
+	{
+		foreground.runs.insert(foreground.runs.end(), m_RowRuns[y].begin(), m_RowRuns[y].end());
+	}
+	label(foreground);
+	return S_OK;
+}
+
+/*!
+Join runs of \a foreground touching in adjacent rows into blobs, drop blobs below the minimum area from the runs
+and the mask.
+*/
+void KCV_background::label(KCV_foreground &foreground)
+{
+	std::vector<KCV_run> &runs = foreground.runs;
+	const int count = (int)runs.size();
+	m_Parent.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		m_Parent[i] = i;
+	}
+
+	// runs of the previous row touching a run, 8-connected
+	int previousBegin = 0, previousEnd = 0;
+	for (int i = 0; i < count;)
+	{
+		const int y = runs[i].y;
+		int j = i;
+		while (j < count && runs[j].y == y)
+			++j;
+
+		if (previousEnd > previousBegin && runs[previousBegin].y == y - 1)
+		{
+			int p = previousBegin;
+			for (int c = i; c < j; ++c)
+			{
+				while (p < previousEnd && runs[p].end < runs[c].begin)
+					++p;
+				for (int q = p; q < previousEnd && runs[q].begin <= runs[c].end; ++q)
+				{
+					int a = findRoot(m_Parent, q), b = findRoot(m_Parent, c);
+					if (a != b)
+						m_Parent[std::max(a, b)] = std::min(a, b);
+				}
+			}
+		}
+		previousBegin = i;
+		previousEnd = j;
+		i = j;
+	}
+
+	// blobs numbered in row major order of their first run
+	foreground.blobs.clear();
+	m_BlobOf.assign(count, -1);
+	for (int i = 0; i < count; ++i)
+	{
+		int root = findRoot(m_Parent, i);
+		const KCV_run &run = runs[i];
+		cv::Rect extent(run.begin, run.y, run.end - run.begin, 1);
+		if (m_BlobOf[root] < 0)
+		{
+			m_BlobOf[root] = (int)foreground.blobs.size();
+			KCV_blob blob;
+			blob.box = extent;
+			blob.area = 0;
+			foreground.blobs.push_back(blob);
+		}
+		KCV_blob &blob = foreground.blobs[m_BlobOf[root]];
+		blob.box |= extent;
+		blob.area += extent.width;
+		runs[i].blob = m_BlobOf[root];
+	}
+
+	// drop small blobs and renumber the rest
+	std::vector<int> &index = m_Parent;
+	index.resize(foreground.blobs.size());
+	int blobs = 0;
+	foreground.pixels = 0;
+	for (size_t b = 0; b < foreground.blobs.size(); ++b)
+	{
+		if (foreground.blobs[b].area < m_MinBlobArea)
+		{
+			index[b] = -1;
+			continue;
+		}
+		index[b] = blobs;
+		foreground.pixels += foreground.blobs[b].area;
+		foreground.blobs[blobs++] = foreground.blobs[b];
+	}
+	foreground.blobs.resize(blobs);
+
+	size_t kept = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		KCV_run run = runs[i];
+		run.blob = index[run.blob];
+		if (run.blob < 0)
+		{
+			memset(foreground.mask.ptr<UCHAR>(run.y) + run.begin, 0, run.end - run.begin);
+			continue;
+		}
+		runs[kept++] = run;
+	}
+	runs.resize(kept);
+}
@@ -0,0 +1,86 @@
+//    File: Kinect2XBackground.h
+
+#ifndef KCV_BACKGROUND_H
+#define KCV_BACKGROUND_H
+
+// Kinect2XBackground.h
+
+#include <algorithm>
+#include <vector>
+
+// Kinect SDK
+#include <Kinect.h>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+namespace kcv
+{
+	// Horizontal run of foreground pixels [begin, end) in row y
+	struct KCV_run
+	{
+		int y;
+		int begin;
+		int end;
+		int blob;		// index to KCV_foreground::blobs
+	};
+
+	// Connected foreground pixels
+	struct KCV_blob
+	{
+		cv::Rect box;	// bounding box on the depth grid
+		int area;		// pixels
+	};
+
+	// Foreground of one depth frame, storage is reused between frames
+	struct KCV_foreground
+	{
+		cv::Mat mask;					// CV_8U, 255 on foreground, blobs below the minimum area removed
+		std::vector<KCV_run> runs;		// row major
+		std::vector<KCV_blob> blobs;
+		int pixels;						// foreground pixels, the sum of blob areas
+	};
+
+	class KCV_background
+	{
+	public:
+		explicit KCV_background(int learnFrames = 30, float rate = 0.01f, float deviations = 2.0f, float margin = 30.0f,
+			int minBlobArea = 64);
+
+		void reset();
+		bool isLearned() const { return m_Frame >= m_LearnFrames; }
+		int frames() const { return m_Frame; }
+
+		void setLearnFrames(int learnFrames) { m_LearnFrames = std::max(learnFrames, 1); }
+		void setRate(float rate) { m_Rate = std::min(std::max(rate, 0.0f), 1.0f); }
+		void setThreshold(float deviations, float margin) { m_Deviations = deviations; m_Margin = margin; }
+		void setMinBlobArea(int minBlobArea) { m_MinBlobArea = std::max(minBlobArea, 1); }
+
+		HRESULT apply(cv::InputArray depth_frame, KCV_foreground &foreground, bool update = true);
+
+		const cv::Mat &nearest() const { return m_Nearest; }
+		const cv::Mat &variance() const { return m_Variance; }
+
+	private:
+		void label(KCV_foreground &foreground);
+
+		int m_LearnFrames;		// frames learned before foreground is reported, and before a new pixel joins the model
+		float m_Rate;			// update rate of the background after learning
+		float m_Deviations;		// foreground is nearer than nearest - deviations * sigma - margin
+		float m_Margin;			// mm
+		int m_MinBlobArea;
+		int m_Frame;
+
+		cv::Mat m_Mean;			// CV_32F mm, 0 where no background was seen
+		cv::Mat m_Variance;		// CV_32F mm^2
+		cv::Mat m_Nearest;		// CV_32F mm, running minimum relaxing towards the mean
+		cv::Mat m_Candidate;	// CV_32F mm, depth of a pixel without background
+		cv::Mat m_Count;		// CV_32F, measured frames within the margin of the candidate
+
+		std::vector<std::vector<KCV_run> > m_RowRuns;
+		std::vector<int> m_Parent;
+		std::vector<int> m_BlobOf;
+	};
+}
+
+#endif // KCV_BACKGROUND_H
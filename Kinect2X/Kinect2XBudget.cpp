@@ -0,0 +1,213 @@
+//    File: Kinect2XBudget.cpp
+
+#include "Kinect2XBudget.h"
+
+#include <cstring>
+
+using namespace kcv;
+
+/*!
+\class KCV_budget
+\brief The KCV_budget class measures the cost of every frame and steps through degradation levels
+when the frame budget is exceeded, recovering once there is headroom again.
+*/
+
+namespace
+{
+	// Smoothing of measured costs
+	const double KCV_SMOOTHING = 0.2;
+	// Frames over budget before degrading
+	const int KCV_DEGRADE_FRAMES = 3;
+	// Frames with headroom before recovering
+	const int KCV_RECOVER_FRAMES = 30;
+	// Frames to settle after a level change before measuring its savings
+	const int KCV_SETTLE_FRAMES = 10;
+	// Part of the budget the recovered level may use
+	const double KCV_HEADROOM = 0.8;
+	// Reused color to depth mapping is refreshed every n-th frame
+	const int KCV_REFRESH_FRAMES = 4;
+}
+
+/*!
+Constructs disabled controller, frames are processed in full until a budget is set.
+*/
+KCV_budget::KCV_budget()
+	: m_BudgetMs(0.0), m_ColorInterval(2)
+{
+	reset();
+}
+
+/*!
+Set frame budget to \a frameMs , 0 disables the controller.
+*/
+void KCV_budget::setBudget(double frameMs)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_BudgetMs = frameMs > 0.0 ? frameMs : 0.0;
+	if (m_BudgetMs == 0.0)
+		m_Counters.level = KCV_LEVEL_FULL;
+}
+
+/*!
+Returns frame budget in ms.
+*/
+double KCV_budget::getBudget() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_BudgetMs;
+}
+
+/*!
+Acquire color every \a interval frames at the sparse color level.
+*/
+void KCV_budget::setColorInterval(int interval)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_ColorInterval = interval > 1 ? interval : 2;
+}
+
+/*!
+Drop measurements and counters, back to full processing.
+*/
+void KCV_budget::reset()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	memset(m_CurrentMs, 0, sizeof(m_CurrentMs));
+	memset(m_LevelEntryMs, 0, sizeof(m_LevelEntryMs));
+	memset(m_SavingsMs, 0, sizeof(m_SavingsMs));
+	memset(&m_Counters, 0, sizeof(m_Counters));
+	m_OverBudget = 0;
+	m_UnderBudget = 0;
+	m_Settle = 0;
+	m_Open = false;
+}
+
+/*!
+Finish the previous frame, including costs recorded after its acquisition, and start measuring a new one.
+*/
+void KCV_budget::beginFrame()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Open)
+		finishFrame();
+	memset(m_CurrentMs, 0, sizeof(m_CurrentMs));
+	m_Open = true;
+}
+
+/*!
+Add \a ms spent in \a cost to the current frame.
+*/
+void KCV_budget::record(KCV_cost cost, double ms)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_CurrentMs[cost] += ms;
+}
+
+/*!
+Drop the current frame, used when no new frame was acquired.
+*/
+void KCV_budget::discardFrame()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Open = false;
+}
+
+/*!
+Account the current frame and decide the level of the next one. Called with mutex held.
+*/
+void KCV_budget::finishFrame()
+{
+	double frameMs = 0.0;
+	for (int i = 0; i < KCV_COST_COUNT; ++i)
+	{
+		m_Counters.costMs[i] += KCV_SMOOTHING * (m_CurrentMs[i] - m_Counters.costMs[i]);
+		frameMs += m_CurrentMs[i];
+	}
+	m_Counters.frameMs = m_Counters.frames == 0 ? frameMs : m_Counters.frameMs + KCV_SMOOTHING * (frameMs - m_Counters.frameMs);
+	m_Counters.frames++;
+
+	if (m_BudgetMs == 0.0)
+		return;
+	if (frameMs > m_BudgetMs)
+		m_Counters.overruns++;
+
+	int &level = m_Counters.level;
+	if (m_Settle > 0)
+	{
+		// savings of the level are known once the smoothed cost followed the change
+		if (--m_Settle == 0)
+		{
+			double saved = m_LevelEntryMs[level] - m_Counters.frameMs;
+			m_SavingsMs[level] = saved > 0.0 ? saved : 0.0;
+		}
+		return;
+	}
+
+	m_OverBudget = m_Counters.frameMs > m_BudgetMs ? m_OverBudget + 1 : 0;
+	if (m_OverBudget >= KCV_DEGRADE_FRAMES && level < KCV_LEVEL_COUNT - 1)
+	{
+		++level;
+		m_LevelEntryMs[level] = m_Counters.frameMs;
+		m_Counters.degradations++;
+		m_OverBudget = 0;
+		m_UnderBudget = 0;
+		m_Settle = KCV_SETTLE_FRAMES;
+		return;
+	}
+
+	// recover only when the previous level would fit with headroom
+	bool fits = level > KCV_LEVEL_FULL && m_Counters.frameMs + m_SavingsMs[level] < m_BudgetMs * KCV_HEADROOM;
+	m_UnderBudget = fits ? m_UnderBudget + 1 : 0;
+	if (m_UnderBudget >= KCV_RECOVER_FRAMES)
+	{
+		--level;
+		m_Counters.recoveries++;
+		m_UnderBudget = 0;
+		m_OverBudget = 0;
+	}
+}
+
+/*!
+Returns if the color to depth mapping is skipped this frame, the previous one is reused then.
+*/
+bool KCV_budget::skipColorToDepth()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Counters.level < KCV_LEVEL_SKIP_COLOR_TO_DEPTH || m_Counters.frames % KCV_REFRESH_FRAMES == 0)
+		return false;
+	m_Counters.skippedColorToDepth++;
+	return true;
+}
+
+/*!
+Returns if color is acquired this frame.
+*/
+bool KCV_budget::acquireColor()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Counters.level < KCV_LEVEL_SPARSE_COLOR || m_Counters.frames % m_ColorInterval == 0)
+		return true;
+	m_Counters.skippedColorFrames++;
+	return false;
+}
+
+/*!
+Returns sampling step of aligned outputs, 2 aligns at half resolution and repeats every sample over 2 x 2 pixels.
+*/
+int KCV_budget::alignStep()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Counters.level < KCV_LEVEL_REDUCED_ALIGN)
+		return 1;
+	m_Counters.reducedAlignments++;
+	return 2;
+}
+
+/*!
+Returns level, smoothed costs and decision counters.
+*/
+KCV_budgetCounters KCV_budget::getCounters() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Counters;
+}
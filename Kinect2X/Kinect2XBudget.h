@@ -0,0 +1,90 @@
+//    File: Kinect2XBudget.h
+
+#ifndef KCV_BUDGET_H
+#define KCV_BUDGET_H
+
+// Kinect2XBudget.h
+
+#include <mutex>
+
+namespace kcv
+{
+	// Measured parts of one frame
+	enum KCV_cost
+	{
+		KCV_COST_ACQUIRE = 0,
+		KCV_COST_DEPTH_TO_COLOR,
+		KCV_COST_COLOR_TO_DEPTH,
+		KCV_COST_DEPTH_TO_CAMERA,
+		KCV_COST_NORMALS,
+		KCV_COST_ALIGN,
+		KCV_COST_COUNT
+	};
+
+	// Degradation levels, every level keeps the savings of the previous ones
+	enum KCV_budgetLevel
+	{
+		KCV_LEVEL_FULL = 0,
+		KCV_LEVEL_SKIP_COLOR_TO_DEPTH,	// reuse color to depth mapping of the previous frame
+		KCV_LEVEL_REDUCED_ALIGN,		// align at half resolution, the output keeps its size
+		KCV_LEVEL_SPARSE_COLOR,			// acquire color only every n-th frame
+		KCV_LEVEL_COUNT
+	};
+
+	struct KCV_budgetCounters
+	{
+		int level;
+		double frameMs;					// smoothed cost of a frame
+		double costMs[KCV_COST_COUNT];	// smoothed cost of every part
+		unsigned long long frames;
+		unsigned long long overruns;
+		unsigned long long degradations;
+		unsigned long long recoveries;
+		unsigned long long skippedColorToDepth;
+		unsigned long long skippedColorFrames;
+		unsigned long long reducedAlignments;
+	};
+
+	class KCV_budget
+	{
+	public:
+		KCV_budget();
+
+		void setBudget(double frameMs);
+		double getBudget() const;
+		void setColorInterval(int interval);
+		void reset();
+
+		void beginFrame();
+		void record(KCV_cost cost, double ms);
+		void discardFrame();
+
+		bool skipColorToDepth();
+		bool acquireColor();
+		int alignStep();
+
+		KCV_budgetCounters getCounters() const;
+
+	private:
+		KCV_budget(const KCV_budget&);
+		KCV_budget& operator=(const KCV_budget&);
+
+		void finishFrame();
+
+		mutable std::mutex m_Mutex;
+		double m_BudgetMs;
+		int m_ColorInterval;
+
+		double m_CurrentMs[KCV_COST_COUNT];
+		double m_LevelEntryMs[KCV_LEVEL_COUNT];	// frame cost when the level was entered
+		double m_SavingsMs[KCV_LEVEL_COUNT];	// cost saved by entering the level
+		int m_OverBudget;
+		int m_UnderBudget;
+		int m_Settle;
+		bool m_Open;
+
+		KCV_budgetCounters m_Counters;
+	};
+}
+
+#endif // KCV_BUDGET_H
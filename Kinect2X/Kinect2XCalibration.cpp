@@ -0,0 +1,647 @@
+//    File: Kinect2XCalibration.cpp
+
+#include "Kinect2XCalibration.h"
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace kcv;
+
+/*!
+\class KCV_calibration
+\brief The KCV_calibration class holds the depth to camera table and the depth to color calibration
+of one device, so coordinate mapping works without the device attached.
+The mapping functions may run concurrently with each other; build(), assign(), load() and release() replace
+the tables and must not run while another thread maps through the calibration.
+*/
+
+namespace
+{
+	const char KCV_CALIBRATION_MAGIC[8] = { 'K', 'C', 'V', 'C', 'A', 'L', 'I', 'B' };
+
+	// Reference depths [mm] used to fit the depth to color lut
+	const UINT16 KCV_NEAR_DEPTH = 1000;
+	const UINT16 KCV_FAR_DEPTH = 4000;
+
+	// Largest color footprint [px] of a single depth pixel
+	const int KCV_MAX_FOOTPRINT = 8;
+
+	UINT64 alignOffset(UINT64 offset)
+	{
+		return (offset + 15) & ~((UINT64)15);
+	}
+
+	// Returns if \a count elements of \a elementSize at \a offset lie behind the header of a \a fileSize file,
+	// written so a corrupt offset or count cannot wrap around
+	bool fitsFile(UINT64 offset, UINT64 count, UINT64 elementSize, UINT64 fileSize)
+	{
+		return offset >= sizeof(KCV_calibrationHeader) && offset <= fileSize && count <= (fileSize - offset) / elementSize;
+	}
+
+	bool isValid(const ColorSpacePoint &p)
+	{
+		return p.X != -std::numeric_limits<float>::infinity() && p.Y != -std::numeric_limits<float>::infinity();
+	}
+
+	HRESULT writeBlock(HANDLE file, const void *data, UINT64 size)
+	{
+		const BYTE *p = reinterpret_cast<const BYTE*>(data);
+		while (size > 0)
+		{
+			DWORD chunk = (DWORD)(size > 0x40000000 ? 0x40000000 : size);
+			DWORD written = 0;
+			if (!WriteFile(file, p, chunk, &written, NULL) || written != chunk)
+			{
+				return HRESULT_FROM_WIN32(GetLastError());
+			}
+			p += chunk;
+			size -= chunk;
+		}
+		return S_OK;
+	}
+
+	HRESULT writePadding(HANDLE file, UINT64 from, UINT64 to)
+	{
+		static const BYTE zeros[16] = { 0 };
+		return writeBlock(file, zeros, to - from);
+	}
+}
+
+/*!
+Constructs an empty calibration.
+*/
+KCV_calibration::KCV_calibration()
+	: m_CameraTable(NULL), m_ColorLut(NULL), m_File(INVALID_HANDLE_VALUE), m_Mapping(NULL), m_View(NULL)
+{
+	memset(&m_Header, 0, sizeof(m_Header));
+}
+
+/*!
+Destructor.
+*/
+KCV_calibration::~KCV_calibration()
+{
+	release();
+}
+
+/*!
+Drop loaded tables and unmap the cache file.
+*/
+void KCV_calibration::release()
+{
+	if (m_View != NULL)
+	{
+		UnmapViewOfFile(m_View);
+		m_View = NULL;
+	}
+	if (m_Mapping != NULL)
+	{
+		CloseHandle(m_Mapping);
+		m_Mapping = NULL;
+	}
+	if (m_File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+	}
+	m_OwnedCameraTable.clear();
+	m_OwnedColorLut.clear();
+	{
+		std::lock_guard<std::mutex> lock(m_ZBufferMutex);
+		std::vector<UINT16>().swap(m_ZBuffer);
+	}
+	m_CameraTable = NULL;
+	m_ColorLut = NULL;
+	m_Serial.clear();
+	memset(&m_Header, 0, sizeof(m_Header));
+}
+
+/*!
+Build the calibration from live \a mapper of device \a serial for depth \a nDepthWidth x \a nDepthHeight
+and color \a nColorWidth x \a nColorHeight frames. Returns E_PENDING while the mapper has no calibration yet.
+*/
+HRESULT KCV_calibration::build(ICoordinateMapper *mapper, const std::wstring &serial, int nDepthWidth, int nDepthHeight,
+	int nColorWidth, int nColorHeight)
+{
+	if (mapper == NULL)
+	{
+		return E_POINTER;
+	}
+
+	const int count = nDepthWidth * nDepthHeight;
+	UINT32 tableCount = 0;
+	PointF *table = NULL;
+	CameraIntrinsics intrinsics;
+	memset(&intrinsics, 0, sizeof(intrinsics));
+
+	HRESULT hr = mapper->GetDepthFrameToCameraSpaceTable(&tableCount, &table);
+	// the table is empty until the device has sent its calibration
+	if (SUCCEEDED(hr) && (table == NULL || tableCount != (UINT32)count))
+	{
+		hr = E_PENDING;
+	}
+	if (SUCCEEDED(hr))
+	{
+		hr = mapper->GetDepthCameraIntrinsics(&intrinsics);
+		if (SUCCEEDED(hr) && intrinsics.FocalLengthX == 0.0f)
+		{
+			hr = E_PENDING;
+		}
+	}
+
+	std::vector<DepthSpacePoint> depthPoints;
+	std::vector<UINT16> nearDepths;
+	std::vector<UINT16> farDepths;
+	std::vector<ColorSpacePoint> nearPoints;
+	std::vector<ColorSpacePoint> farPoints;
+
+	if (SUCCEEDED(hr))
+	{
+		depthPoints.resize(count);
+		for (int y = 0; y < nDepthHeight; ++y)
+		{
+			for (int x = 0; x < nDepthWidth; ++x)
+			{
+				depthPoints[y * nDepthWidth + x].X = (float)x;
+				depthPoints[y * nDepthWidth + x].Y = (float)y;
+			}
+		}
+		nearDepths.assign(count, KCV_NEAR_DEPTH);
+		farDepths.assign(count, KCV_FAR_DEPTH);
+		nearPoints.resize(count);
+		farPoints.resize(count);
+
+		hr = mapper->MapDepthPointsToColorSpace(count, &depthPoints[0], count, &nearDepths[0], count, &nearPoints[0]);
+		if (SUCCEEDED(hr))
+		{
+			hr = mapper->MapDepthPointsToColorSpace(count, &depthPoints[0], count, &farDepths[0], count, &farPoints[0]);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		std::vector<KCV_colorLut> colorLut(count);
+
+		// color position is linear in inverse depth: c = a + b / z
+		const float inverseNear = 1.0f / KCV_NEAR_DEPTH;
+		const float inverseFar = 1.0f / KCV_FAR_DEPTH;
+		for (int i = 0; i < count; ++i)
+		{
+			KCV_colorLut &lut = colorLut[i];
+			if (isValid(nearPoints[i]) && isValid(farPoints[i]))
+			{
+				lut.bx = (nearPoints[i].X - farPoints[i].X) / (inverseNear - inverseFar);
+				lut.ax = nearPoints[i].X - lut.bx * inverseNear;
+				lut.by = (nearPoints[i].Y - farPoints[i].Y) / (inverseNear - inverseFar);
+				lut.ay = nearPoints[i].Y - lut.by * inverseNear;
+			}
+			else
+			{
+				lut.ax = lut.ay = -std::numeric_limits<float>::infinity();
+				lut.bx = lut.by = 0.0f;
+			}
+		}
+
+		hr = assign(serial, nDepthWidth, nDepthHeight, nColorWidth, nColorHeight, intrinsics,
+			std::vector<PointF>(table, table + count), colorLut);
+	}
+
+	if (table != NULL)
+	{
+		CoTaskMemFree(table);
+	}
+	return hr;
+}
+
+/*!
+Take the calibration of device \a serial for depth \a nDepthWidth x \a nDepthHeight and color \a nColorWidth x
+\a nColorHeight frames from depth \a intrinsics , depth to camera \a cameraTable and depth to color \a colorLut ,
+both tables have one entry per depth pixel.
+*/
+HRESULT KCV_calibration::assign(const std::wstring &serial, int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight,
+	const CameraIntrinsics &intrinsics, const std::vector<PointF> &cameraTable, const std::vector<KCV_colorLut> &colorLut)
+{
+	const int count = nDepthWidth * nDepthHeight;
+	if (count <= 0 || nColorWidth <= 0 || nColorHeight <= 0 ||
+		cameraTable.size() != (size_t)count || colorLut.size() != (size_t)count)
+	{
+		return E_INVALIDARG;
+	}
+
+	// arguments may refer to our own, keep copies across release
+	std::wstring deviceSerial = serial;
+	std::vector<PointF> ownedCameraTable(cameraTable);
+	std::vector<KCV_colorLut> ownedColorLut(colorLut);
+	CameraIntrinsics depthIntrinsics = intrinsics;
+	release();
+
+	m_OwnedCameraTable.swap(ownedCameraTable);
+	m_OwnedColorLut.swap(ownedColorLut);
+
+	memcpy(m_Header.magic, KCV_CALIBRATION_MAGIC, sizeof(m_Header.magic));
+	m_Header.version = KCV_CALIBRATION_VERSION;
+	m_Header.headerSize = sizeof(KCV_calibrationHeader);
+	m_Header.depthWidth = nDepthWidth;
+	m_Header.depthHeight = nDepthHeight;
+	m_Header.colorWidth = nColorWidth;
+	m_Header.colorHeight = nColorHeight;
+	wcsncpy_s(m_Header.serial, deviceSerial.c_str(), _TRUNCATE);
+	m_Header.depthIntrinsics = depthIntrinsics;
+	m_Header.cameraTableOffset = alignOffset(sizeof(KCV_calibrationHeader));
+	m_Header.colorLutOffset = alignOffset(m_Header.cameraTableOffset + count * sizeof(PointF));
+
+	m_Serial = m_Header.serial;
+	m_CameraTable = &m_OwnedCameraTable[0];
+	m_ColorLut = &m_OwnedColorLut[0];
+	return S_OK;
+}
+
+/*!
+Write the calibration to the cache file \a path.
+*/
+HRESULT KCV_calibration::save(const std::wstring &path) const
+{
+	if (!isLoaded())
+	{
+		return E_FAIL;
+	}
+
+	// write next to the target and swap, so readers never map a half written file
+	std::wstring tmpPath = path + L".tmp";
+	HANDLE file = CreateFileW(tmpPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	const UINT64 count = (UINT64)m_Header.depthWidth * m_Header.depthHeight;
+	const UINT64 tableEnd = m_Header.cameraTableOffset + count * sizeof(PointF);
+
+	HRESULT hr = writeBlock(file, &m_Header, sizeof(m_Header));
+	if (SUCCEEDED(hr))
+		hr = writePadding(file, sizeof(m_Header), m_Header.cameraTableOffset);
+	if (SUCCEEDED(hr))
+		hr = writeBlock(file, m_CameraTable, count * sizeof(PointF));
+	if (SUCCEEDED(hr))
+		hr = writePadding(file, tableEnd, m_Header.colorLutOffset);
+	if (SUCCEEDED(hr))
+		hr = writeBlock(file, m_ColorLut, count * sizeof(KCV_colorLut));
+	CloseHandle(file);
+
+	if (SUCCEEDED(hr) && !MoveFileExW(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+	if (FAILED(hr))
+	{
+		DeleteFileW(tmpPath.c_str());
+	}
+	return hr;
+}
+
+/*!
+Map the cache file \a path read-only and use its tables. The file must belong to device \a serial and hold
+the calibration of depth \a nDepthWidth x \a nDepthHeight and color \a nColorWidth x \a nColorHeight frames,
+any other file is rejected with ERROR_INVALID_DATA.
+*/
+HRESULT KCV_calibration::load(const std::wstring &path, const std::wstring &serial, int nDepthWidth, int nDepthHeight,
+	int nColorWidth, int nColorHeight)
+{
+	release();
+
+	m_File = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_File == INVALID_HANDLE_VALUE)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	HRESULT hr = S_OK;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(m_File, &fileSize))
+	{
+		hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+	if (SUCCEEDED(hr) && fileSize.QuadPart < (LONGLONG)sizeof(KCV_calibrationHeader))
+	{
+		hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+	if (SUCCEEDED(hr))
+	{
+		m_Mapping = CreateFileMappingW(m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_Mapping == NULL)
+			hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+	if (SUCCEEDED(hr))
+	{
+		m_View = MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+		if (m_View == NULL)
+			hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+	if (SUCCEEDED(hr))
+	{
+		const BYTE *base = reinterpret_cast<const BYTE*>(m_View);
+		memcpy(&m_Header, base, sizeof(m_Header));
+		m_Header.serial[63] = L'\0';
+
+		// the sizes are checked first, they bound the table sizes and the z-buffer of the mapping
+		const UINT64 size = (UINT64)fileSize.QuadPart;
+		const UINT64 count = (UINT64)nDepthWidth * nDepthHeight;
+		if (memcmp(m_Header.magic, KCV_CALIBRATION_MAGIC, sizeof(m_Header.magic)) != 0 ||
+			m_Header.version != KCV_CALIBRATION_VERSION ||
+			m_Header.headerSize != sizeof(KCV_calibrationHeader) ||
+			nDepthWidth <= 0 || nDepthHeight <= 0 || nColorWidth <= 0 || nColorHeight <= 0 ||
+			m_Header.depthWidth != nDepthWidth || m_Header.depthHeight != nDepthHeight ||
+			m_Header.colorWidth != nColorWidth || m_Header.colorHeight != nColorHeight ||
+			serial.compare(0, 63, m_Header.serial) != 0 ||
+			!fitsFile(m_Header.cameraTableOffset, count, sizeof(PointF), size) ||
+			!fitsFile(m_Header.colorLutOffset, count, sizeof(KCV_colorLut), size))
+		{
+			hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+		else
+		{
+			m_Serial = m_Header.serial;
+			m_CameraTable = reinterpret_cast<const PointF*>(base + m_Header.cameraTableOffset);
+			m_ColorLut = reinterpret_cast<const KCV_colorLut*>(base + m_Header.colorLutOffset);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		release();
+	}
+	return hr;
+}
+
+/*!
+Returns the cache file name of device \a serial in \a directory.
+*/
+std::wstring KCV_calibration::cacheFileName(const std::wstring &directory, const std::wstring &serial)
+{
+	std::wstring name = directory;
+	if (!name.empty() && name[name.size() - 1] != L'\\' && name[name.size() - 1] != L'/')
+	{
+		name += L'\\';
+	}
+	name += L"kcv_";
+	// unique ids are device paths, keep them file name safe
+	for (size_t i = 0; i < serial.size(); ++i)
+	{
+		WCHAR c = serial[i];
+		bool safe = (c >= L'0' && c <= L'9') || (c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z');
+		name += safe ? c : L'_';
+	}
+	name += L".calib";
+	return name;
+}
+
+/*!
+Map depth frame \a p_DepthBuffer to color space \a p_ColorPoints.
+*/
+HRESULT KCV_calibration::mapDepthFrameToColorSpace(const UINT16 *p_DepthBuffer, ColorSpacePoint *p_ColorPoints) const
+{
+	if (!isLoaded())
+	{
+		return E_FAIL;
+	}
+
+	const int count = m_Header.depthWidth * m_Header.depthHeight;
+	for (int i = 0; i < count; ++i)
+	{
+		const KCV_colorLut &lut = m_ColorLut[i];
+		UINT16 depth = p_DepthBuffer[i];
+		if (depth != 0 && lut.ax != -std::numeric_limits<float>::infinity())
+		{
+			float inverse = 1.0f / depth;
+			p_ColorPoints[i].X = lut.ax + lut.bx * inverse;
+			p_ColorPoints[i].Y = lut.ay + lut.by * inverse;
+		}
+		else
+		{
+			p_ColorPoints[i].X = -std::numeric_limits<float>::infinity();
+			p_ColorPoints[i].Y = -std::numeric_limits<float>::infinity();
+		}
+	}
+	return S_OK;
+}
+
+/*!
+Map color frame to depth space \a p_DepthPoints using depth frame \a p_DepthBuffer.
+Every depth pixel is projected to color space and fills its footprint, nearest depth wins.
+The depth buffer of the footprints is kept between calls; a call running concurrently with another
+one uses a temporary buffer instead.
+*/
+HRESULT KCV_calibration::mapColorFrameToDepthSpace(const UINT16 *p_DepthBuffer, DepthSpacePoint *p_DepthPoints) const
+{
+	if (!isLoaded())
+	{
+		return E_FAIL;
+	}
+
+	const int nDepthWidth = m_Header.depthWidth;
+	const int nDepthHeight = m_Header.depthHeight;
+	const int nColorWidth = m_Header.colorWidth;
+	const int nColorHeight = m_Header.colorHeight;
+
+	std::unique_lock<std::mutex> lock(m_ZBufferMutex, std::try_to_lock);
+	std::vector<UINT16> localBuffer;
+	std::vector<UINT16> &zBuffer = lock.owns_lock() ? m_ZBuffer : localBuffer;
+	// assign keeps the capacity, only the first call allocates
+	zBuffer.assign(nColorWidth * nColorHeight, USHRT_MAX);
+	for (int i = 0; i < nColorWidth * nColorHeight; ++i)
+	{
+		p_DepthPoints[i].X = -std::numeric_limits<float>::infinity();
+		p_DepthPoints[i].Y = -std::numeric_limits<float>::infinity();
+	}
+
+	for (int y = 0; y < nDepthHeight - 1; ++y)
+	{
+		for (int x = 0; x < nDepthWidth - 1; ++x)
+		{
+			const int index = y * nDepthWidth + x;
+			const UINT16 depth = p_DepthBuffer[index];
+			if (depth == 0 || m_ColorLut[index].ax == -std::numeric_limits<float>::infinity())
+				continue;
+
+			// corners of the depth cell, all projected with the depth of this pixel
+			const float inverse = 1.0f / depth;
+			const int corners[4] = { index, index + 1, index + nDepthWidth, index + nDepthWidth + 1 };
+			float cx[4];
+			float cy[4];
+			bool valid = true;
+			for (int c = 0; c < 4; ++c)
+			{
+				const KCV_colorLut &lut = m_ColorLut[corners[c]];
+				if (lut.ax == -std::numeric_limits<float>::infinity())
+				{
+					valid = false;
+					break;
+				}
+				cx[c] = lut.ax + lut.bx * inverse;
+				cy[c] = lut.ay + lut.by * inverse;
+			}
+			if (!valid)
+				continue;
+
+			float minX = cx[0], maxX = cx[0], minY = cy[0], maxY = cy[0];
+			for (int c = 1; c < 4; ++c)
+			{
+				minX = cx[c] < minX ? cx[c] : minX;
+				maxX = cx[c] > maxX ? cx[c] : maxX;
+				minY = cy[c] < minY ? cy[c] : minY;
+				maxY = cy[c] > maxY ? cy[c] : maxY;
+			}
+			int x0 = (int)std::floor(minX + 0.5f);
+			int x1 = (int)std::floor(maxX + 0.5f);
+			int y0 = (int)std::floor(minY + 0.5f);
+			int y1 = (int)std::floor(maxY + 0.5f);
+			if (x1 - x0 > KCV_MAX_FOOTPRINT || y1 - y0 > KCV_MAX_FOOTPRINT)
+				continue;
+			x0 = x0 < 0 ? 0 : x0;
+			y0 = y0 < 0 ? 0 : y0;
+			x1 = x1 >= nColorWidth ? nColorWidth - 1 : x1;
+			y1 = y1 >= nColorHeight ? nColorHeight - 1 : y1;
+
+			const float spanX = cx[1] - cx[0];
+			const float spanY = cy[2] - cy[0];
+			for (int py = y0; py <= y1; ++py)
+			{
+				for (int px = x0; px <= x1; ++px)
+				{
+					const int colorIndex = py * nColorWidth + px;
+					if (depth >= zBuffer[colorIndex])
+						continue;
+					zBuffer[colorIndex] = depth;
+
+					float u = std::fabs(spanX) > 1e-6f ? (px - cx[0]) / spanX : 0.0f;
+					float v = std::fabs(spanY) > 1e-6f ? (py - cy[0]) / spanY : 0.0f;
+					u = u < 0.0f ? 0.0f : (u > 1.0f ? 1.0f : u);
+					v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+					p_DepthPoints[colorIndex].X = x + u;
+					p_DepthPoints[colorIndex].Y = y + v;
+				}
+			}
+		}
+	}
+	return S_OK;
+}
+
+/*!
+Map depth frame \a p_DepthBuffer to camera space \a p_CameraPoints.
+*/
+HRESULT KCV_calibration::mapDepthFrameToCameraSpace(const UINT16 *p_DepthBuffer, CameraSpacePoint *p_CameraPoints) const
+{
+	if (!isLoaded())
+	{
+		return E_FAIL;
+	}
+
+	const int count = m_Header.depthWidth * m_Header.depthHeight;
+	for (int i = 0; i < count; ++i)
+	{
+		UINT16 depth = p_DepthBuffer[i];
+		if (depth != 0)
+		{
+			float z = depth * 0.001f;
+			p_CameraPoints[i].X = m_CameraTable[i].X * z;
+			p_CameraPoints[i].Y = m_CameraTable[i].Y * z;
+			p_CameraPoints[i].Z = z;
+		}
+		else
+		{
+			p_CameraPoints[i].X = -std::numeric_limits<float>::infinity();
+			p_CameraPoints[i].Y = -std::numeric_limits<float>::infinity();
+			p_CameraPoints[i].Z = -std::numeric_limits<float>::infinity();
+		}
+	}
+	return S_OK;
+}
+
+/*!
+Bilinear sample of the depth to camera table at \a x , \a y , linear outside of the frame.
+*/
+void KCV_calibration::sampleTable(float x, float y, PointF &value) const
+{
+	const int nDepthWidth = m_Header.depthWidth;
+	const int nDepthHeight = m_Header.depthHeight;
+
+	int ix = (int)std::floor(x);
+	int iy = (int)std::floor(y);
+	ix = ix < 0 ? 0 : (ix > nDepthWidth - 2 ? nDepthWidth - 2 : ix);
+	iy = iy < 0 ? 0 : (iy > nDepthHeight - 2 ? nDepthHeight - 2 : iy);
+	const float fx = x - ix;
+	const float fy = y - iy;
+
+	const PointF &p00 = m_CameraTable[iy * nDepthWidth + ix];
+	const PointF &p10 = m_CameraTable[iy * nDepthWidth + ix + 1];
+	const PointF &p01 = m_CameraTable[(iy + 1) * nDepthWidth + ix];
+	const PointF &p11 = m_CameraTable[(iy + 1) * nDepthWidth + ix + 1];
+
+	value.X = (1 - fy) * ((1 - fx) * p00.X + fx * p10.X) + fy * ((1 - fx) * p01.X + fx * p11.X);
+	value.Y = (1 - fy) * ((1 - fx) * p00.Y + fx * p10.Y) + fy * ((1 - fx) * p01.Y + fx * p11.Y);
+}
+
+/*!
+Map \a cameraPoint to depth space \a p_DepthPoint by inverting the depth to camera table.
+*/
+HRESULT KCV_calibration::mapCameraPointToDepthSpace(const CameraSpacePoint &cameraPoint, DepthSpacePoint *p_DepthPoint) const
+{
+	p_DepthPoint->X = -std::numeric_limits<float>::infinity();
+	p_DepthPoint->Y = -std::numeric_limits<float>::infinity();
+	if (!isLoaded())
+	{
+		return E_FAIL;
+	}
+	if (!(cameraPoint.Z > 0.0f))
+	{
+		return S_OK;
+	}
+
+	const int nDepthWidth = m_Header.depthWidth;
+	const int nDepthHeight = m_Header.depthHeight;
+	const float tx = cameraPoint.X / cameraPoint.Z;
+	const float ty = cameraPoint.Y / cameraPoint.Z;
+
+	// initial guess from the central row and column, then refine with newton steps
+	const PointF &left = m_CameraTable[(nDepthHeight / 2) * nDepthWidth];
+	const PointF &right = m_CameraTable[(nDepthHeight / 2) * nDepthWidth + nDepthWidth - 1];
+	const PointF &top = m_CameraTable[nDepthWidth / 2];
+	const PointF &bottom = m_CameraTable[(nDepthHeight - 1) * nDepthWidth + nDepthWidth / 2];
+	const float stepX = (right.X - left.X) / (nDepthWidth - 1);
+	const float stepY = (bottom.Y - top.Y) / (nDepthHeight - 1);
+	if (stepX == 0.0f || stepY == 0.0f)
+	{
+		return E_FAIL;
+	}
+
+	float u = (tx - left.X) / stepX;
+	float v = (ty - top.Y) / stepY;
+	for (int iteration = 0; iteration < 5; ++iteration)
+	{
+		PointF p, pu, pv;
+		sampleTable(u, v, p);
+		sampleTable(u + 1.0f, v, pu);
+		sampleTable(u, v + 1.0f, pv);
+
+		const float j00 = pu.X - p.X, j01 = pv.X - p.X;
+		const float j10 = pu.Y - p.Y, j11 = pv.Y - p.Y;
+		const float det = j00 * j11 - j01 * j10;
+		if (det == 0.0f)
+			break;
+
+		const float ex = tx - p.X;
+		const float ey = ty - p.Y;
+		const float du = (j11 * ex - j01 * ey) / det;
+		const float dv = (-j10 * ex + j00 * ey) / det;
+		u += du;
+		v += dv;
+		if (std::fabs(du) + std::fabs(dv) < 1e-3f)
+			break;
+	}
+
+	p_DepthPoint->X = u;
+	p_DepthPoint->Y = v;
+	return S_OK;
+}
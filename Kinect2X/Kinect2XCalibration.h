@@ -0,0 +1,102 @@
+//    File: Kinect2XCalibration.h
+
+#ifndef KCV_CALIBRATION_H
+#define KCV_CALIBRATION_H
+
+// Kinect2XCalibration.h
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Kinect SDK
+#include <Kinect.h>
+
+namespace kcv
+{
+	// Cache file version, increase when the layout changes
+	const UINT32 KCV_CALIBRATION_VERSION = 1;
+
+	// Depth to color mapping of one depth pixel, color = a + b / depth[mm]
+	struct KCV_colorLut
+	{
+		float ax;
+		float bx;
+		float ay;
+		float by;
+	};
+
+	// Header of the cache file, followed by the depth to camera table and the color lut
+	struct KCV_calibrationHeader
+	{
+		char magic[8];
+		UINT32 version;
+		UINT32 headerSize;
+		INT32 depthWidth;
+		INT32 depthHeight;
+		INT32 colorWidth;
+		INT32 colorHeight;
+		WCHAR serial[64];
+		CameraIntrinsics depthIntrinsics;
+		UINT64 cameraTableOffset;
+		UINT64 colorLutOffset;
+	};
+
+	class KCV_calibration
+	{
+	public:
+		KCV_calibration();
+		~KCV_calibration();
+
+		HRESULT build(ICoordinateMapper *mapper, const std::wstring &serial, int nDepthWidth, int nDepthHeight,
+			int nColorWidth, int nColorHeight);
+		HRESULT assign(const std::wstring &serial, int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight,
+			const CameraIntrinsics &intrinsics, const std::vector<PointF> &cameraTable, const std::vector<KCV_colorLut> &colorLut);
+		HRESULT save(const std::wstring &path) const;
+		HRESULT load(const std::wstring &path, const std::wstring &serial, int nDepthWidth, int nDepthHeight,
+			int nColorWidth, int nColorHeight);
+		void release();
+
+		bool isLoaded() const { return m_CameraTable != NULL; }
+		const std::wstring &serial() const { return m_Serial; }
+		int depthWidth() const { return m_Header.depthWidth; }
+		int depthHeight() const { return m_Header.depthHeight; }
+		int colorWidth() const { return m_Header.colorWidth; }
+		int colorHeight() const { return m_Header.colorHeight; }
+		const PointF *cameraTable() const { return m_CameraTable; }
+		const CameraIntrinsics &depthIntrinsics() const { return m_Header.depthIntrinsics; }
+
+		static std::wstring cacheFileName(const std::wstring &directory, const std::wstring &serial);
+
+		HRESULT mapDepthFrameToColorSpace(const UINT16 *p_DepthBuffer, ColorSpacePoint *p_ColorPoints) const;
+		HRESULT mapColorFrameToDepthSpace(const UINT16 *p_DepthBuffer, DepthSpacePoint *p_DepthPoints) const;
+		HRESULT mapDepthFrameToCameraSpace(const UINT16 *p_DepthBuffer, CameraSpacePoint *p_CameraPoints) const;
+		HRESULT mapCameraPointToDepthSpace(const CameraSpacePoint &cameraPoint, DepthSpacePoint *p_DepthPoint) const;
+
+	private:
+		KCV_calibration(const KCV_calibration&);
+		KCV_calibration& operator=(const KCV_calibration&);
+
+		void sampleTable(float x, float y, PointF &value) const;
+
+		KCV_calibrationHeader m_Header;
+		std::wstring m_Serial;
+
+		// Tables point either to owned vectors or to the mapped file view
+		const PointF *m_CameraTable;
+		const KCV_colorLut *m_ColorLut;
+		std::vector<PointF> m_OwnedCameraTable;
+		std::vector<KCV_colorLut> m_OwnedColorLut;
+
+		// Nearest depth per color pixel of mapColorFrameToDepthSpace, reused between frames
+		mutable std::vector<UINT16> m_ZBuffer;
+		mutable std::mutex m_ZBufferMutex;
+
+		// Mapped cache file
+		HANDLE m_File;
+		HANDLE m_Mapping;
+		const void *m_View;
+	};
+}
+
+#endif // KCV_CALIBRATION_H
@@ -0,0 +1,767 @@
+//    File: Kinect2XFusion.cpp
+
+#include "Kinect2XFusion.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+#include <emmintrin.h>
+
+using namespace kcv;
+
+/*!
+\class KCV_fusion
+\brief The KCV_fusion class integrates depth frames into a truncated signed distance volume.
+
+Only blocks of 8x8x8 voxels around observed surfaces are allocated, they are found through a hash of their
+coordinates. Every frame allocates the blocks in the truncation band of its points, then the visible blocks are
+integrated in parallel, four voxels at once. The volume is rendered by raycasting and exported by surface nets.
+*/
+
+namespace
+{
+	// Bits per block coordinate in the hash key
+	const int KCV_KEY_BITS = 21;
+	const UINT64 KCV_KEY_MASK = (1ULL << KCV_KEY_BITS) - 1;
+
+	// Least number of valid rays to fit the intrinsics
+	const int KCV_MIN_RAYS = 100;
+
+	// Pixels along one side of a raycast depth range tile
+	const int KCV_RANGE_TILE = 8;
+
+	inline UINT64 gridKey(int x, int y, int z)
+	{
+		return ((UINT64)(x & KCV_KEY_MASK) << (2 * KCV_KEY_BITS)) | ((UINT64)(y & KCV_KEY_MASK) << KCV_KEY_BITS) | (UINT64)(z & KCV_KEY_MASK);
+	}
+
+	inline int floorDiv(int value, int divisor)
+	{
+		return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+	}
+
+	inline cv::Point3f transform(const cv::Matx44f &m, const cv::Point3f &p)
+	{
+		return cv::Point3f(m(0, 0) * p.x + m(0, 1) * p.y + m(0, 2) * p.z + m(0, 3),
+			m(1, 0) * p.x + m(1, 1) * p.y + m(1, 2) * p.z + m(1, 3),
+			m(2, 0) * p.x + m(2, 1) * p.y + m(2, 2) * p.z + m(2, 3));
+	}
+
+	inline cv::Point3f rotate(const cv::Matx44f &m, const cv::Point3f &p)
+	{
+		return cv::Point3f(m(0, 0) * p.x + m(0, 1) * p.y + m(0, 2) * p.z,
+			m(1, 0) * p.x + m(1, 1) * p.y + m(1, 2) * p.z,
+			m(2, 0) * p.x + m(2, 1) * p.y + m(2, 2) * p.z);
+	}
+
+	// Inverse of rigid \a pose
+	cv::Matx44f invertPose(const cv::Matx44f &pose)
+	{
+		cv::Matx44f inverse = cv::Matx44f::eye();
+		for (int r = 0; r < 3; ++r)
+		{
+			for (int c = 0; c < 3; ++c)
+				inverse(r, c) = pose(c, r);
+			inverse(r, 3) = -(pose(0, r) * pose(0, 3) + pose(1, r) * pose(1, 3) + pose(2, r) * pose(2, 3));
+		}
+		return inverse;
+	}
+}
+
+/*!
+Constructs default configuration, 1 cm voxels with 4 cm truncation.
+*/
+KCV_fusionConfig::KCV_fusionConfig()
+	: voxelSize(0.01f), truncation(0.04f), maxWeight(64.0f), minDepth(0.5f), maxDepth(4.5f), maxBlocks(32768)
+{
+}
+
+/*!
+Integrates \a camera_coordinates into a sparse voxel volume of the given grid.
+*/
+class KCV_fusion::IntegrateBody : public cv::ParallelLoopBody
+{
+public:
+	IntegrateBody(KCV_fusion &fusion, const cv::Matx44f &worldToCamera)
+		: m_Fusion(fusion), m_WorldToCamera(worldToCamera)
+	{
+	}
+
+	void operator()(const cv::Range &range) const
+	{
+		const KCV_fusionConfig &config = m_Fusion.m_Config;
+		const float voxelSize = config.voxelSize;
+		const int width = m_Fusion.m_Width;
+		const int height = m_Fusion.m_Height;
+		const float fx = m_Fusion.m_Fx, fy = m_Fusion.m_Fy, cx = m_Fusion.m_Cx, cy = m_Fusion.m_Cy;
+		const cv::Mat &depth = m_Fusion.m_Depth;
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+		const __m128 minDepth = _mm_set1_ps(config.minDepth);
+		const __m128 negTruncation = _mm_set1_ps(-config.truncation);
+		const __m128 invTruncation = _mm_set1_ps(1.0f / config.truncation);
+		const __m128 maxWeight = _mm_set1_ps(config.maxWeight);
+
+		// camera space step of one voxel along x
+		const __m128 stepX = _mm_set1_ps(m_WorldToCamera(0, 0) * voxelSize);
+		const __m128 stepY = _mm_set1_ps(m_WorldToCamera(1, 0) * voxelSize);
+		const __m128 stepZ = _mm_set1_ps(m_WorldToCamera(2, 0) * voxelSize);
+
+		for (int i = range.start; i < range.end; ++i)
+		{
+			const int index = m_Fusion.m_Visible[i];
+			const cv::Vec3i &coord = m_Fusion.m_BlockCoords[index];
+			KCV_voxelBlock &block = m_Fusion.m_Blocks[index];
+
+			for (int z = 0; z < KCV_BLOCK_SIZE; ++z)
+			{
+				for (int y = 0; y < KCV_BLOCK_SIZE; ++y)
+				{
+					cv::Point3f origin = transform(m_WorldToCamera, cv::Point3f(coord[0] * KCV_BLOCK_SIZE * voxelSize,
+						(coord[1] * KCV_BLOCK_SIZE + y) * voxelSize, (coord[2] * KCV_BLOCK_SIZE + z) * voxelSize));
+
+					for (int x = 0; x < KCV_BLOCK_SIZE; x += 4)
+					{
+						__m128 offset = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+						__m128 px = _mm_add_ps(_mm_set1_ps(origin.x), _mm_mul_ps(offset, stepX));
+						__m128 py = _mm_add_ps(_mm_set1_ps(origin.y), _mm_mul_ps(offset, stepY));
+						__m128 pz = _mm_add_ps(_mm_set1_ps(origin.z), _mm_mul_ps(offset, stepZ));
+
+						// project to the depth image, voxels behind the near plane read no depth
+						__m128 inFront = _mm_cmpgt_ps(pz, minDepth);
+						__m128 invZ = _mm_div_ps(one, _mm_or_ps(_mm_and_ps(inFront, pz), _mm_andnot_ps(inFront, one)));
+						__m128i u = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fx), _mm_mul_ps(px, invZ)), _mm_set1_ps(cx)));
+						__m128i v = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fy), _mm_mul_ps(py, invZ)), _mm_set1_ps(cy)));
+
+						CV_DECL_ALIGNED(16) int us[4];
+						CV_DECL_ALIGNED(16) int vs[4];
+						CV_DECL_ALIGNED(16) float front[4];
+						CV_DECL_ALIGNED(16) float measured[4];
+						_mm_store_si128(reinterpret_cast<__m128i*>(us), u);
+						_mm_store_si128(reinterpret_cast<__m128i*>(vs), v);
+						_mm_store_ps(front, inFront);
+						for (int lane = 0; lane < 4; ++lane)
+						{
+							bool inside = front[lane] != 0.0f && us[lane] >= 0 && us[lane] < width && vs[lane] >= 0 && vs[lane] < height;
+							measured[lane] = inside ? depth.ptr<float>(vs[lane])[us[lane]] : 0.0f;
+						}
+
+						__m128 d = _mm_load_ps(measured);
+						__m128 sdf = _mm_sub_ps(d, pz);
+						__m128 update = _mm_and_ps(_mm_cmpgt_ps(d, zero), _mm_cmpge_ps(sdf, negTruncation));
+						__m128 tsdf = _mm_min_ps(one, _mm_mul_ps(sdf, invTruncation));
+
+						const int voxel = (z * KCV_BLOCK_SIZE + y) * KCV_BLOCK_SIZE + x;
+						__m128 oldTsdf = _mm_loadu_ps(block.tsdf + voxel);
+						__m128 oldWeight = _mm_loadu_ps(block.weight + voxel);
+						__m128 newWeight = _mm_add_ps(oldWeight, one);
+						__m128 newTsdf = _mm_div_ps(_mm_add_ps(_mm_mul_ps(oldTsdf, oldWeight), tsdf), newWeight);
+						newWeight = _mm_min_ps(newWeight, maxWeight);
+
+						_mm_storeu_ps(block.tsdf + voxel, _mm_or_ps(_mm_and_ps(update, newTsdf), _mm_andnot_ps(update, oldTsdf)));
+						_mm_storeu_ps(block.weight + voxel, _mm_or_ps(_mm_and_ps(update, newWeight), _mm_andnot_ps(update, oldWeight)));
+					}
+				}
+			}
+		}
+	}
+
+private:
+	KCV_fusion &m_Fusion;
+	cv::Matx44f m_WorldToCamera;
+};
+
+/*!
+Casts one ray per depth pixel into the volume.
+*/
+class KCV_fusion::RaycastBody : public cv::ParallelLoopBody
+{
+public:
+	RaycastBody(const KCV_fusion &fusion, const cv::Matx44f &pose, const cv::Mat &ranges, cv::Mat &points, cv::Mat &normals)
+		: m_Fusion(fusion), m_Pose(pose), m_Ranges(ranges), m_Points(points), m_Normals(normals)
+	{
+	}
+
+	void operator()(const cv::Range &range) const
+	{
+		const KCV_fusionConfig &config = m_Fusion.m_Config;
+		const float voxelSize = config.voxelSize;
+		const float blockSize = voxelSize * KCV_BLOCK_SIZE;
+		const float invalid = -std::numeric_limits<float>::infinity();
+		const cv::Point3f origin(m_Pose(0, 3), m_Pose(1, 3), m_Pose(2, 3));
+		const cv::Matx44f worldToCamera = invertPose(m_Pose);
+
+		KCV_fusion::BlockCache cache;
+		for (int v = range.start; v < range.end; ++v)
+		{
+			cv::Vec3f *p_Point = m_Points.ptr<cv::Vec3f>(v);
+			cv::Vec3f *p_Normal = m_Normals.ptr<cv::Vec3f>(v);
+			const cv::Vec2f *p_Range = m_Ranges.ptr<cv::Vec2f>(v / KCV_RANGE_TILE);
+			for (int u = 0; u < m_Fusion.m_Width; ++u)
+			{
+				p_Point[u] = cv::Vec3f(invalid, invalid, invalid);
+				p_Normal[u] = cv::Vec3f(0.0f, 0.0f, 0.0f);
+
+				// ray parametrised by camera depth
+				const cv::Point3f ray((u - m_Fusion.m_Cx) / m_Fusion.m_Fx, (v - m_Fusion.m_Cy) / m_Fusion.m_Fy, 1.0f);
+				const cv::Point3f direction = rotate(m_Pose, ray);
+				const float length = std::sqrt(direction.dot(direction));
+
+				// march only the depths where allocated blocks project
+				float z = p_Range[u / KCV_RANGE_TILE][0];
+				const float end = p_Range[u / KCV_RANGE_TILE][1];
+
+				float previousZ = 0.0f;
+				float previousTsdf = 0.0f;
+				bool hasPrevious = false;
+				bool coarse = false;
+				bool fine = false;
+				while (z < end)
+				{
+					cv::Point3f p = origin + direction * z;
+					float tsdf, weight;
+					bool allocated = m_Fusion.voxel(cvRound(p.x / voxelSize), cvRound(p.y / voxelSize), cvRound(p.z / voxelSize), tsdf, weight, cache) >= 0;
+					if (!allocated || weight == 0.0f)
+					{
+						// skip empty space by blocks, unobserved voxels by voxels
+						coarse = !allocated && !fine;
+						z += (coarse ? blockSize : voxelSize) / length;
+						hasPrevious = false;
+						continue;
+					}
+					if (coarse && tsdf < 0.0f)
+					{
+						// the block step jumped over the front of the band, march it again by voxels
+						coarse = false;
+						fine = true;
+						z -= (blockSize - voxelSize) / length;
+						continue;
+					}
+					coarse = false;
+					fine = false;
+
+					if (hasPrevious && previousTsdf >= 0.0f && tsdf < 0.0f)
+					{
+						// refine the zero crossing with interpolated distances
+						float t0 = previousTsdf, t1 = tsdf;
+						m_Fusion.sample(origin + direction * previousZ, t0, cache);
+						m_Fusion.sample(p, t1, cache);
+						float hitZ = t0 != t1 ? previousZ + (z - previousZ) * t0 / (t0 - t1) : z;
+
+						cv::Point3f hit = ray * hitZ;
+						p_Point[u] = cv::Vec3f(hit.x, hit.y, hit.z);
+
+						cv::Point3f g;
+						if (m_Fusion.gradient(origin + direction * hitZ, g, cache))
+						{
+							cv::Point3f n = rotate(worldToCamera, g);
+							float norm = std::sqrt(n.dot(n));
+							if (norm > 0.0f)
+								p_Normal[u] = cv::Vec3f(n.x / norm, n.y / norm, n.z / norm);
+						}
+						break;
+					}
+
+					previousTsdf = tsdf;
+					previousZ = z;
+					hasPrevious = true;
+					z += std::max(tsdf * config.truncation * 0.8f, voxelSize) / length;
+				}
+			}
+		}
+	}
+
+private:
+	const KCV_fusion &m_Fusion;
+	cv::Matx44f m_Pose;
+	const cv::Mat &m_Ranges;
+	cv::Mat &m_Points;
+	cv::Mat &m_Normals;
+};
+
+/*!
+Constructs empty volume with \a config .
+*/
+KCV_fusion::KCV_fusion(const KCV_fusionConfig &config)
+	: m_Config(config), m_Width(0), m_Height(0), m_Fx(0.0f), m_Fy(0.0f), m_Cx(0.0f), m_Cy(0.0f), m_Frame(0), m_Dropped(0)
+{
+}
+
+/*!
+Drop all blocks, the intrinsics are kept.
+*/
+void KCV_fusion::reset()
+{
+	m_Blocks.clear();
+	m_BlockCoords.clear();
+	m_BlockFrame.clear();
+	m_Hash.clear();
+	m_Visible.clear();
+	m_Frame = 0;
+	m_Dropped = 0;
+}
+
+/*!
+Set projection of \a width x \a height depth frames, pixel u = \a fx * X / Z + \a cx and v = \a fy * Y / Z + \a cy .
+*/
+void KCV_fusion::setIntrinsics(int width, int height, float fx, float fy, float cx, float cy)
+{
+	m_Width = width;
+	m_Height = height;
+	m_Fx = fx;
+	m_Fy = fy;
+	m_Cx = cx;
+	m_Cy = cy;
+}
+
+/*!
+Fit the projection to the rays of \a camera_coordinates (CV_32FC3) by least squares.
+*/
+HRESULT KCV_fusion::fitIntrinsics(cv::InputArray camera_coordinates)
+{
+	cv::Mat points = camera_coordinates.getMat();
+	if (points.type() != CV_32FC3)
+	{
+		return E_INVALIDARG;
+	}
+
+	double n = 0.0, sx = 0.0, sxx = 0.0, su = 0.0, sxu = 0.0, sy = 0.0, syy = 0.0, sv = 0.0, syv = 0.0;
+	for (int v = 0; v < points.rows; v += 4)
+	{
+		const cv::Vec3f *p_Row = points.ptr<cv::Vec3f>(v);
+		for (int u = 0; u < points.cols; u += 4)
+		{
+			const cv::Vec3f &p = p_Row[u];
+			if (!(p[2] > 0.0f) || p[2] == std::numeric_limits<float>::infinity())
+				continue;
+			double x = p[0] / p[2], y = p[1] / p[2];
+			n += 1.0;
+			sx += x; sxx += x * x; su += u; sxu += x * u;
+			sy += y; syy += y * y; sv += v; syv += y * v;
+		}
+	}
+	double detX = n * sxx - sx * sx;
+	double detY = n * syy - sy * sy;
+	if (n < KCV_MIN_RAYS || detX <= 0.0 || detY <= 0.0)
+	{
+		return E_FAIL;
+	}
+
+	float fx = (float)((n * sxu - sx * su) / detX);
+	float fy = (float)((n * syv - sy * sv) / detY);
+	setIntrinsics(points.cols, points.rows, fx, fy, (float)((su - fx * sx) / n), (float)((sv - fy * sy) / n));
+	return S_OK;
+}
+
+/*!
+Integrate \a camera_coordinates (CV_32FC3, m) observed from \a pose , the camera to world transform.
+*/
+HRESULT KCV_fusion::integrate(cv::InputArray camera_coordinates, const cv::Matx44f &pose)
+{
+	cv::Mat points = camera_coordinates.getMat();
+	if (points.type() != CV_32FC3)
+	{
+		return E_INVALIDARG;
+	}
+	if (!hasIntrinsics())
+	{
+		HRESULT hr = fitIntrinsics(points);
+		if (FAILED(hr))
+			return hr;
+	}
+	if (points.cols != m_Width || points.rows != m_Height)
+	{
+		return E_INVALIDARG;
+	}
+
+	// depth of the valid points
+	m_Depth.create(points.rows, points.cols, CV_32F);
+	for (int v = 0; v < points.rows; ++v)
+	{
+		const cv::Vec3f *p_Point = points.ptr<cv::Vec3f>(v);
+		float *p_Depth = m_Depth.ptr<float>(v);
+		for (int u = 0; u < points.cols; ++u)
+		{
+			float z = p_Point[u][2];
+			p_Depth[u] = z >= m_Config.minDepth && z <= m_Config.maxDepth ? z : 0.0f;
+		}
+	}
+
+	allocateBlocks(points, pose);
+
+	IntegrateBody body(*this, invertPose(pose));
+	cv::parallel_for_(cv::Range(0, (int)m_Visible.size()), body, m_Visible.size() / 64.0);
+	return S_OK;
+}
+
+/*!
+Render the surface seen from \a pose to camera space \a points (CV_32FC3, -infinity without surface)
+and unit \a normals (CV_32FC3, zero without surface) of the depth frame size.
+*/
+HRESULT KCV_fusion::raycast(const cv::Matx44f &pose, cv::OutputArray points, cv::OutputArray normals) const
+{
+	if (!hasIntrinsics())
+	{
+		return E_FAIL;
+	}
+	points.create(m_Height, m_Width, CV_32FC3);
+	normals.create(m_Height, m_Width, CV_32FC3);
+	cv::Mat pointMap = points.getMat();
+	cv::Mat normalMap = normals.getMat();
+
+	// depth range of the projected blocks per tile, empty ones are not marched at all
+	const int tilesX = (m_Width + KCV_RANGE_TILE - 1) / KCV_RANGE_TILE, tilesY = (m_Height + KCV_RANGE_TILE - 1) / KCV_RANGE_TILE;
+	cv::Mat ranges(tilesY, tilesX, CV_32FC2, cv::Scalar(m_Config.maxDepth, m_Config.minDepth));
+	const cv::Matx44f worldToCamera = invertPose(pose);
+	const float voxelSize = m_Config.voxelSize, blockSize = voxelSize * KCV_BLOCK_SIZE;
+	for (size_t b = 0; b < m_BlockCoords.size(); ++b)
+	{
+		// voxels are centered on the grid, the block spans half a voxel to each side
+		const cv::Point3f corner(m_BlockCoords[b][0] * blockSize - voxelSize, m_BlockCoords[b][1] * blockSize - voxelSize, m_BlockCoords[b][2] * blockSize - voxelSize);
+		float zMin = FLT_MAX, zMax = -FLT_MAX, uMin = FLT_MAX, uMax = -FLT_MAX, vMin = FLT_MAX, vMax = -FLT_MAX;
+		for (int c = 0; c < 8; ++c)
+		{
+			const float extent = blockSize + voxelSize;
+			cv::Point3f p = transform(worldToCamera, corner + cv::Point3f((c & 1) * extent, ((c >> 1) & 1) * extent, (c >> 2) * extent));
+			zMin = std::min(zMin, p.z);
+			zMax = std::max(zMax, p.z);
+			if (p.z > 0.0f)
+			{
+				float pu = m_Fx * p.x / p.z + m_Cx, pv = m_Fy * p.y / p.z + m_Cy;
+				uMin = std::min(uMin, pu);
+				uMax = std::max(uMax, pu);
+				vMin = std::min(vMin, pv);
+				vMax = std::max(vMax, pv);
+			}
+		}
+		if (zMax < m_Config.minDepth || zMin > m_Config.maxDepth)
+			continue;
+		if (zMin <= 0.0f)
+		{
+			// block around the camera plane, may project anywhere
+			uMin = vMin = 0.0f;
+			uMax = (float)m_Width;
+			vMax = (float)m_Height;
+		}
+
+		const int x0 = std::max(0, (int)uMin / KCV_RANGE_TILE), x1 = std::min(tilesX - 1, (int)std::min(uMax, (float)m_Width) / KCV_RANGE_TILE);
+		const int y0 = std::max(0, (int)vMin / KCV_RANGE_TILE), y1 = std::min(tilesY - 1, (int)std::min(vMax, (float)m_Height) / KCV_RANGE_TILE);
+		zMin = std::max(zMin, m_Config.minDepth);
+		zMax = std::min(zMax, m_Config.maxDepth);
+		for (int y = y0; y <= y1; ++y)
+		{
+			cv::Vec2f *p_Range = ranges.ptr<cv::Vec2f>(y);
+			for (int x = x0; x <= x1; ++x)
+			{
+				p_Range[x][0] = std::min(p_Range[x][0], zMin);
+				p_Range[x][1] = std::max(p_Range[x][1], zMax);
+			}
+		}
+	}
+
+	RaycastBody body(*this, pose, ranges, pointMap, normalMap);
+	cv::parallel_for_(cv::Range(0, m_Height), body, m_Height / 8.0);
+	return S_OK;
+}
+
+/*!
+Extract the zero level of the volume as a triangle mesh by surface nets, \a vertices are in world space.
+*/
+HRESULT KCV_fusion::extractMesh(std::vector<cv::Point3f> &vertices, std::vector<cv::Vec3i> &triangles) const
+{
+	vertices.clear();
+	triangles.clear();
+
+	const float voxelSize = m_Config.voxelSize;
+	// corner offsets of a cell and the corner pairs of its 12 edges
+	static const int corners[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 0, 0, 1 }, { 1, 0, 1 }, { 0, 1, 1 }, { 1, 1, 1 } };
+	static const int edges[12][2] = { { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+
+	// one vertex per cell crossing the surface, at the mean of its edge crossings
+	std::unordered_map<UINT64, int> cells;
+	BlockCache cache;
+	for (size_t b = 0; b < m_Blocks.size(); ++b)
+	{
+		const cv::Vec3i &coord = m_BlockCoords[b];
+		for (int i = 0; i < KCV_BLOCK_VOXELS; ++i)
+		{
+			int x = coord[0] * KCV_BLOCK_SIZE + i % KCV_BLOCK_SIZE;
+			int y = coord[1] * KCV_BLOCK_SIZE + (i / KCV_BLOCK_SIZE) % KCV_BLOCK_SIZE;
+			int z = coord[2] * KCV_BLOCK_SIZE + i / (KCV_BLOCK_SIZE * KCV_BLOCK_SIZE);
+
+			float values[8];
+			bool observed = true;
+			int inside = 0;
+			for (int c = 0; c < 8 && observed; ++c)
+			{
+				float weight;
+				observed = voxel(x + corners[c][0], y + corners[c][1], z + corners[c][2], values[c], weight, cache) >= 0 && weight > 0.0f;
+				inside += values[c] < 0.0f ? 1 : 0;
+			}
+			if (!observed || inside == 0 || inside == 8)
+				continue;
+
+			cv::Point3f sum(0.0f, 0.0f, 0.0f);
+			int crossings = 0;
+			for (int e = 0; e < 12; ++e)
+			{
+				float a = values[edges[e][0]], b = values[edges[e][1]];
+				if ((a < 0.0f) == (b < 0.0f))
+					continue;
+				float t = a / (a - b);
+				const int *ca = corners[edges[e][0]], *cb = corners[edges[e][1]];
+				sum += cv::Point3f(ca[0] + t * (cb[0] - ca[0]), ca[1] + t * (cb[1] - ca[1]), ca[2] + t * (cb[2] - ca[2]));
+				++crossings;
+			}
+			sum *= 1.0f / crossings;
+			cells[gridKey(x, y, z)] = (int)vertices.size();
+			vertices.push_back(cv::Point3f((x + sum.x) * voxelSize, (y + sum.y) * voxelSize, (z + sum.z) * voxelSize));
+		}
+	}
+
+	// one quad per voxel edge crossing the surface, joining the four cells around it
+	for (size_t b = 0; b < m_Blocks.size(); ++b)
+	{
+		const cv::Vec3i &coord = m_BlockCoords[b];
+		for (int i = 0; i < KCV_BLOCK_VOXELS; ++i)
+		{
+			int p[3] = { coord[0] * KCV_BLOCK_SIZE + i % KCV_BLOCK_SIZE,
+				coord[1] * KCV_BLOCK_SIZE + (i / KCV_BLOCK_SIZE) % KCV_BLOCK_SIZE,
+				coord[2] * KCV_BLOCK_SIZE + i / (KCV_BLOCK_SIZE * KCV_BLOCK_SIZE) };
+			float t0, w0;
+			if (voxel(p[0], p[1], p[2], t0, w0, cache) < 0 || w0 == 0.0f)
+				continue;
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				int q[3] = { p[0], p[1], p[2] };
+				q[axis] += 1;
+				float t1, w1;
+				if (voxel(q[0], q[1], q[2], t1, w1, cache) < 0 || w1 == 0.0f || (t0 < 0.0f) == (t1 < 0.0f))
+					continue;
+
+				// cells around the edge, counter clockwise seen from +axis
+				const int a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+				static const int around[4][2] = { { -1, -1 }, { 0, -1 }, { 0, 0 }, { -1, 0 } };
+				int quad[4];
+				bool complete = true;
+				for (int k = 0; k < 4 && complete; ++k)
+				{
+					int c[3] = { p[0], p[1], p[2] };
+					c[a1] += around[k][0];
+					c[a2] += around[k][1];
+					std::unordered_map<UINT64, int>::const_iterator it = cells.find(gridKey(c[0], c[1], c[2]));
+					complete = it != cells.end();
+					if (complete)
+						quad[k] = it->second;
+				}
+				if (!complete)
+					continue;
+
+				// face the positive, observed free space side
+				if (t0 > 0.0f)
+				{
+					triangles.push_back(cv::Vec3i(quad[0], quad[2], quad[1]));
+					triangles.push_back(cv::Vec3i(quad[0], quad[3], quad[2]));
+				}
+				else
+				{
+					triangles.push_back(cv::Vec3i(quad[0], quad[1], quad[2]));
+					triangles.push_back(cv::Vec3i(quad[0], quad[2], quad[3]));
+				}
+			}
+		}
+	}
+	return S_OK;
+}
+
+/*!
+Returns index of block \a bx , \a by , \a bz or -1 when not allocated.
+*/
+int KCV_fusion::findBlock(int bx, int by, int bz, BlockCache &cache) const
+{
+	UINT64 key = gridKey(bx, by, bz);
+	if (key != cache.key)
+	{
+		std::unordered_map<UINT64, int>::const_iterator it = m_Hash.find(key);
+		cache.key = key;
+		cache.index = it != m_Hash.end() ? it->second : -1;
+	}
+	return cache.index;
+}
+
+/*!
+Returns index of block \a bx , \a by , \a bz , allocated when missing, or -1 when the volume is full.
+*/
+int KCV_fusion::allocateBlock(int bx, int by, int bz)
+{
+	UINT64 key = gridKey(bx, by, bz);
+	std::unordered_map<UINT64, int>::const_iterator it = m_Hash.find(key);
+	if (it != m_Hash.end())
+	{
+		return it->second;
+	}
+	if (m_Blocks.size() >= m_Config.maxBlocks)
+	{
+		++m_Dropped;
+		return -1;
+	}
+
+	int index = (int)m_Blocks.size();
+	m_Blocks.resize(index + 1);
+	KCV_voxelBlock &block = m_Blocks.back();
+	std::fill(block.tsdf, block.tsdf + KCV_BLOCK_VOXELS, 1.0f);
+	std::fill(block.weight, block.weight + KCV_BLOCK_VOXELS, 0.0f);
+	m_BlockCoords.push_back(cv::Vec3i(bx, by, bz));
+	m_BlockFrame.push_back(0);
+	m_Hash[key] = index;
+	return index;
+}
+
+/*!
+Allocate blocks in the truncation band along the rays of \a points seen from \a pose and collect the visible ones.
+*/
+void KCV_fusion::allocateBlocks(const cv::Mat &points, const cv::Matx44f &pose)
+{
+	const float blockSize = m_Config.voxelSize * KCV_BLOCK_SIZE;
+	const float truncation = m_Config.truncation;
+	const cv::Point3f origin(pose(0, 3), pose(1, 3), pose(2, 3));
+	// samples along the band, at most half a block apart
+	const int steps = std::max(2, (int)std::ceil(2.0f * truncation / (0.5f * blockSize)));
+
+	if (m_Blocks.capacity() == 0)
+	{
+		m_Blocks.reserve(std::min<size_t>(m_Config.maxBlocks, 4096));
+	}
+	m_Visible.clear();
+	++m_Frame;
+
+	// every second pixel, a block spans many pixels in range
+	UINT64 lastKey = ~0ULL;
+	for (int v = 0; v < points.rows; v += 2)
+	{
+		const cv::Vec3f *p_Row = points.ptr<cv::Vec3f>(v);
+		const float *p_Depth = m_Depth.ptr<float>(v);
+		for (int u = 0; u < points.cols; u += 2)
+		{
+			if (p_Depth[u] == 0.0f)
+				continue;
+
+			cv::Point3f world = transform(pose, cv::Point3f(p_Row[u][0], p_Row[u][1], p_Row[u][2]));
+			cv::Point3f direction = world - origin;
+			direction *= 1.0f / std::sqrt(direction.dot(direction));
+
+			for (int s = 0; s <= steps; ++s)
+			{
+				cv::Point3f q = world + direction * (truncation * (2.0f * s / steps - 1.0f));
+				int bx = (int)std::floor(q.x / blockSize);
+				int by = (int)std::floor(q.y / blockSize);
+				int bz = (int)std::floor(q.z / blockSize);
+				UINT64 key = gridKey(bx, by, bz);
+				if (key == lastKey)
+					continue;
+				lastKey = key;
+
+				int index = allocateBlock(bx, by, bz);
+				if (index >= 0 && m_BlockFrame[index] != m_Frame)
+				{
+					m_BlockFrame[index] = m_Frame;
+					m_Visible.push_back(index);
+				}
+			}
+		}
+	}
+}
+
+/*!
+Read voxel \a x , \a y , \a z to \a tsdf and \a weight , returns its block or -1 when not allocated.
+*/
+int KCV_fusion::voxel(int x, int y, int z, float &tsdf, float &weight, BlockCache &cache) const
+{
+	int index = findBlock(floorDiv(x, KCV_BLOCK_SIZE), floorDiv(y, KCV_BLOCK_SIZE), floorDiv(z, KCV_BLOCK_SIZE), cache);
+	if (index < 0)
+	{
+		tsdf = 1.0f;
+		weight = 0.0f;
+		return -1;
+	}
+	const int local = ((z & (KCV_BLOCK_SIZE - 1)) * KCV_BLOCK_SIZE + (y & (KCV_BLOCK_SIZE - 1))) * KCV_BLOCK_SIZE + (x & (KCV_BLOCK_SIZE - 1));
+	tsdf = m_Blocks[index].tsdf[local];
+	weight = m_Blocks[index].weight[local];
+	return index;
+}
+
+/*!
+Store \a tsdf and \a weight of voxel \a x , \a y , \a z (world point divided by the voxel size), false when its block
+is not allocated.
+*/
+bool KCV_fusion::voxelAt(int x, int y, int z, float &tsdf, float &weight) const
+{
+	BlockCache cache;
+	return voxel(x, y, z, tsdf, weight, cache) >= 0;
+}
+
+/*!
+Trilinear \a tsdf at world point \a p , false when a neighbouring voxel was not observed.
+*/
+bool KCV_fusion::sample(const cv::Point3f &p, float &tsdf, BlockCache &cache) const
+{
+	const float gx = p.x / m_Config.voxelSize, gy = p.y / m_Config.voxelSize, gz = p.z / m_Config.voxelSize;
+	const int x = (int)std::floor(gx), y = (int)std::floor(gy), z = (int)std::floor(gz);
+	const float fx = gx - x, fy = gy - y, fz = gz - z;
+	const int mask = KCV_BLOCK_SIZE - 1;
+
+	float values[8];
+	if ((x & mask) != mask && (y & mask) != mask && (z & mask) != mask)
+	{
+		// all corners in one block, index it directly
+		int index = findBlock(floorDiv(x, KCV_BLOCK_SIZE), floorDiv(y, KCV_BLOCK_SIZE), floorDiv(z, KCV_BLOCK_SIZE), cache);
+		if (index < 0)
+			return false;
+		const KCV_voxelBlock &block = m_Blocks[index];
+		const int local = ((z & mask) * KCV_BLOCK_SIZE + (y & mask)) * KCV_BLOCK_SIZE + (x & mask);
+		for (int c = 0; c < 8; ++c)
+		{
+			const int offset = local + (c & 1) + ((c >> 1) & 1) * KCV_BLOCK_SIZE + (c >> 2) * KCV_BLOCK_SIZE * KCV_BLOCK_SIZE;
+			if (block.weight[offset] == 0.0f)
+				return false;
+			values[c] = block.tsdf[offset];
+		}
+	}
+	else
+	{
+		for (int c = 0; c < 8; ++c)
+		{
+			float w;
+			if (voxel(x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2), values[c], w, cache) < 0 || w == 0.0f)
+				return false;
+		}
+	}
+
+	const float x0 = values[0] + (values[1] - values[0]) * fx, x1 = values[2] + (values[3] - values[2]) * fx;
+	const float x2 = values[4] + (values[5] - values[4]) * fx, x3 = values[6] + (values[7] - values[6]) * fx;
+	const float y0 = x0 + (x1 - x0) * fy, y1 = x2 + (x3 - x2) * fy;
+	tsdf = y0 + (y1 - y0) * fz;
+	return true;
+}
+
+/*!
+Central difference gradient \a g of the distance at world point \a p .
+*/
+bool KCV_fusion::gradient(const cv::Point3f &p, cv::Point3f &g, BlockCache &cache) const
+{
+	const float h = m_Config.voxelSize;
+	float xp, xn, yp, yn, zp, zn;
+	if (!sample(p + cv::Point3f(h, 0.0f, 0.0f), xp, cache) || !sample(p - cv::Point3f(h, 0.0f, 0.0f), xn, cache) ||
+		!sample(p + cv::Point3f(0.0f, h, 0.0f), yp, cache) || !sample(p - cv::Point3f(0.0f, h, 0.0f), yn, cache) ||
+		!sample(p + cv::Point3f(0.0f, 0.0f, h), zp, cache) || !sample(p - cv::Point3f(0.0f, 0.0f, h), zn, cache))
+	{
+		return false;
+	}
+	g = cv::Point3f(xp - xn, yp - yn, zp - zn);
+	return true;
+}
@@ -0,0 +1,103 @@
+//    File: Kinect2XFusion.h
+
+#ifndef KCV_FUSION_H
+#define KCV_FUSION_H
+
+// Kinect2XFusion.h
+
+#include <unordered_map>
+#include <vector>
+
+// Kinect SDK
+#include <Kinect.h>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+namespace kcv
+{
+	// Voxels along one side of a block
+	const int KCV_BLOCK_SIZE = 8;
+	const int KCV_BLOCK_VOXELS = KCV_BLOCK_SIZE * KCV_BLOCK_SIZE * KCV_BLOCK_SIZE;
+
+	// Voxels of one block, x runs fastest
+	struct KCV_voxelBlock
+	{
+		float tsdf[KCV_BLOCK_VOXELS];	// signed distance divided by truncation, [-1, 1]
+		float weight[KCV_BLOCK_VOXELS];	// 0 when never observed
+	};
+
+	struct KCV_fusionConfig
+	{
+		KCV_fusionConfig();
+
+		float voxelSize;	// m
+		float truncation;	// m
+		float maxWeight;	// observations averaged, older ones fade out above
+		float minDepth;		// m
+		float maxDepth;		// m
+		size_t maxBlocks;	// memory limit, 4 kB per block
+	};
+
+	class KCV_fusion
+	{
+	public:
+		explicit KCV_fusion(const KCV_fusionConfig &config = KCV_fusionConfig());
+
+		void reset();
+		const KCV_fusionConfig &config() const { return m_Config; }
+
+		// Depth camera projection, fitted from the camera space rays on the first integration when not set
+		void setIntrinsics(int width, int height, float fx, float fy, float cx, float cy);
+		HRESULT fitIntrinsics(cv::InputArray camera_coordinates);
+		bool hasIntrinsics() const { return m_Width > 0; }
+
+		HRESULT integrate(cv::InputArray camera_coordinates, const cv::Matx44f &pose = cv::Matx44f::eye());
+		HRESULT raycast(const cv::Matx44f &pose, cv::OutputArray points, cv::OutputArray normals) const;
+		HRESULT extractMesh(std::vector<cv::Point3f> &vertices, std::vector<cv::Vec3i> &triangles) const;
+
+		bool voxelAt(int x, int y, int z, float &tsdf, float &weight) const;
+
+		size_t blockCount() const { return m_Blocks.size(); }
+		size_t visibleBlockCount() const { return m_Visible.size(); }
+		unsigned long long droppedBlocks() const { return m_Dropped; }
+
+	private:
+		KCV_fusion(const KCV_fusion&);
+		KCV_fusion& operator=(const KCV_fusion&);
+
+		class IntegrateBody;
+		class RaycastBody;
+
+		// Last block found, neighbouring lookups mostly hit the same block
+		struct BlockCache
+		{
+			BlockCache() : key(~0ULL), index(-1) {}
+			UINT64 key;
+			int index;
+		};
+
+		int findBlock(int bx, int by, int bz, BlockCache &cache) const;
+		int allocateBlock(int bx, int by, int bz);
+		void allocateBlocks(const cv::Mat &points, const cv::Matx44f &pose);
+		int voxel(int x, int y, int z, float &tsdf, float &weight, BlockCache &cache) const;
+		bool sample(const cv::Point3f &p, float &tsdf, BlockCache &cache) const;
+		bool gradient(const cv::Point3f &p, cv::Point3f &g, BlockCache &cache) const;
+
+		KCV_fusionConfig m_Config;
+		int m_Width;
+		int m_Height;
+		float m_Fx, m_Fy, m_Cx, m_Cy;
+
+		std::vector<KCV_voxelBlock> m_Blocks;
+		std::vector<cv::Vec3i> m_BlockCoords;
+		std::vector<unsigned int> m_BlockFrame;		// last frame the block was visible in
+		std::unordered_map<UINT64, int> m_Hash;
+		std::vector<int> m_Visible;					// blocks of the current frame
+		cv::Mat m_Depth;							// CV_32F depth in m, 0 when invalid
+		unsigned int m_Frame;
+		unsigned long long m_Dropped;
+	};
+}
+
+#endif // KCV_FUSION_H
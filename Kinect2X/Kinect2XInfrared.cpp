@@ -0,0 +1,133 @@
+//    File: Kinect2XInfrared.cpp
+
+#include "Kinect2XInfrared.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <emmintrin.h>
+
+using namespace kcv;
+
+/*!
+\class KCV_infrared
+\brief The KCV_infrared class converts 16 bit infrared frames to 8 bit images with clipping and gamma.
+
+Intensities are clipped to [low, high] and scaled, eight pixels at once. Without gamma the scaled values are
+the output, otherwise they index a table of KCV_GAMMA_LEVELS gamma corrected values. Rows are split across cores.
+*/
+
+namespace
+{
+	class KCV_infraredBody : public cv::ParallelLoopBody
+	{
+	public:
+		KCV_infraredBody(const cv::Mat &infrared, cv::Mat &normalized, UINT16 low, UINT16 high, const UCHAR *p_Table)
+			: m_Infrared(infrared), m_Normalized(normalized), m_Low(low), m_High(high), m_Table(p_Table)
+		{
+		}
+
+		void operator()(const cv::Range &range) const
+		{
+			const int width = m_Infrared.cols;
+			const float levels = m_Table != NULL ? (float)(KCV_GAMMA_LEVELS - 1) : 255.0f;
+			const float scale = levels / std::max(m_High - m_Low, 1);
+
+			// unsigned clipping through the signed range
+			const __m128i bias = _mm_set1_epi16((short)0x8000);
+			const __m128i low = _mm_set1_epi16((short)(m_Low ^ 0x8000));
+			const __m128i high = _mm_set1_epi16((short)(m_High ^ 0x8000));
+			const __m128i offset = _mm_set1_epi16((short)m_Low);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128 scale4 = _mm_set1_ps(scale);
+
+			for (int y = range.start; y < range.end; ++y)
+			{
+				const UINT16 *p_Infrared = m_Infrared.ptr<UINT16>(y);
+				UCHAR *p_Normalized = m_Normalized.ptr<UCHAR>(y);
+
+				int x = 0;
+				for (; x + 8 <= width; x += 8)
+				{
+					__m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Infrared + x)), bias);
+					v = _mm_sub_epi16(_mm_xor_si128(_mm_min_epi16(_mm_max_epi16(v, low), high), bias), offset);
+
+					__m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), scale4));
+					__m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), scale4));
+					__m128i levels16 = _mm_packs_epi32(lo, hi);
+					if (m_Table == NULL)
+					{
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(p_Normalized + x), _mm_packus_epi16(levels16, levels16));
+						continue;
+					}
+
+					CV_DECL_ALIGNED(16) short index[8];
+					_mm_store_si128(reinterpret_cast<__m128i*>(index), levels16);
+					for (int i = 0; i < 8; ++i)
+						p_Normalized[x + i] = m_Table[index[i]];
+				}
+				for (; x < width; ++x)
+				{
+					int level = cvRound((std::min(std::max(p_Infrared[x], m_Low), m_High) - m_Low) * scale);
+					p_Normalized[x] = m_Table != NULL ? m_Table[level] : (UCHAR)level;
+				}
+			}
+		}
+
+	private:
+		const cv::Mat &m_Infrared;
+		cv::Mat &m_Normalized;
+		UINT16 m_Low;
+		UINT16 m_High;
+		const UCHAR *m_Table;
+	};
+}
+
+/*!
+Constructs normalization of intensities \a low to \a high with \a gamma .
+*/
+KCV_infrared::KCV_infrared(UINT16 low, UINT16 high, float gamma)
+	: m_Low(0), m_High(USHRT_MAX), m_Gamma(1.0f)
+{
+	setClipping(low, high);
+	setGamma(gamma);
+}
+
+/*!
+Set intensities mapped to black \a low and white \a high , swapped when given in reverse.
+*/
+void KCV_infrared::setClipping(UINT16 low, UINT16 high)
+{
+	m_Low = std::min(low, high);
+	m_High = std::max(low, high);
+}
+
+/*!
+Set \a gamma , values above 1 brighten dark infrared, 1 is linear.
+*/
+void KCV_infrared::setGamma(float gamma)
+{
+	m_Gamma = gamma > 0.0f ? gamma : 1.0f;
+	for (int i = 0; i < KCV_GAMMA_LEVELS; ++i)
+	{
+		m_Table[i] = (UCHAR)cvRound(255.0 * std::pow(i / (double)(KCV_GAMMA_LEVELS - 1), 1.0 / m_Gamma));
+	}
+}
+
+/*!
+Normalize \a infrared_frame (CV_16U) to \a normalized_frame (CV_8U), its storage is reused when the size matches.
+*/
+HRESULT KCV_infrared::normalize(cv::InputArray infrared_frame, cv::OutputArray normalized_frame) const
+{
+	cv::Mat infrared = infrared_frame.getMat();
+	if (infrared.type() != CV_16U)
+	{
+		return E_INVALIDARG;
+	}
+	normalized_frame.create(infrared.rows, infrared.cols, CV_8U);
+	cv::Mat normalized = normalized_frame.getMat();
+
+	KCV_infraredBody body(infrared, normalized, m_Low, m_High, m_Gamma != 1.0f ? m_Table : NULL);
+	cv::parallel_for_(cv::Range(0, infrared.rows), body, infrared.rows / 16.0);
+	return S_OK;
+}
@@ -0,0 +1,42 @@
+//    File: Kinect2XInfrared.h
+
+#ifndef KCV_INFRARED_H
+#define KCV_INFRARED_H
+
+// Kinect2XInfrared.h
+
+#include <climits>
+
+// Kinect SDK
+#include <Kinect.h>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+namespace kcv
+{
+	// Entries of the gamma table, clipped intensities are quantized to this many levels
+	const int KCV_GAMMA_LEVELS = 1024;
+
+	class KCV_infrared
+	{
+	public:
+		explicit KCV_infrared(UINT16 low = 0, UINT16 high = USHRT_MAX, float gamma = 1.0f);
+
+		void setClipping(UINT16 low, UINT16 high);
+		UINT16 low() const { return m_Low; }
+		UINT16 high() const { return m_High; }
+		void setGamma(float gamma);
+		float gamma() const { return m_Gamma; }
+
+		HRESULT normalize(cv::InputArray infrared_frame, cv::OutputArray normalized_frame) const;
+
+	private:
+		UINT16 m_Low;		// intensity mapped to 0
+		UINT16 m_High;		// intensity mapped to 255
+		float m_Gamma;		// output = 255 * t^(1/gamma) of the clipped intensity t in [0, 1]
+		UCHAR m_Table[KCV_GAMMA_LEVELS];
+	};
+}
+
+#endif // KCV_INFRARED_H
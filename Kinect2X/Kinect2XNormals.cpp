@@ -0,0 +1,220 @@
+//    File: Kinect2XNormals.cpp
+
+#include "Kinect2XNormals.h"
+
+#include <cstring>
+
+#include <emmintrin.h>
+
+using namespace kcv;
+
+/*!
+\class KCV_normals
+\brief The KCV_normals class estimates surface normals and curvature on the organized camera space point cloud.
+
+The normal of a pixel is the cross product of the horizontal and vertical differences of its neighbours
+\a radius pixels away. Curvature is the offset of the pixel from the mean of these neighbours along the normal,
+scaled to 1/m, positive where the surface bulges towards the camera. Four pixels are processed at once,
+rows are split across cores.
+*/
+
+namespace
+{
+	// Load camera points p[0..3] as x, y and z of four pixels
+	inline void loadPoints(const float *p, __m128 &x, __m128 &y, __m128 &z)
+	{
+		__m128 a = _mm_loadu_ps(p);		// x0 y0 z0 x1
+		__m128 b = _mm_loadu_ps(p + 4);	// y1 z1 x2 y2
+		__m128 c = _mm_loadu_ps(p + 8);	// z2 x3 y3 z3
+		x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+		y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+		z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+	}
+
+	// Store x, y and z of four pixels as interleaved points p[0..3]
+	inline void storePoints(float *p, __m128 x, __m128 y, __m128 z)
+	{
+		_mm_storeu_ps(p, _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(p + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(p + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+	}
+
+	inline __m128 squaredDistance(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+	{
+		__m128 dx = _mm_sub_ps(ax, bx);
+		__m128 dy = _mm_sub_ps(ay, by);
+		__m128 dz = _mm_sub_ps(az, bz);
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+	}
+
+	// Neighbour depth is finite, positive and close enough to the center depth
+	inline __m128 continuous(__m128 z, __m128 centerZ, __m128 maxJump)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		__m128 jump = _mm_and_ps(_mm_sub_ps(z, centerZ), absMask);
+		return _mm_and_ps(_mm_cmpgt_ps(z, zero), _mm_cmple_ps(jump, _mm_mul_ps(centerZ, maxJump)));
+	}
+
+	class KCV_normalsBody : public cv::ParallelLoopBody
+	{
+	public:
+		KCV_normalsBody(const cv::Mat &points, cv::Mat &normals, cv::Mat *curvature, int radius, float maxDepthJump)
+			: m_Points(points), m_Normals(normals), m_Curvature(curvature), m_Radius(radius), m_MaxDepthJump(maxDepthJump)
+		{
+		}
+
+		void operator()(const cv::Range &range) const
+		{
+			const int r = m_Radius;
+			const int width = m_Points.cols;
+			const int height = m_Points.rows;
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 quarter = _mm_set1_ps(0.25f);
+			const __m128 two = _mm_set1_ps(2.0f);
+			const __m128 epsilon = _mm_set1_ps(1e-12f);
+			const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+			const __m128 maxJump = _mm_set1_ps(m_MaxDepthJump);
+
+			for (int y = range.start; y < range.end; ++y)
+			{
+				float *p_Normal = m_Normals.ptr<float>(y);
+				float *p_Curvature = m_Curvature != NULL ? m_Curvature->ptr<float>(y) : NULL;
+				if (y < r || y >= height - r)
+				{
+					memset(p_Normal, 0, width * 3 * sizeof(float));
+					if (p_Curvature != NULL)
+						memset(p_Curvature, 0, width * sizeof(float));
+					continue;
+				}
+
+				const float *p_Up = m_Points.ptr<float>(y - r);
+				const float *p_Center = m_Points.ptr<float>(y);
+				const float *p_Down = m_Points.ptr<float>(y + r);
+
+				// borders without a full window
+				memset(p_Normal, 0, r * 3 * sizeof(float));
+				memset(p_Normal + (width - r) * 3, 0, r * 3 * sizeof(float));
+				if (p_Curvature != NULL)
+				{
+					memset(p_Curvature, 0, r * sizeof(float));
+					memset(p_Curvature + width - r, 0, r * sizeof(float));
+				}
+
+				// the last block is moved back to end at the border, overlapping pixels are written twice
+				for (int x = r; x < width - r; x += 4)
+				{
+					if (x > width - r - 4)
+						x = width - r - 4;
+
+					__m128 cx, cy, cz, lx, ly, lz, rx, ry, rz, ux, uy, uz, dx, dy, dz;
+					loadPoints(p_Center + x * 3, cx, cy, cz);
+					loadPoints(p_Center + (x - r) * 3, lx, ly, lz);
+					loadPoints(p_Center + (x + r) * 3, rx, ry, rz);
+					loadPoints(p_Up + x * 3, ux, uy, uz);
+					loadPoints(p_Down + x * 3, dx, dy, dz);
+
+					__m128 valid = _mm_cmpgt_ps(cz, zero);
+					valid = _mm_and_ps(valid, continuous(lz, cz, maxJump));
+					valid = _mm_and_ps(valid, continuous(rz, cz, maxJump));
+					valid = _mm_and_ps(valid, continuous(uz, cz, maxJump));
+					valid = _mm_and_ps(valid, continuous(dz, cz, maxJump));
+
+					// horizontal and vertical tangents
+					__m128 hx = _mm_sub_ps(rx, lx), hy = _mm_sub_ps(ry, ly), hz = _mm_sub_ps(rz, lz);
+					__m128 vx = _mm_sub_ps(dx, ux), vy = _mm_sub_ps(dy, uy), vz = _mm_sub_ps(dz, uz);
+
+					__m128 nx = _mm_sub_ps(_mm_mul_ps(hy, vz), _mm_mul_ps(hz, vy));
+					__m128 ny = _mm_sub_ps(_mm_mul_ps(hz, vx), _mm_mul_ps(hx, vz));
+					__m128 nz = _mm_sub_ps(_mm_mul_ps(hx, vy), _mm_mul_ps(hy, vx));
+
+					__m128 length = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+					valid = _mm_and_ps(valid, _mm_cmpgt_ps(length, epsilon));
+					__m128 scale = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(length));
+
+					// face the camera, normal and viewing ray point against each other
+					__m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_mul_ps(nz, cz));
+					scale = _mm_xor_ps(scale, _mm_and_ps(_mm_cmpgt_ps(facing, zero), signMask));
+
+					// masked after scaling, invalid points may be infinite
+					nx = _mm_and_ps(_mm_mul_ps(nx, scale), valid);
+					ny = _mm_and_ps(_mm_mul_ps(ny, scale), valid);
+					nz = _mm_and_ps(_mm_mul_ps(nz, scale), valid);
+					storePoints(p_Normal + x * 3, nx, ny, nz);
+
+					if (p_Curvature != NULL)
+					{
+						__m128 mx = _mm_mul_ps(_mm_add_ps(_mm_add_ps(lx, rx), _mm_add_ps(ux, dx)), quarter);
+						__m128 my = _mm_mul_ps(_mm_add_ps(_mm_add_ps(ly, ry), _mm_add_ps(uy, dy)), quarter);
+						__m128 mz = _mm_mul_ps(_mm_add_ps(_mm_add_ps(lz, rz), _mm_add_ps(uz, dz)), quarter);
+						__m128 offset = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_sub_ps(cx, mx)), _mm_mul_ps(ny, _mm_sub_ps(cy, my))),
+							_mm_mul_ps(nz, _mm_sub_ps(cz, mz)));
+						__m128 spread = _mm_mul_ps(_mm_add_ps(
+							_mm_add_ps(squaredDistance(lx, ly, lz, cx, cy, cz), squaredDistance(rx, ry, rz, cx, cy, cz)),
+							_mm_add_ps(squaredDistance(ux, uy, uz, cx, cy, cz), squaredDistance(dx, dy, dz, cx, cy, cz))), quarter);
+						__m128 curvature = _mm_div_ps(_mm_mul_ps(two, offset), spread);
+						_mm_storeu_ps(p_Curvature + x, _mm_and_ps(curvature, valid));
+					}
+				}
+			}
+		}
+
+	private:
+		const cv::Mat &m_Points;
+		cv::Mat &m_Normals;
+		cv::Mat *m_Curvature;
+		int m_Radius;
+		float m_MaxDepthJump;
+	};
+}
+
+/*!
+Constructs estimator with window half size \a radius and largest neighbour depth difference \a maxDepthJump
+relative to the depth of the pixel.
+*/
+KCV_normals::KCV_normals(int radius, float maxDepthJump)
+	: m_Radius(radius > 0 ? radius : 1), m_MaxDepthJump(maxDepthJump)
+{
+}
+
+/*!
+Set window half size to \a radius pixels, larger windows smooth sensor noise.
+*/
+void KCV_normals::setRadius(int radius)
+{
+	m_Radius = radius > 0 ? radius : 1;
+}
+
+/*!
+Set largest neighbour depth difference relative to the depth of the pixel, pixels over edges get no normal.
+*/
+void KCV_normals::setMaxDepthJump(float maxDepthJump)
+{
+	m_MaxDepthJump = maxDepthJump;
+}
+
+/*!
+Estimate unit \a normals (CV_32FC3) and optional \a curvature (CV_32F, 1/m) of \a camera_coordinates (CV_32FC3).
+Pixels without a valid window are zero. Output storage is reused when the size matches.
+*/
+HRESULT KCV_normals::compute(cv::InputArray camera_coordinates, cv::OutputArray normals, cv::OutputArray curvature) const
+{
+	cv::Mat points = camera_coordinates.getMat();
+	if (points.type() != CV_32FC3 || points.cols < 2 * m_Radius + 4 || points.rows < 2 * m_Radius + 1)
+	{
+		return E_INVALIDARG;
+	}
+
+	normals.create(points.rows, points.cols, CV_32FC3);
+	cv::Mat normalMap = normals.getMat();
+	cv::Mat curvatureMap;
+	if (curvature.needed())
+	{
+		curvature.create(points.rows, points.cols, CV_32F);
+		curvatureMap = curvature.getMat();
+	}
+
+	KCV_normalsBody body(points, normalMap, curvature.needed() ? &curvatureMap : NULL, m_Radius, m_MaxDepthJump);
+	cv::parallel_for_(cv::Range(0, points.rows), body, points.rows / 16.0);
+	return S_OK;
+}
@@ -0,0 +1,35 @@
+//    File: Kinect2XNormals.h
+
+#ifndef KCV_NORMALS_H
+#define KCV_NORMALS_H
+
+// Kinect2XNormals.h
+
+// Kinect SDK
+#include <Kinect.h>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+namespace kcv
+{
+	class KCV_normals
+	{
+	public:
+		explicit KCV_normals(int radius = 2, float maxDepthJump = 0.05f);
+
+		void setRadius(int radius);
+		int radius() const { return m_Radius; }
+		void setMaxDepthJump(float maxDepthJump);
+		float maxDepthJump() const { return m_MaxDepthJump; }
+
+		HRESULT compute(cv::InputArray camera_coordinates, cv::OutputArray normals,
+			cv::OutputArray curvature = cv::noArray()) const;
+
+	private:
+		int m_Radius;			// window half size in pixels
+		float m_MaxDepthJump;	// depth difference to the window center relative to its depth
+	};
+}
+
+#endif // KCV_NORMALS_H
@@ -0,0 +1,371 @@
+//    File: Kinect2XPipeline.cpp
+
+#include "Kinect2XPipeline.h"
+
+#include <chrono>
+#include <cstring>
+
+using namespace kcv;
+
+/*!
+\class KCV_pipeline
+\brief The KCV_pipeline class runs acquisition, mapping, alignment, colorization and sinks
+as separate stages connected by bounded queues, so consecutive frames overlap.
+*/
+
+/*!
+Default configuration, every stage enabled on a single worker.
+*/
+KCV_pipelineConfig::KCV_pipelineConfig()
+	: curvature(false), queueCapacity(2), poolSize(8)
+{
+	for (int i = 0; i < KCV_STAGE_COUNT; ++i)
+	{
+		enabled[i] = true;
+		workers[i] = 1;
+	}
+	enabled[KCV_STAGE_NORMALS] = false;
+}
+
+/*!
+Constructs pipeline over \a sensor with \a config .
+*/
+KCV_pipeline::KCV_pipeline(KCV_sensor *sensor, const KCV_pipelineConfig &config)
+	: m_Sensor(sensor), m_Config(config), m_Pool(config.poolSize), m_Running(false), m_Sequence(0), m_StartTick(0)
+{
+	// acquire and sink are always present, alignment needs the per frame mapping
+	m_Config.enabled[KCV_STAGE_ACQUIRE] = true;
+	m_Config.enabled[KCV_STAGE_SINK] = true;
+	if (!m_Config.enabled[KCV_STAGE_MAP])
+	{
+		m_Config.enabled[KCV_STAGE_NORMALS] = false;
+		m_Config.enabled[KCV_STAGE_ALIGN] = false;
+	}
+	m_Config.workers[KCV_STAGE_ACQUIRE] = 1;
+	m_Config.workers[KCV_STAGE_SINK] = 1;
+	if (m_Config.queueCapacity < 1)
+		m_Config.queueCapacity = 1;
+	if (m_Config.poolSize < 2)
+		m_Config.poolSize = 2;
+
+	for (int i = 0; i < KCV_STAGE_COUNT; ++i)
+	{
+		if (m_Config.workers[i] < 1)
+			m_Config.workers[i] = 1;
+		m_Queues[i] = new KCV_queue<KCV_frame*>(m_Config.queueCapacity);
+	}
+	for (size_t i = 0; i < m_Config.poolSize; ++i)
+	{
+		m_Frames.push_back(new KCV_frame());
+	}
+	memset(m_Stats, 0, sizeof(m_Stats));
+}
+
+/*!
+Destructor, stops the pipeline.
+*/
+KCV_pipeline::~KCV_pipeline()
+{
+	stop();
+	for (int i = 0; i < KCV_STAGE_COUNT; ++i)
+	{
+		delete m_Queues[i];
+		m_Queues[i] = NULL;
+	}
+	for (size_t i = 0; i < m_Frames.size(); ++i)
+	{
+		delete m_Frames[i];
+	}
+	m_Frames.clear();
+}
+
+/*!
+Add \a sink called in sequence order for every processed frame. Only before start.
+*/
+void KCV_pipeline::addSink(const KCV_sink &sink)
+{
+	if (!m_Running)
+		m_Sinks.push_back(sink);
+}
+
+/*!
+Start stage workers.
+*/
+HRESULT KCV_pipeline::start()
+{
+	if (m_Sensor == NULL)
+	{
+		return E_POINTER;
+	}
+	if (m_Running)
+	{
+		return S_FALSE;
+	}
+
+	double waited = 0.0;
+	m_Pool.reset(m_Config.poolSize);
+	for (size_t i = 0; i < m_Frames.size(); ++i)
+	{
+		m_Pool.push(m_Frames[i], waited);
+	}
+	for (int i = 0; i < KCV_STAGE_COUNT; ++i)
+	{
+		m_Queues[i]->reset(m_Config.queueCapacity);
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_StatsMutex);
+		memset(m_Stats, 0, sizeof(m_Stats));
+	}
+	m_Sequence = 0;
+	m_StartTick = cv::getTickCount();
+	m_Running = true;
+
+	m_Threads.push_back(std::thread(&KCV_pipeline::acquireLoop, this));
+	for (int stage = KCV_STAGE_MAP; stage < KCV_STAGE_SINK; ++stage)
+	{
+		if (!m_Config.enabled[stage])
+			continue;
+		for (int w = 0; w < m_Config.workers[stage]; ++w)
+		{
+			m_Threads.push_back(std::thread(&KCV_pipeline::stageLoop, this, (KCV_stage)stage));
+		}
+	}
+	m_Threads.push_back(std::thread(&KCV_pipeline::sinkLoop, this));
+	return S_OK;
+}
+
+/*!
+Stop stage workers, frames in flight are dropped.
+*/
+void KCV_pipeline::stop()
+{
+	m_Running = false;
+	m_Pool.close();
+	for (int i = 0; i < KCV_STAGE_COUNT; ++i)
+	{
+		m_Queues[i]->close();
+	}
+	for (size_t i = 0; i < m_Threads.size(); ++i)
+	{
+		if (m_Threads[i].joinable())
+			m_Threads[i].join();
+	}
+	m_Threads.clear();
+}
+
+/*!
+Returns if the pipeline is running.
+*/
+bool KCV_pipeline::isRunning() const
+{
+	return m_Running;
+}
+
+/*!
+Returns timing and backpressure of \a stage .
+*/
+KCV_stageStats KCV_pipeline::getStats(KCV_stage stage) const
+{
+	KCV_stageStats stats;
+	{
+		std::lock_guard<std::mutex> lock(m_StatsMutex);
+		stats = m_Stats[stage];
+	}
+	stats.queued = stage == KCV_STAGE_ACQUIRE ? m_Pool.size() : m_Queues[stage]->size();
+	return stats;
+}
+
+/*!
+Returns delivered frames per second since start.
+*/
+double KCV_pipeline::getThroughput() const
+{
+	double seconds = (cv::getTickCount() - m_StartTick) / cv::getTickFrequency();
+	if (seconds <= 0.0)
+		return 0.0;
+	std::lock_guard<std::mutex> lock(m_StatsMutex);
+	return m_Stats[KCV_STAGE_SINK].frames / seconds;
+}
+
+/*!
+Returns first enabled stage after \a stage .
+*/
+int KCV_pipeline::nextStage(KCV_stage stage) const
+{
+	int next = stage + 1;
+	while (next < KCV_STAGE_SINK && !m_Config.enabled[next])
+		++next;
+	return next;
+}
+
+/*!
+Pass \a frame from \a stage to the next enabled stage, blocks while its queue is full.
+*/
+bool KCV_pipeline::forward(KCV_stage stage, KCV_frame *frame, double &blockedMs)
+{
+	return m_Queues[nextStage(stage)]->push(frame, blockedMs);
+}
+
+/*!
+Add one processed frame of \a stage to the statistics, counted as \a dropped when it was not processed.
+*/
+void KCV_pipeline::record(KCV_stage stage, double busyMs, double starvedMs, double blockedMs, bool dropped)
+{
+	std::lock_guard<std::mutex> lock(m_StatsMutex);
+	KCV_stageStats &stats = m_Stats[stage];
+	if (dropped)
+		stats.dropped++;
+	else
+		stats.frames++;
+	stats.lastMs = busyMs;
+	stats.busyMs += busyMs;
+	stats.starvedMs += starvedMs;
+	stats.blockedMs += blockedMs;
+}
+
+/*!
+Acquisition worker, takes free frames from the pool and fills them from the sensor.
+*/
+void KCV_pipeline::acquireLoop()
+{
+	const double tickMs = 1000.0 / cv::getTickFrequency();
+	while (m_Running)
+	{
+		KCV_frame *frame = NULL;
+		double starved = 0.0;
+		if (!m_Pool.pop(frame, starved))
+			break;
+
+		// wait for the next sensor frame
+		int64 start = cv::getTickCount();
+		HRESULT hr = m_Sensor->acquireRawImages(frame->depth, frame->color, frame->infrared, frame->longExposureInfrared);
+		while (FAILED(hr) && m_Running)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			start = cv::getTickCount();
+			hr = m_Sensor->acquireRawImages(frame->depth, frame->color, frame->infrared, frame->longExposureInfrared);
+		}
+		if (FAILED(hr))
+			break;
+		int64 end = cv::getTickCount();
+
+		frame->sequence = m_Sequence++;
+		frame->acquiredTick = end;
+		frame->dropped = false;
+
+		double blocked = 0.0;
+		bool forwarded = forward(KCV_STAGE_ACQUIRE, frame, blocked);
+		record(KCV_STAGE_ACQUIRE, (end - start) * tickMs, starved, blocked);
+		if (!forwarded)
+			break;
+	}
+}
+
+/*!
+Worker of a processing \a stage .
+*/
+void KCV_pipeline::stageLoop(KCV_stage stage)
+{
+	const double tickMs = 1000.0 / cv::getTickFrequency();
+	while (m_Running)
+	{
+		KCV_frame *frame = NULL;
+		double starved = 0.0;
+		if (!m_Queues[stage]->pop(frame, starved))
+			break;
+
+		// a dropped frame still flows to the sink, which keeps the sequence order
+		int64 start = cv::getTickCount();
+		const bool failed = !frame->dropped && FAILED(process(stage, frame));
+		frame->dropped = frame->dropped || failed;
+		double busy = (cv::getTickCount() - start) * tickMs;
+
+		double blocked = 0.0;
+		bool forwarded = forward(stage, frame, blocked);
+		record(stage, busy, starved, blocked, failed);
+		if (!forwarded)
+			break;
+	}
+}
+
+/*!
+Run \a stage on \a frame . A failed stage drops the frame.
+*/
+HRESULT KCV_pipeline::process(KCV_stage stage, KCV_frame *frame)
+{
+	HRESULT hr = S_OK;
+	switch (stage)
+	{
+	case KCV_STAGE_MAP:
+		// without the color stream only the depth grid is mapped
+		hr = m_Sensor->mapCoordinates(frame->depth, frame->color.cols, frame->color.rows,
+			frame->colorCoordinates, frame->depthCoordinates, frame->cameraCoordinates);
+		break;
+	case KCV_STAGE_NORMALS:
+		if (m_Config.curvature)
+			hr = m_Normals.compute(frame->cameraCoordinates, frame->normals, frame->curvature);
+		else
+			hr = m_Normals.compute(frame->cameraCoordinates, frame->normals);
+		break;
+	case KCV_STAGE_ALIGN:
+		// nothing to align without color, stale images of an earlier frame are not passed on
+		if (frame->color.empty() || frame->colorCoordinates.empty() || frame->depthCoordinates.empty())
+		{
+			frame->alignedColor.release();
+			frame->alignedDepth.release();
+			break;
+		}
+		hr = m_Sensor->alignColorFrame(frame->colorCoordinates, frame->color, frame->alignedColor);
+		if (SUCCEEDED(hr))
+			hr = m_Sensor->alignDepthFrame(frame->depthCoordinates, frame->depth, frame->alignedDepth);
+		break;
+	case KCV_STAGE_COLORIZE:
+		m_Sensor->visualiseDepthMap(frame->depth, frame->depthVis);
+		break;
+	default:
+		break;
+	}
+	return hr;
+}
+
+/*!
+Sink worker, restores sequence order, calls sinks and returns frames to the pool.
+*/
+void KCV_pipeline::sinkLoop()
+{
+	const double tickMs = 1000.0 / cv::getTickFrequency();
+	std::map<unsigned long long, KCV_frame*> pending;
+	unsigned long long expected = 0;
+
+	while (m_Running)
+	{
+		KCV_frame *frame = NULL;
+		double starved = 0.0;
+		if (!m_Queues[KCV_STAGE_SINK]->pop(frame, starved))
+			break;
+		pending[frame->sequence] = frame;
+
+		// stages with several workers may finish frames out of order
+		std::map<unsigned long long, KCV_frame*>::iterator it = pending.find(expected);
+		while (it != pending.end())
+		{
+			KCV_frame *next = it->second;
+			pending.erase(it);
+
+			int64 start = cv::getTickCount();
+			for (size_t i = 0; i < m_Sinks.size() && !next->dropped; ++i)
+			{
+				m_Sinks[i](*next);
+			}
+			double busy = (cv::getTickCount() - start) * tickMs;
+
+			double blocked = 0.0;
+			const bool dropped = next->dropped;
+			m_Pool.push(next, blocked);
+			record(KCV_STAGE_SINK, busy, starved, blocked, dropped);
+			starved = 0.0;
+
+			it = pending.find(++expected);
+		}
+	}
+}
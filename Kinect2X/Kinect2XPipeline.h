@@ -0,0 +1,204 @@
+//    File: Kinect2XPipeline.h
+
+#ifndef KCV_PIPELINE_H
+#define KCV_PIPELINE_H
+
+// Kinect2XPipeline.h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Kinect2X.h"
+
+namespace kcv
+{
+	// Frame flowing through the pipeline, storage is pooled and reused
+	struct KCV_frame
+	{
+		unsigned long long sequence;
+		int64 acquiredTick;
+		bool dropped;				// a stage failed, later stages and the sinks skip the frame
+
+		cv::Mat depth;				// CV_16U
+		cv::Mat color;				// CV_8UC4
+		cv::Mat infrared;			// CV_16U, empty unless the stream is enabled
+		cv::Mat longExposureInfrared;	// CV_16U, empty unless the stream is enabled
+		cv::Mat colorCoordinates;	// CV_32FC2, depth grid
+		cv::Mat depthCoordinates;	// CV_32FC2, color grid
+		cv::Mat cameraCoordinates;	// CV_32FC3, depth grid
+		cv::Mat normals;			// CV_32FC3, depth grid
+		cv::Mat curvature;			// CV_32F, depth grid
+		cv::Mat alignedColor;		// CV_8UC4, depth grid
+		cv::Mat alignedDepth;		// CV_16U, color grid
+		cv::Mat depthVis;			// CV_8UC3
+	};
+
+	enum KCV_stage
+	{
+		KCV_STAGE_ACQUIRE = 0,
+		KCV_STAGE_MAP,
+		KCV_STAGE_NORMALS,
+		KCV_STAGE_ALIGN,
+		KCV_STAGE_COLORIZE,
+		KCV_STAGE_SINK,
+		KCV_STAGE_COUNT
+	};
+
+	struct KCV_stageStats
+	{
+		unsigned long long frames;
+		unsigned long long dropped;	// frames failed in the stage, at the sink all frames not delivered
+		double lastMs;		// processing time of the last frame
+		double busyMs;		// total processing time
+		double starvedMs;	// total time waiting for input
+		double blockedMs;	// total time waiting on full output queue (backpressure)
+		size_t queued;		// frames waiting in the input queue
+	};
+
+	struct KCV_pipelineConfig
+	{
+		KCV_pipelineConfig();
+
+		bool enabled[KCV_STAGE_COUNT];	// map, align and colorize can be switched off, normals is off by default
+		bool curvature;					// normals stage also estimates curvature
+		int workers[KCV_STAGE_COUNT];	// acquire and sink always run on one worker
+		size_t queueCapacity;			// frames between two stages
+		size_t poolSize;				// frames in flight
+	};
+
+	// Sinks get the frame only for the duration of the call
+	typedef std::function<void(const KCV_frame &)> KCV_sink;
+
+	// Bounded blocking queue between two stages
+	template<class T>
+	class KCV_queue
+	{
+	public:
+		explicit KCV_queue(size_t capacity) : m_Capacity(capacity), m_Closed(false) {}
+
+		// Returns false when the queue was closed, \a waitedMs is the time spent blocked
+		bool push(const T &item, double &waitedMs)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			waitedMs = 0.0;
+			if (m_Items.size() >= m_Capacity && !m_Closed)
+			{
+				int64 start = cv::getTickCount();
+				while (m_Items.size() >= m_Capacity && !m_Closed)
+					m_NotFull.wait(lock);
+				waitedMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+			}
+			if (m_Closed)
+				return false;
+			m_Items.push_back(item);
+			m_NotEmpty.notify_one();
+			return true;
+		}
+
+		// Returns false when the queue was closed, \a waitedMs is the time spent waiting
+		bool pop(T &item, double &waitedMs)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			waitedMs = 0.0;
+			if (m_Items.empty() && !m_Closed)
+			{
+				int64 start = cv::getTickCount();
+				while (m_Items.empty() && !m_Closed)
+					m_NotEmpty.wait(lock);
+				waitedMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+			}
+			if (m_Items.empty())
+				return false;
+			item = m_Items.front();
+			m_Items.pop_front();
+			m_NotFull.notify_one();
+			return true;
+		}
+
+		void close()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Closed = true;
+			m_NotEmpty.notify_all();
+			m_NotFull.notify_all();
+		}
+
+		void reset(size_t capacity)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Items.clear();
+			m_Capacity = capacity;
+			m_Closed = false;
+		}
+
+		size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Items.size();
+		}
+
+	private:
+		KCV_queue(const KCV_queue&);
+		KCV_queue& operator=(const KCV_queue&);
+
+		mutable std::mutex m_Mutex;
+		std::condition_variable m_NotEmpty;
+		std::condition_variable m_NotFull;
+		std::deque<T> m_Items;
+		size_t m_Capacity;
+		bool m_Closed;
+	};
+
+	class KCV_pipeline
+	{
+	public:
+		KCV_pipeline(KCV_sensor *sensor, const KCV_pipelineConfig &config = KCV_pipelineConfig());
+		~KCV_pipeline();
+
+		void addSink(const KCV_sink &sink);
+		HRESULT start();
+		void stop();
+		bool isRunning() const;
+
+		KCV_stageStats getStats(KCV_stage stage) const;
+		double getThroughput() const;
+
+	private:
+		KCV_pipeline(const KCV_pipeline&);
+		KCV_pipeline& operator=(const KCV_pipeline&);
+
+		void acquireLoop();
+		void stageLoop(KCV_stage stage);
+		void sinkLoop();
+		HRESULT process(KCV_stage stage, KCV_frame *frame);
+		int nextStage(KCV_stage stage) const;
+		bool forward(KCV_stage stage, KCV_frame *frame, double &blockedMs);
+		void record(KCV_stage stage, double busyMs, double starvedMs, double blockedMs, bool dropped = false);
+
+		KCV_sensor *m_Sensor;
+		KCV_pipelineConfig m_Config;
+		KCV_normals m_Normals;
+		std::vector<KCV_sink> m_Sinks;
+
+		// Frame pool and input queue of every stage
+		std::vector<KCV_frame*> m_Frames;
+		KCV_queue<KCV_frame*> m_Pool;
+		KCV_queue<KCV_frame*> *m_Queues[KCV_STAGE_COUNT];
+
+		std::vector<std::thread> m_Threads;
+		std::atomic<bool> m_Running;
+		unsigned long long m_Sequence;
+		int64 m_StartTick;
+
+		mutable std::mutex m_StatsMutex;
+		KCV_stageStats m_Stats[KCV_STAGE_COUNT];
+	};
+}
+
+#endif // KCV_PIPELINE_H
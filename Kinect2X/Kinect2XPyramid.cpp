@@ -0,0 +1,270 @@
+//    File: Kinect2XPyramid.cpp
+
+#include "Kinect2XPyramid.h"
+
+#include <algorithm>
+#include <climits>
+#include <limits>
+
+#include <emmintrin.h>
+
+using namespace kcv;
+
+/*!
+\class KCV_pyramid
+\brief The KCV_pyramid class builds half resolution levels of a depth frame without mixing invalid pixels into valid ones.
+
+Every output pixel reduces the valid depths of its 2x2 block, 0 and USHRT_MAX are invalid and a block without
+valid depth is 0. The matching camera space point is the point of the selected depth, or the mean of the valid
+points in mean mode. Eight pixels are reduced at once, rows are split across cores and the level buffers
+are reused between frames.
+*/
+
+namespace
+{
+	// Depth d maps to (d - 1) ^ 0x8000, ordering valid depths as signed 16 bit values below both invalid ones
+	const short KCV_INVALID_KEY = 0x7ffe;
+
+	// Low and high 16 bits of the 32 bit lanes of a and b, as eight values each
+	inline void deinterleave(__m128i a, __m128i b, __m128i &even, __m128i &odd)
+	{
+		even = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+		odd = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+	}
+
+	inline bool isValid(UINT16 depth)
+	{
+		return depth != 0 && depth != USHRT_MAX;
+	}
+
+	// Reduce depths d[0..3] of one block
+	UINT16 reduceBlock(const UINT16 *d, KCV_pyramidMode mode)
+	{
+		UINT16 valid[4];
+		int n = 0;
+		unsigned int sum = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (isValid(d[i]))
+			{
+				valid[n++] = d[i];
+				sum += d[i];
+			}
+		}
+		if (n == 0)
+			return 0;
+
+		switch (mode)
+		{
+		case KCV_PYRAMID_MIN:
+			return *std::min_element(valid, valid + n);
+		case KCV_PYRAMID_MEDIAN:
+			std::sort(valid, valid + n);
+			return valid[(n - 1) / 2];
+		default:
+			return (UINT16)((sum + n / 2) / n);
+		}
+	}
+
+	class KCV_pyramidBody : public cv::ParallelLoopBody
+	{
+	public:
+		KCV_pyramidBody(const cv::Mat &depth, const cv::Mat &camera, cv::Mat &reducedDepth, cv::Mat &reducedCamera, KCV_pyramidMode mode)
+			: m_Depth(depth), m_Camera(camera), m_ReducedDepth(reducedDepth), m_ReducedCamera(reducedCamera), m_Mode(mode)
+		{
+		}
+
+		void operator()(const cv::Range &range) const
+		{
+			const int width = m_ReducedDepth.cols;
+			const __m128i one = _mm_set1_epi16(1);
+			const __m128i bias = _mm_set1_epi16((short)0x8000);
+			const __m128i invalidKey = _mm_set1_epi16(KCV_INVALID_KEY);
+			const __m128i minusTwo = _mm_set1_epi16(-2);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i bias32 = _mm_set1_epi32(0x8000);
+			const __m128 half = _mm_set1_ps(0.5f);
+			const __m128 oneF = _mm_set1_ps(1.0f);
+
+			for (int y = range.start; y < range.end; ++y)
+			{
+				const UINT16 *p_Row0 = m_Depth.ptr<UINT16>(2 * y);
+				const UINT16 *p_Row1 = m_Depth.ptr<UINT16>(2 * y + 1);
+				UINT16 *p_Reduced = m_ReducedDepth.ptr<UINT16>(y);
+
+				int x = 0;
+				for (; x + 8 <= width; x += 8)
+				{
+					__m128i k[4];
+					{
+						__m128i r0a = _mm_xor_si128(_mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Row0 + 2 * x)), one), bias);
+						__m128i r0b = _mm_xor_si128(_mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Row0 + 2 * x + 8)), one), bias);
+						__m128i r1a = _mm_xor_si128(_mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Row1 + 2 * x)), one), bias);
+						__m128i r1b = _mm_xor_si128(_mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Row1 + 2 * x + 8)), one), bias);
+						deinterleave(r0a, r0b, k[0], k[1]);
+						deinterleave(r1a, r1b, k[2], k[3]);
+					}
+
+					__m128i result;
+					if (m_Mode == KCV_PYRAMID_MEAN)
+					{
+						// sums and counts of the valid depths in 32 bits
+						__m128i sumLo = zero, sumHi = zero, count = zero;
+						for (int i = 0; i < 4; ++i)
+						{
+							__m128i valid = _mm_cmplt_epi16(k[i], invalidKey);
+							__m128i depth = _mm_and_si128(valid, _mm_add_epi16(_mm_xor_si128(k[i], bias), one));
+							sumLo = _mm_add_epi32(sumLo, _mm_unpacklo_epi16(depth, zero));
+							sumHi = _mm_add_epi32(sumHi, _mm_unpackhi_epi16(depth, zero));
+							count = _mm_sub_epi16(count, valid);
+						}
+						__m128 countLo = _mm_max_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(count, zero)), oneF);
+						__m128 countHi = _mm_max_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(count, zero)), oneF);
+						__m128i meanLo = _mm_cvttps_epi32(_mm_add_ps(_mm_div_ps(_mm_cvtepi32_ps(sumLo), countLo), half));
+						__m128i meanHi = _mm_cvttps_epi32(_mm_add_ps(_mm_div_ps(_mm_cvtepi32_ps(sumHi), countHi), half));
+						// pack unsigned 16 bit values through the signed range
+						result = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(meanLo, bias32), _mm_sub_epi32(meanHi, bias32)), bias);
+					}
+					else
+					{
+						__m128i key;
+						if (m_Mode == KCV_PYRAMID_MIN)
+						{
+							key = _mm_min_epi16(_mm_min_epi16(k[0], k[1]), _mm_min_epi16(k[2], k[3]));
+						}
+						else
+						{
+							// sorting network, invalid depths sort last
+							__m128i a = _mm_min_epi16(k[0], k[1]), b = _mm_max_epi16(k[0], k[1]);
+							__m128i c = _mm_min_epi16(k[2], k[3]), d = _mm_max_epi16(k[2], k[3]);
+							__m128i s0 = _mm_min_epi16(a, c);
+							__m128i s1 = _mm_min_epi16(_mm_max_epi16(a, c), _mm_min_epi16(b, d));
+
+							// lower median is the second value of 3 or 4 valid depths, the first otherwise
+							__m128i count = zero;
+							for (int i = 0; i < 4; ++i)
+								count = _mm_add_epi16(count, _mm_cmplt_epi16(k[i], invalidKey));
+							__m128i second = _mm_cmplt_epi16(count, minusTwo);	// count is minus the valid depths
+							key = _mm_or_si128(_mm_and_si128(second, s1), _mm_andnot_si128(second, s0));
+						}
+						__m128i valid = _mm_cmplt_epi16(key, invalidKey);
+						result = _mm_and_si128(valid, _mm_add_epi16(_mm_xor_si128(key, bias), one));
+					}
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(p_Reduced + x), result);
+				}
+				for (; x < width; ++x)
+				{
+					const UINT16 d[4] = { p_Row0[2 * x], p_Row0[2 * x + 1], p_Row1[2 * x], p_Row1[2 * x + 1] };
+					p_Reduced[x] = reduceBlock(d, m_Mode);
+				}
+
+				if (!m_Camera.empty())
+					reduceCamera(y);
+			}
+		}
+
+	private:
+		// Camera points of row y of the reduced depth
+		void reduceCamera(int y) const
+		{
+			const float invalid = -std::numeric_limits<float>::infinity();
+			const UINT16 *p_Row0 = m_Depth.ptr<UINT16>(2 * y);
+			const UINT16 *p_Row1 = m_Depth.ptr<UINT16>(2 * y + 1);
+			const cv::Vec3f *p_Camera0 = m_Camera.ptr<cv::Vec3f>(2 * y);
+			const cv::Vec3f *p_Camera1 = m_Camera.ptr<cv::Vec3f>(2 * y + 1);
+			const UINT16 *p_Reduced = m_ReducedDepth.ptr<UINT16>(y);
+			cv::Vec3f *p_ReducedCamera = m_ReducedCamera.ptr<cv::Vec3f>(y);
+
+			for (int x = 0; x < m_ReducedDepth.cols; ++x)
+			{
+				const UINT16 d[4] = { p_Row0[2 * x], p_Row0[2 * x + 1], p_Row1[2 * x], p_Row1[2 * x + 1] };
+				const cv::Vec3f *p[4] = { &p_Camera0[2 * x], &p_Camera0[2 * x + 1], &p_Camera1[2 * x], &p_Camera1[2 * x + 1] };
+				cv::Vec3f &out = p_ReducedCamera[x];
+				out = cv::Vec3f(invalid, invalid, invalid);
+				if (p_Reduced[x] == 0)
+					continue;
+
+				if (m_Mode == KCV_PYRAMID_MEAN)
+				{
+					cv::Vec3f sum(0.0f, 0.0f, 0.0f);
+					int n = 0;
+					for (int i = 0; i < 4; ++i)
+					{
+						if (isValid(d[i]))
+						{
+							sum += *p[i];
+							++n;
+						}
+					}
+					out = sum * (1.0f / n);
+				}
+				else
+				{
+					for (int i = 0; i < 4; ++i)
+					{
+						if (d[i] == p_Reduced[x])
+						{
+							out = *p[i];
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		const cv::Mat &m_Depth;
+		const cv::Mat &m_Camera;
+		cv::Mat &m_ReducedDepth;
+		cv::Mat &m_ReducedCamera;
+		KCV_pyramidMode m_Mode;
+	};
+}
+
+/*!
+Constructs pyramid of \a levels , including the input level, reducing blocks by \a mode .
+*/
+KCV_pyramid::KCV_pyramid(int levels, KCV_pyramidMode mode)
+	: m_Levels(1), m_Mode(mode)
+{
+	setLevels(levels);
+}
+
+/*!
+Set number of \a levels including the input level, at least 1.
+*/
+void KCV_pyramid::setLevels(int levels)
+{
+	m_Levels = std::max(levels, 1);
+	m_Depth.resize(m_Levels);
+	m_Camera.resize(m_Levels);
+}
+
+/*!
+Build levels of \a depth_frame (CV_16U) and, when given, of the matching \a camera_coordinates (CV_32FC3).
+Level 0 references the inputs, they must outlive its use.
+*/
+HRESULT KCV_pyramid::build(cv::InputArray depth_frame, cv::InputArray camera_coordinates)
+{
+	cv::Mat depth = depth_frame.getMat();
+	cv::Mat camera = camera_coordinates.getMat();
+	if (depth.type() != CV_16U || (!camera.empty() && (camera.type() != CV_32FC3 || camera.size() != depth.size())))
+	{
+		return E_INVALIDARG;
+	}
+
+	m_Depth[0] = depth;
+	m_Camera[0] = camera;
+	for (int level = 1; level < m_Levels; ++level)
+	{
+		const cv::Mat &source = m_Depth[level - 1];
+		m_Depth[level].create(source.rows / 2, source.cols / 2, CV_16U);
+		if (camera.empty())
+			m_Camera[level].release();
+		else
+			m_Camera[level].create(source.rows / 2, source.cols / 2, CV_32FC3);
+
+		KCV_pyramidBody body(source, m_Camera[level - 1], m_Depth[level], m_Camera[level], m_Mode);
+		cv::parallel_for_(cv::Range(0, m_Depth[level].rows), body, m_Depth[level].rows / 16.0);
+	}
+	return S_OK;
+}
@@ -0,0 +1,50 @@
+//    File: Kinect2XPyramid.h
+
+#ifndef KCV_PYRAMID_H
+#define KCV_PYRAMID_H
+
+// Kinect2XPyramid.h
+
+#include <vector>
+
+// Kinect SDK
+#include <Kinect.h>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+namespace kcv
+{
+	// Reduction of the valid depths of a 2x2 block
+	enum KCV_pyramidMode
+	{
+		KCV_PYRAMID_MIN,		// nearest depth, keeps foreground edges
+		KCV_PYRAMID_MEDIAN,		// lower median, an actual measurement
+		KCV_PYRAMID_MEAN		// mean of the valid depths
+	};
+
+	class KCV_pyramid
+	{
+	public:
+		explicit KCV_pyramid(int levels = 3, KCV_pyramidMode mode = KCV_PYRAMID_MIN);
+
+		void setLevels(int levels);
+		int levels() const { return m_Levels; }
+		void setMode(KCV_pyramidMode mode) { m_Mode = mode; }
+		KCV_pyramidMode mode() const { return m_Mode; }
+
+		HRESULT build(cv::InputArray depth_frame, cv::InputArray camera_coordinates = cv::noArray());
+
+		// Level 0 is the input itself, the camera levels are empty without camera coordinates
+		const cv::Mat &depth(int level) const { return m_Depth[level]; }
+		const cv::Mat &camera(int level) const { return m_Camera[level]; }
+
+	private:
+		int m_Levels;
+		KCV_pyramidMode m_Mode;
+		std::vector<cv::Mat> m_Depth;	// CV_16U, 0 when invalid
+		std::vector<cv::Mat> m_Camera;	// CV_32FC3, -infinity when invalid
+	};
+}
+
+#endif // KCV_PYRAMID_H
@@ -0,0 +1,507 @@
+//    File: Kinect2XShared.cpp
+
+#include "Kinect2XShared.h"
+
+#include <cstring>
+
+using namespace kcv;
+
+/*!
+\class KCV_publisher
+\brief The KCV_publisher class writes frames into a shared memory ring for other local processes.
+*/
+
+/*!
+\class KCV_subscriber
+\brief The KCV_subscriber class reads frames published by KCV_publisher without copying them.
+*/
+
+namespace
+{
+	const char KCV_SHARED_MAGIC[8] = { 'K', 'C', 'V', 'S', 'H', 'A', 'R', 'E' };
+
+	UINT64 alignTo(UINT64 value, UINT64 alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	std::wstring mappingName(const std::wstring &name)
+	{
+		return L"Local\\kcv_" + name;
+	}
+
+	std::wstring eventName(const std::wstring &name, int index)
+	{
+		return L"Local\\kcv_" + name + L"_" + std::to_wstring((long long)index);
+	}
+
+	KCV_sharedSlot *slotAt(KCV_sharedHeader *header, unsigned long long sequence)
+	{
+		BYTE *base = reinterpret_cast<BYTE*>(header);
+		return reinterpret_cast<KCV_sharedSlot*>(base + header->slotOffset + (sequence % header->slotCount) * header->slotSize);
+	}
+
+	// Subscriber slot value of \a token in \a process , claimed by one compare exchange
+	LONG64 subscriberOwner(LONG token, DWORD process)
+	{
+		return (LONG64)(((UINT64)(UINT32)token << 32) | process);
+	}
+
+	// Returns if the process in the low half of \a owner , a subscriber slot value or the publisher, is gone
+	bool isAbandoned(LONG64 owner)
+	{
+		HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)(owner & 0xffffffff));
+		if (process == NULL)
+			return true;
+		bool exited = WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+		CloseHandle(process);
+		return exited;
+	}
+}
+
+/*!
+Constructs a closed publisher.
+*/
+KCV_publisher::KCV_publisher()
+	: m_Mapping(NULL), m_Header(NULL), m_Sequence(0), m_Owner(false)
+{
+	for (int i = 0; i < KCV_SHARED_MAX_SUBSCRIBERS; ++i)
+	{
+		m_Events[i] = NULL;
+		m_Owners[i] = 0;
+	}
+}
+
+/*!
+Destructor.
+*/
+KCV_publisher::~KCV_publisher()
+{
+	close();
+}
+
+/*!
+Create shared ring \a name with \a slotCount frames of \a depthSize depth and \a colorSize color images.
+Only one publisher may own a name, the ring records its process and fails with ERROR_ALREADY_EXISTS while that
+process lives. When subscribers still hold the ring of a closed or exited publisher, a ring of the same layout is
+taken over and its sequence continues, another layout fails with ERROR_ALREADY_EXISTS.
+*/
+HRESULT KCV_publisher::create(const std::wstring &name, const cv::Size &depthSize, const cv::Size &colorSize, int slotCount)
+{
+	close();
+	// one slot may be under write, readers need at least two more
+	if (slotCount < 3)
+		slotCount = 3;
+
+	KCV_sharedHeader layout;
+	memset(&layout, 0, sizeof(layout));
+	const int types[KCV_PLANE_COUNT] = { CV_16U, CV_8UC4, CV_8UC4, CV_16U };
+	const cv::Size sizes[KCV_PLANE_COUNT] = { depthSize, colorSize, depthSize, colorSize };
+
+	UINT64 offset = alignTo(sizeof(KCV_sharedSlot), 64);
+	for (int i = 0; i < KCV_PLANE_COUNT; ++i)
+	{
+		KCV_sharedPlane &plane = layout.planes[i];
+		plane.rows = sizes[i].height;
+		plane.cols = sizes[i].width;
+		plane.type = types[i];
+		plane.step = (UINT32)(sizes[i].width * CV_ELEM_SIZE(types[i]));
+		plane.offset = offset;
+		offset = alignTo(offset + (UINT64)plane.rows * plane.step, 64);
+	}
+	layout.version = KCV_SHARED_VERSION;
+	layout.slotCount = slotCount;
+	layout.slotSize = alignTo(offset, 4096);
+	layout.slotOffset = alignTo(sizeof(KCV_sharedHeader), 4096);
+	const UINT64 total = layout.slotOffset + layout.slotCount * layout.slotSize;
+
+	m_Mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(total >> 32), (DWORD)total,
+		mappingName(name).c_str());
+	if (m_Mapping == NULL)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	const bool exists = GetLastError() == ERROR_ALREADY_EXISTS;
+
+	m_Header = reinterpret_cast<KCV_sharedHeader*>(MapViewOfFile(m_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+	if (m_Header == NULL)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		close();
+		return hr;
+	}
+
+	if (exists)
+	{
+		// ring of a previous publisher kept alive by subscribers, the existing mapping keeps its size
+		MEMORY_BASIC_INFORMATION info;
+		bool compatible = VirtualQuery(m_Header, &info, sizeof(info)) != 0 && info.RegionSize >= total;
+		MemoryBarrier();
+		compatible = compatible &&
+			memcmp(m_Header->magic, KCV_SHARED_MAGIC, sizeof(m_Header->magic)) == 0 &&
+			m_Header->version == layout.version && m_Header->slotCount == layout.slotCount &&
+			m_Header->slotSize == layout.slotSize && m_Header->slotOffset == layout.slotOffset &&
+			memcmp(m_Header->planes, layout.planes, sizeof(layout.planes)) == 0;
+		if (!compatible)
+		{
+			close();
+			return HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+		}
+
+		// claimed by one compare exchange, the owner of a crashed publisher is replaced
+		LONG owner = m_Header->publisher;
+		for (;;)
+		{
+			if (owner != 0 && !isAbandoned((LONG64)(UINT32)owner))
+			{
+				close();
+				return HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+			}
+			LONG seen = InterlockedCompareExchange(&m_Header->publisher, (LONG)GetCurrentProcessId(), owner);
+			if (seen == owner)
+				break;
+			owner = seen;
+		}
+		m_Owner = true;
+
+		// subscribers wait for sequences above the published one
+		m_Name = name;
+		m_Sequence = (unsigned long long)m_Header->published;
+		return S_OK;
+	}
+
+	// pages start zeroed, magic goes last so subscribers never see a partial header
+	layout.publisher = (LONG)GetCurrentProcessId();
+	m_Owner = true;
+	memcpy(m_Header, &layout, sizeof(layout));
+	MemoryBarrier();
+	memcpy(m_Header->magic, KCV_SHARED_MAGIC, sizeof(m_Header->magic));
+
+	m_Name = name;
+	m_Sequence = 0;
+	return S_OK;
+}
+
+/*!
+Unmap the ring, subscribers keep their mapping until they close and another publisher may take it over.
+*/
+void KCV_publisher::close()
+{
+	if (m_Owner)
+	{
+		InterlockedExchange(&m_Header->publisher, 0);
+		m_Owner = false;
+	}
+	for (int i = 0; i < KCV_SHARED_MAX_SUBSCRIBERS; ++i)
+	{
+		if (m_Events[i] != NULL)
+			CloseHandle(m_Events[i]);
+		m_Events[i] = NULL;
+		m_Owners[i] = 0;
+	}
+	if (m_Header != NULL)
+	{
+		UnmapViewOfFile(m_Header);
+		m_Header = NULL;
+	}
+	if (m_Mapping != NULL)
+	{
+		CloseHandle(m_Mapping);
+		m_Mapping = NULL;
+	}
+}
+
+/*!
+Publish \a depth , \a color , \a aligned_color and \a aligned_depth as the next frame. Empty images are left out.
+*/
+HRESULT KCV_publisher::publish(const cv::Mat &depth, const cv::Mat &color, const cv::Mat &aligned_color, const cv::Mat &aligned_depth)
+{
+	if (m_Header == NULL)
+	{
+		return E_FAIL;
+	}
+
+	const cv::Mat *images[KCV_PLANE_COUNT] = { &depth, &color, &aligned_color, &aligned_depth };
+	for (int i = 0; i < KCV_PLANE_COUNT; ++i)
+	{
+		const KCV_sharedPlane &plane = m_Header->planes[i];
+		if (!images[i]->empty() &&
+			(images[i]->rows != plane.rows || images[i]->cols != plane.cols || images[i]->type() != plane.type))
+		{
+			return E_INVALIDARG;
+		}
+	}
+
+	const unsigned long long sequence = m_Sequence + 1;
+	KCV_sharedSlot *slot = slotAt(m_Header, sequence);
+	BYTE *base = reinterpret_cast<BYTE*>(slot);
+
+	// readers holding the old frame of this slot see begin change
+	slot->begin = (LONG64)sequence;
+	MemoryBarrier();
+
+	UINT32 mask = 0;
+	for (int i = 0; i < KCV_PLANE_COUNT; ++i)
+	{
+		if (images[i]->empty())
+			continue;
+		const KCV_sharedPlane &plane = m_Header->planes[i];
+		cv::Mat target(plane.rows, plane.cols, plane.type, base + plane.offset, plane.step);
+		images[i]->copyTo(target);
+		mask |= 1u << i;
+	}
+	slot->tick = cv::getTickCount();
+	slot->planeMask = mask;
+
+	MemoryBarrier();
+	slot->end = (LONG64)sequence;
+	InterlockedExchange64(&m_Header->published, (LONG64)sequence);
+	m_Sequence = sequence;
+
+	notify();
+	return S_OK;
+}
+
+/*!
+Publish depth, color and aligned images of pipeline \a frame .
+*/
+HRESULT KCV_publisher::publish(const KCV_frame &frame)
+{
+	return publish(frame.depth, frame.color, frame.alignedColor, frame.alignedDepth);
+}
+
+/*!
+Signal event of every registered subscriber.
+*/
+void KCV_publisher::notify()
+{
+	for (int i = 0; i < KCV_SHARED_MAX_SUBSCRIBERS; ++i)
+	{
+		LONG64 owner = m_Header->subscribers[i];
+		// subscriber creates its event after claiming the slot, retry until it exists
+		if (owner != m_Owners[i] || (owner != 0 && m_Events[i] == NULL))
+		{
+			if (m_Events[i] != NULL)
+				CloseHandle(m_Events[i]);
+			m_Events[i] = owner != 0 ? OpenEventW(EVENT_MODIFY_STATE, FALSE, eventName(m_Name, i).c_str()) : NULL;
+			m_Owners[i] = owner;
+		}
+		if (m_Events[i] != NULL)
+			SetEvent(m_Events[i]);
+	}
+}
+
+/*!
+Constructs a closed subscriber.
+*/
+KCV_subscriber::KCV_subscriber()
+	: m_Mapping(NULL), m_Header(NULL), m_Event(NULL), m_Index(-1), m_Last(0), m_Dropped(0)
+{
+}
+
+/*!
+Destructor.
+*/
+KCV_subscriber::~KCV_subscriber()
+{
+	close();
+}
+
+/*!
+Open shared ring \a name and register for frame notification.
+*/
+HRESULT KCV_subscriber::open(const std::wstring &name)
+{
+	close();
+
+	m_Mapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, mappingName(name).c_str());
+	if (m_Mapping == NULL)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	m_Header = reinterpret_cast<KCV_sharedHeader*>(MapViewOfFile(m_Mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0));
+	if (m_Header == NULL)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		close();
+		return hr;
+	}
+	MemoryBarrier();
+	if (memcmp(m_Header->magic, KCV_SHARED_MAGIC, sizeof(m_Header->magic)) != 0 || m_Header->version != KCV_SHARED_VERSION)
+	{
+		close();
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+
+	// claim a free subscriber slot, take over slots of dead processes when full,
+	// the process is part of the claimed value so a claimed slot is never seen without it
+	const LONG64 owner = subscriberOwner(InterlockedIncrement(&m_Header->nextToken), GetCurrentProcessId());
+	for (int i = 0; i < KCV_SHARED_MAX_SUBSCRIBERS && m_Index < 0; ++i)
+	{
+		if (InterlockedCompareExchange64(&m_Header->subscribers[i], owner, 0) == 0)
+			m_Index = i;
+	}
+	for (int i = 0; i < KCV_SHARED_MAX_SUBSCRIBERS && m_Index < 0; ++i)
+	{
+		LONG64 previous = m_Header->subscribers[i];
+		if (isAbandoned(previous) && InterlockedCompareExchange64(&m_Header->subscribers[i], owner, previous) == previous)
+			m_Index = i;
+	}
+	if (m_Index < 0)
+	{
+		close();
+		return HRESULT_FROM_WIN32(ERROR_BUSY);
+	}
+
+	m_Event = CreateEventW(NULL, FALSE, FALSE, eventName(name, m_Index).c_str());
+	if (m_Event == NULL)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		close();
+		return hr;
+	}
+
+	// deliver frames published from now on
+	m_Last = (unsigned long long)m_Header->published;
+	m_Dropped = 0;
+	return S_OK;
+}
+
+/*!
+Unregister and unmap the ring.
+*/
+void KCV_subscriber::close()
+{
+	if (m_Header != NULL && m_Index >= 0)
+	{
+		InterlockedExchange64(&m_Header->subscribers[m_Index], 0);
+	}
+	m_Index = -1;
+	if (m_Event != NULL)
+	{
+		CloseHandle(m_Event);
+		m_Event = NULL;
+	}
+	if (m_Header != NULL)
+	{
+		UnmapViewOfFile(m_Header);
+		m_Header = NULL;
+	}
+	if (m_Mapping != NULL)
+	{
+		CloseHandle(m_Mapping);
+		m_Mapping = NULL;
+	}
+}
+
+/*!
+Fill \a frame with views on slot of \a sequence , returns false when the slot holds another frame.
+*/
+bool KCV_subscriber::readSlot(unsigned long long sequence, KCV_sharedFrame &frame)
+{
+	KCV_sharedSlot *slot = slotAt(m_Header, sequence);
+	LONG64 end = slot->end;
+	MemoryBarrier();
+	LONG64 begin = slot->begin;
+	if ((unsigned long long)begin != sequence || (unsigned long long)end != sequence)
+	{
+		return false;
+	}
+
+	BYTE *base = reinterpret_cast<BYTE*>(slot);
+	cv::Mat *images[KCV_PLANE_COUNT] = { &frame.depth, &frame.color, &frame.alignedColor, &frame.alignedDepth };
+	for (int i = 0; i < KCV_PLANE_COUNT; ++i)
+	{
+		const KCV_sharedPlane &plane = m_Header->planes[i];
+		if (slot->planeMask & (1u << i))
+			*images[i] = cv::Mat(plane.rows, plane.cols, plane.type, base + plane.offset, plane.step);
+		else
+			images[i]->release();
+	}
+	frame.sequence = sequence;
+	frame.tick = slot->tick;
+	return true;
+}
+
+/*!
+Wait up to \a timeoutMs for the next unread frame and store views on it in \a frame .
+Frames overwritten before they were read are counted as dropped. Returns E_PENDING on timeout.
+*/
+HRESULT KCV_subscriber::waitFrame(KCV_sharedFrame &frame, DWORD timeoutMs)
+{
+	if (m_Header == NULL)
+	{
+		return E_FAIL;
+	}
+
+	const DWORD start = GetTickCount();
+	for (;;)
+	{
+		unsigned long long published = (unsigned long long)m_Header->published;
+		if (published > m_Last)
+		{
+			// the slot after the published one may be under write already
+			unsigned long long next = m_Last + 1;
+			unsigned long long oldest = published + 2 > m_Header->slotCount ? published + 2 - m_Header->slotCount : 1;
+			if (next < oldest)
+			{
+				m_Dropped += oldest - next;
+				next = oldest;
+			}
+			for (; next <= published; ++next)
+			{
+				if (readSlot(next, frame))
+				{
+					m_Last = next;
+					return S_OK;
+				}
+				m_Dropped++;
+			}
+			m_Last = published;
+			continue;
+		}
+
+		DWORD elapsed = GetTickCount() - start;
+		if (timeoutMs != INFINITE && elapsed >= timeoutMs)
+		{
+			return E_PENDING;
+		}
+		WaitForSingleObject(m_Event, timeoutMs == INFINITE ? INFINITE : timeoutMs - elapsed);
+	}
+}
+
+/*!
+Store views on the newest frame in \a frame , skipping unread ones. Returns E_PENDING when there is none.
+*/
+HRESULT KCV_subscriber::latestFrame(KCV_sharedFrame &frame)
+{
+	if (m_Header == NULL)
+	{
+		return E_FAIL;
+	}
+	unsigned long long published = (unsigned long long)m_Header->published;
+	if (published == 0 || !readSlot(published, frame))
+	{
+		return E_PENDING;
+	}
+	if (published > m_Last)
+	{
+		m_Dropped += published - m_Last - 1;
+		m_Last = published;
+	}
+	return S_OK;
+}
+
+/*!
+Returns if views in \a frame still show that frame. Check after use, the publisher overwrites old slots.
+*/
+bool KCV_subscriber::isValid(const KCV_sharedFrame &frame) const
+{
+	if (m_Header == NULL)
+	{
+		return false;
+	}
+	KCV_sharedSlot *slot = slotAt(m_Header, frame.sequence);
+	MemoryBarrier();
+	return (unsigned long long)slot->begin == frame.sequence && (unsigned long long)slot->end == frame.sequence;
+}
@@ -0,0 +1,133 @@
+//    File: Kinect2XShared.h
+
+#ifndef KCV_SHARED_H
+#define KCV_SHARED_H
+
+// Kinect2XShared.h
+
+#include <string>
+
+#include "Kinect2XPipeline.h"
+
+namespace kcv
+{
+	const UINT32 KCV_SHARED_VERSION = 3;
+	const int KCV_SHARED_MAX_SUBSCRIBERS = 8;
+
+	enum KCV_sharedPlaneType
+	{
+		KCV_PLANE_DEPTH = 0,
+		KCV_PLANE_COLOR,
+		KCV_PLANE_ALIGNED_COLOR,
+		KCV_PLANE_ALIGNED_DEPTH,
+		KCV_PLANE_COUNT
+	};
+
+	// Image plane inside of a ring slot
+	struct KCV_sharedPlane
+	{
+		INT32 rows;
+		INT32 cols;
+		INT32 type;
+		UINT32 step;
+		UINT64 offset;
+	};
+
+	// Ring slot header, begin and end carry the sequence written into the slot
+	struct KCV_sharedSlot
+	{
+		volatile LONG64 begin;
+		volatile LONG64 end;
+		INT64 tick;
+		UINT32 planeMask;
+		UINT32 reserved;
+	};
+
+	// Shared memory header, followed by the ring slots
+	struct KCV_sharedHeader
+	{
+		char magic[8];
+		UINT32 version;
+		UINT32 slotCount;
+		UINT64 slotSize;
+		UINT64 slotOffset;
+		KCV_sharedPlane planes[KCV_PLANE_COUNT];
+		volatile LONG64 published;
+		volatile LONG nextToken;
+		volatile LONG publisher;	// process of the publisher, 0 when none
+		volatile LONG64 subscribers[KCV_SHARED_MAX_SUBSCRIBERS];	// token << 32 | process of the subscriber, 0 when free
+	};
+
+	// Frame read from shared memory, images are views on the shared pages
+	struct KCV_sharedFrame
+	{
+		unsigned long long sequence;
+		INT64 tick;
+		cv::Mat depth;
+		cv::Mat color;
+		cv::Mat alignedColor;
+		cv::Mat alignedDepth;
+	};
+
+	class KCV_publisher
+	{
+	public:
+		KCV_publisher();
+		~KCV_publisher();
+
+		HRESULT create(const std::wstring &name, const cv::Size &depthSize, const cv::Size &colorSize, int slotCount = 4);
+		void close();
+		bool isOpen() const { return m_Header != NULL; }
+
+		HRESULT publish(const cv::Mat &depth, const cv::Mat &color, const cv::Mat &aligned_color, const cv::Mat &aligned_depth);
+		HRESULT publish(const KCV_frame &frame);
+		unsigned long long sequence() const { return m_Sequence; }
+
+	private:
+		KCV_publisher(const KCV_publisher&);
+		KCV_publisher& operator=(const KCV_publisher&);
+
+		void notify();
+
+		std::wstring m_Name;
+		HANDLE m_Mapping;
+		KCV_sharedHeader *m_Header;
+		unsigned long long m_Sequence;
+		bool m_Owner;
+
+		// Subscriber events, reopened when a subscriber slot changes owner
+		HANDLE m_Events[KCV_SHARED_MAX_SUBSCRIBERS];
+		LONG64 m_Owners[KCV_SHARED_MAX_SUBSCRIBERS];
+	};
+
+	class KCV_subscriber
+	{
+	public:
+		KCV_subscriber();
+		~KCV_subscriber();
+
+		HRESULT open(const std::wstring &name);
+		void close();
+		bool isOpen() const { return m_Header != NULL; }
+
+		HRESULT waitFrame(KCV_sharedFrame &frame, DWORD timeoutMs);
+		HRESULT latestFrame(KCV_sharedFrame &frame);
+		bool isValid(const KCV_sharedFrame &frame) const;
+		unsigned long long dropped() const { return m_Dropped; }
+
+	private:
+		KCV_subscriber(const KCV_subscriber&);
+		KCV_subscriber& operator=(const KCV_subscriber&);
+
+		bool readSlot(unsigned long long sequence, KCV_sharedFrame &frame);
+
+		HANDLE m_Mapping;
+		KCV_sharedHeader *m_Header;
+		HANDLE m_Event;
+		int m_Index;
+		unsigned long long m_Last;
+		unsigned long long m_Dropped;
+	};
+}
+
+#endif // KCV_SHARED_H
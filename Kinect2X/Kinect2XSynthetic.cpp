@@ -0,0 +1,271 @@
+//    File: Kinect2XSynthetic.cpp
+
+#include "Kinect2XSynthetic.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace kcv;
+
+/*!
+\class KCV_syntheticSource
+\brief The KCV_syntheticSource class renders depth, color and infrared frames of a sphere swinging in front of a wall.
+
+Frames have the sizes and formats of the device and come at its frame rate. Infrared falls off with the squared
+distance and the incidence angle and carries a fixed noise pattern, long exposure infrared is four times brighter.
+Grazing sphere pixels have no depth, as flying pixels are dropped by the device.
+
+The color camera is a pinhole shifted by a baseline along x, calibration() gives the matching depth to camera
+table and depth to color lut, so mapped synthetic frames line up like those of a calibrated device.
+*/
+
+namespace
+{
+	const int KCV_DEPTH_WIDTH = 512;
+	const int KCV_DEPTH_HEIGHT = 424;
+	const int KCV_COLOR_WIDTH = 1920;
+	const int KCV_COLOR_HEIGHT = 1080;
+
+	// Focal lengths in pixels, principal points are the image centers
+	const float KCV_DEPTH_FOCAL = 365.0f;
+	const float KCV_COLOR_FOCAL = 1060.0f;
+
+	// Color camera position along x relative to the depth camera, m
+	const float KCV_COLOR_BASELINE = 0.052f;
+
+	// Scene in m, y up
+	const float KCV_WALL_DEPTH = 3.0f;
+	const float KCV_SPHERE_RADIUS = 0.4f;
+	const float KCV_SPHERE_DEPTH = 2.0f;
+	const float KCV_SPHERE_SWING = 0.6f;
+
+	// Infrared of a wall facing the camera at 1 m
+	const float KCV_INFRARED_GAIN = 13500.0f;
+
+	const double KCV_FRAME_MS = 1000.0 / 30.0;
+
+	struct Hit
+	{
+		float z;		// depth along the optical axis
+		float cosine;	// cosine of the incidence angle
+		bool sphere;
+		float u, v;		// surface coordinates, m on the wall and unit vector on the sphere
+	};
+
+	// Trace ray (x, y, 1) from the camera
+	Hit trace(float x, float y, float sphereX)
+	{
+		Hit hit;
+		const float length = std::sqrt(x * x + y * y + 1.0f);
+
+		// |t * d - c|^2 = r^2 with d = (x, y, 1) and c = (sphereX, 0, depth)
+		const float a = x * x + y * y + 1.0f;
+		const float b = x * sphereX + KCV_SPHERE_DEPTH;
+		const float c = sphereX * sphereX + KCV_SPHERE_DEPTH * KCV_SPHERE_DEPTH - KCV_SPHERE_RADIUS * KCV_SPHERE_RADIUS;
+		const float discriminant = b * b - a * c;
+		if (discriminant > 0.0f)
+		{
+			const float t = (b - std::sqrt(discriminant)) / a;
+			const float nx = (t * x - sphereX) / KCV_SPHERE_RADIUS, ny = t * y / KCV_SPHERE_RADIUS, nz = (t - KCV_SPHERE_DEPTH) / KCV_SPHERE_RADIUS;
+			hit.z = t;
+			hit.cosine = -(nx * x + ny * y + nz) / length;
+			hit.sphere = true;
+			hit.u = nx;
+			hit.v = ny;
+			return hit;
+		}
+
+		hit.z = KCV_WALL_DEPTH;
+		hit.cosine = 1.0f / length;
+		hit.sphere = false;
+		hit.u = x * KCV_WALL_DEPTH;
+		hit.v = y * KCV_WALL_DEPTH;
+		return hit;
+	}
+
+	// Fixed pattern noise in [-1, 1] of pixel x, y
+	float noise(int x, int y)
+	{
+		unsigned int h = (unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u;
+		h ^= h >> 13;
+		h *= 0x5bd1e995u;
+		h ^= h >> 15;
+		return (h & 0xffff) / 32767.5f - 1.0f;
+	}
+
+	class KCV_depthBody : public cv::ParallelLoopBody
+	{
+	public:
+		KCV_depthBody(float sphereX, cv::Mat &depth, cv::Mat *infrared, cv::Mat *longExposure)
+			: m_SphereX(sphereX), m_Depth(depth), m_Infrared(infrared), m_LongExposure(longExposure)
+		{
+		}
+
+		void operator()(const cv::Range &range) const
+		{
+			for (int v = range.start; v < range.end; ++v)
+			{
+				UINT16 *p_Depth = m_Depth.ptr<UINT16>(v);
+				UINT16 *p_Infrared = m_Infrared != NULL ? m_Infrared->ptr<UINT16>(v) : NULL;
+				UINT16 *p_LongExposure = m_LongExposure != NULL ? m_LongExposure->ptr<UINT16>(v) : NULL;
+				for (int u = 0; u < KCV_DEPTH_WIDTH; ++u)
+				{
+					Hit hit = trace((u - KCV_DEPTH_WIDTH / 2) / KCV_DEPTH_FOCAL, (KCV_DEPTH_HEIGHT / 2 - v) / KCV_DEPTH_FOCAL, m_SphereX);
+					p_Depth[u] = hit.cosine > 0.1f ? (UINT16)(hit.z * 1000.0f + 0.5f) : 0;
+
+					float intensity = KCV_INFRARED_GAIN * (hit.sphere ? 1.5f : 1.0f) * hit.cosine / (hit.z * hit.z) * (1.0f + 0.02f * noise(u, v));
+					if (p_Infrared != NULL)
+						p_Infrared[u] = (UINT16)std::min(intensity, 65535.0f);
+					if (p_LongExposure != NULL)
+						p_LongExposure[u] = (UINT16)std::min(4.0f * intensity, 65535.0f);
+				}
+			}
+		}
+
+	private:
+		float m_SphereX;
+		cv::Mat &m_Depth;
+		cv::Mat *m_Infrared;
+		cv::Mat *m_LongExposure;
+	};
+
+	class KCV_colorBody : public cv::ParallelLoopBody
+	{
+	public:
+		KCV_colorBody(float sphereX, cv::Mat &color)
+			: m_SphereX(sphereX), m_Color(color)
+		{
+		}
+
+		void operator()(const cv::Range &range) const
+		{
+			for (int v = range.start; v < range.end; ++v)
+			{
+				RGBQUAD *p_Color = m_Color.ptr<RGBQUAD>(v);
+				for (int u = 0; u < KCV_COLOR_WIDTH; ++u)
+				{
+					// the scene is traced from the color camera, wall positions are moved back to the depth camera
+					Hit hit = trace((u - KCV_COLOR_WIDTH / 2) / KCV_COLOR_FOCAL, (KCV_COLOR_HEIGHT / 2 - v) / KCV_COLOR_FOCAL,
+						m_SphereX - KCV_COLOR_BASELINE);
+					if (!hit.sphere)
+						hit.u += KCV_COLOR_BASELINE;
+					RGBQUAD &pixel = p_Color[u];
+					pixel.rgbReserved = 255;
+					if (hit.sphere)
+					{
+						// red sphere, lit from the camera
+						pixel.rgbRed = (BYTE)(55.0f + 200.0f * hit.cosine);
+						pixel.rgbGreen = (BYTE)(40.0f * hit.cosine);
+						pixel.rgbBlue = (BYTE)(40.0f * hit.cosine);
+					}
+					else
+					{
+						// 20 cm checkerboard on the wall
+						bool dark = (((int)std::floor(hit.u * 5.0f) + (int)std::floor(hit.v * 5.0f)) & 1) != 0;
+						BYTE level = dark ? 70 : 200;
+						pixel.rgbRed = pixel.rgbGreen = pixel.rgbBlue = level;
+					}
+				}
+			}
+		}
+
+	private:
+		float m_SphereX;
+		cv::Mat &m_Color;
+	};
+}
+
+/*!
+Constructs source at the first frame.
+*/
+KCV_syntheticSource::KCV_syntheticSource()
+	: m_Frame(0), m_LastTick(0)
+{
+}
+
+/*!
+Restart the scene at the first frame.
+*/
+void KCV_syntheticSource::reset()
+{
+	m_Frame = 0;
+	m_LastTick = 0;
+}
+
+/*!
+Render the next frame to \a depth_frame (CV_16U) and, when set, \a color_frame (CV_8UC4), \a infrared_frame and
+\a long_exposure_frame (CV_16U). The storage of the images is reused when the size matches. Returns E_PENDING while
+the next frame is not due, as the device does.
+*/
+HRESULT KCV_syntheticSource::acquire(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat *infrared_frame,
+	cv::Mat *long_exposure_frame, bool acquire_color)
+{
+	int64 now = cv::getTickCount();
+	if (m_LastTick != 0 && (now - m_LastTick) * 1000.0 / cv::getTickFrequency() < KCV_FRAME_MS)
+	{
+		return E_PENDING;
+	}
+	m_LastTick = now;
+
+	const float sphereX = KCV_SPHERE_SWING * (float)std::sin(m_Frame * 0.05);
+	++m_Frame;
+
+	if (!depth_frame.isContinuous())
+		depth_frame.release();
+	depth_frame.create(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_16U);
+	if (infrared_frame != NULL)
+		infrared_frame->create(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_16U);
+	if (long_exposure_frame != NULL)
+		long_exposure_frame->create(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_16U);
+	KCV_depthBody depthBody(sphereX, depth_frame, infrared_frame, long_exposure_frame);
+	cv::parallel_for_(cv::Range(0, KCV_DEPTH_HEIGHT), depthBody, KCV_DEPTH_HEIGHT / 16.0);
+
+	if (acquire_color)
+	{
+		if (!color_frame.isContinuous())
+			color_frame.release();
+		color_frame.create(KCV_COLOR_HEIGHT, KCV_COLOR_WIDTH, CV_8UC4);
+		KCV_colorBody colorBody(sphereX, color_frame);
+		cv::parallel_for_(cv::Range(0, KCV_COLOR_HEIGHT), colorBody, KCV_COLOR_HEIGHT / 16.0);
+	}
+	return S_OK;
+}
+
+/*!
+Store the calibration of the synthetic cameras to \a calibration , keyed by KCV_SYNTHETIC_SERIAL.
+Depth (mm) maps to color as c = a + b / depth with the shift of the baseline in b.
+*/
+HRESULT KCV_syntheticSource::calibration(KCV_calibration &calibration) const
+{
+	const int count = KCV_DEPTH_WIDTH * KCV_DEPTH_HEIGHT;
+	std::vector<PointF> cameraTable(count);
+	std::vector<KCV_colorLut> colorLut(count);
+	for (int v = 0; v < KCV_DEPTH_HEIGHT; ++v)
+	{
+		for (int u = 0; u < KCV_DEPTH_WIDTH; ++u)
+		{
+			const int index = v * KCV_DEPTH_WIDTH + u;
+			PointF &point = cameraTable[index];
+			point.X = (u - KCV_DEPTH_WIDTH / 2) / KCV_DEPTH_FOCAL;
+			point.Y = (KCV_DEPTH_HEIGHT / 2 - v) / KCV_DEPTH_FOCAL;
+
+			KCV_colorLut &lut = colorLut[index];
+			lut.ax = KCV_COLOR_WIDTH / 2 + KCV_COLOR_FOCAL * point.X;
+			lut.bx = -KCV_COLOR_FOCAL * KCV_COLOR_BASELINE * 1000.0f;
+			lut.ay = KCV_COLOR_HEIGHT / 2 - KCV_COLOR_FOCAL * point.Y;
+			lut.by = 0.0f;
+		}
+	}
+
+	CameraIntrinsics intrinsics;
+	memset(&intrinsics, 0, sizeof(intrinsics));
+	intrinsics.FocalLengthX = KCV_DEPTH_FOCAL;
+	intrinsics.FocalLengthY = KCV_DEPTH_FOCAL;
+	intrinsics.PrincipalPointX = KCV_DEPTH_WIDTH / 2;
+	intrinsics.PrincipalPointY = KCV_DEPTH_HEIGHT / 2;
+
+	return calibration.assign(KCV_SYNTHETIC_SERIAL, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT,
+		intrinsics, cameraTable, colorLut);
+}
@@ -0,0 +1,40 @@
+//    File: Kinect2XSynthetic.h
+
+#ifndef KCV_SYNTHETIC_H
+#define KCV_SYNTHETIC_H
+
+// Kinect2XSynthetic.h
+
+// Kinect SDK
+#include <Kinect.h>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+#include "Kinect2XCalibration.h"
+
+namespace kcv
+{
+	// Serial of the calibration matching the synthetic frames
+	const WCHAR KCV_SYNTHETIC_SERIAL[] = L"synthetic";
+
+	// Frames of a deterministic scene in the formats of the device, used in place of the sensor
+	class KCV_syntheticSource
+	{
+	public:
+		KCV_syntheticSource();
+
+		void reset();
+		unsigned long long frames() const { return m_Frame; }
+
+		HRESULT acquire(cv::Mat &depth_frame, cv::Mat &color_frame, cv::Mat *infrared_frame,
+			cv::Mat *long_exposure_frame, bool acquire_color);
+		HRESULT calibration(KCV_calibration &calibration) const;
+
+	private:
+		unsigned long long m_Frame;
+		int64 m_LastTick;	// tick of the last frame, frames are paced to the device rate
+	};
+}
+
+#endif // KCV_SYNTHETIC_H
@@ -0,0 +1,1216 @@
+//    File: Kinect2XPython.cpp
+
+// Python module kcv, images are returned as NumPy arrays sharing memory with cv::Mat
+
+#include <Python.h>
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+
+#include "Kinect2X.h"
+
+using namespace kcv;
+
+namespace
+{
+	// numpy.asarray, arrays are created from our buffer objects
+	PyObject *g_AsArray = NULL;
+
+	// Buffer protocol exporter owning one cv::Mat reference
+	struct MatBuffer
+	{
+		PyObject_HEAD
+		cv::Mat *mat;
+		Py_ssize_t shape[3];
+		Py_ssize_t strides[3];
+	};
+
+	PyTypeObject MatBufferType = { PyVarObject_HEAD_INIT(NULL, 0) };
+	PyBufferProcs MatBufferProcs;
+
+	const char *formatOf(int depth)
+	{
+		switch (depth)
+		{
+		case CV_8U: return "B";
+		case CV_8S: return "b";
+		case CV_16U: return "H";
+		case CV_16S: return "h";
+		case CV_32S: return "i";
+		case CV_32F: return "f";
+		case CV_64F: return "d";
+		}
+		return NULL;
+	}
+
+	int MatBuffer_getbuffer(PyObject *self, Py_buffer *view, int flags)
+	{
+		MatBuffer *buffer = reinterpret_cast<MatBuffer*>(self);
+		const cv::Mat &mat = *buffer->mat;
+		if (!(flags & PyBUF_STRIDES) && !mat.isContinuous())
+		{
+			PyErr_SetString(PyExc_BufferError, "image is not contiguous");
+			return -1;
+		}
+
+		const int channels = mat.channels();
+		buffer->shape[0] = mat.rows;
+		buffer->shape[1] = mat.cols;
+		buffer->shape[2] = channels;
+		buffer->strides[0] = (Py_ssize_t)mat.step[0];
+		buffer->strides[1] = (Py_ssize_t)mat.elemSize();
+		buffer->strides[2] = (Py_ssize_t)mat.elemSize1();
+
+		view->obj = self;
+		Py_INCREF(self);
+		view->buf = mat.data;
+		view->len = (Py_ssize_t)(mat.total() * mat.elemSize());
+		view->readonly = 0;
+		view->itemsize = (Py_ssize_t)mat.elemSize1();
+		view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(formatOf(mat.depth())) : NULL;
+		view->ndim = channels > 1 ? 3 : 2;
+		view->shape = buffer->shape;
+		view->strides = buffer->strides;
+		view->suboffsets = NULL;
+		view->internal = NULL;
+		return 0;
+	}
+
+	void MatBuffer_dealloc(PyObject *self)
+	{
+		MatBuffer *buffer = reinterpret_cast<MatBuffer*>(self);
+		delete buffer->mat;
+		buffer->mat = NULL;
+		Py_TYPE(self)->tp_free(self);
+	}
+
+	// Wrap \a mat into a NumPy array without copying, the array keeps the data alive
+	PyObject *toArray(const cv::Mat &mat)
+	{
+		if (formatOf(mat.depth()) == NULL)
+		{
+			PyErr_SetString(PyExc_TypeError, "unsupported image type");
+			return NULL;
+		}
+		MatBuffer *buffer = PyObject_New(MatBuffer, &MatBufferType);
+		if (buffer == NULL)
+		{
+			return NULL;
+		}
+		buffer->mat = new cv::Mat(mat);
+		PyObject *array = PyObject_CallFunctionObjArgs(g_AsArray, reinterpret_cast<PyObject*>(buffer), NULL);
+		Py_DECREF(buffer);
+		return array;
+	}
+
+	// toArray of a stream image, None while the stream is off
+	PyObject *toStreamArray(const cv::Mat &mat)
+	{
+		if (mat.empty())
+			Py_RETURN_NONE;
+		return toArray(mat);
+	}
+
+	// Input array borrowed as cv::Mat header for the duration of a call
+	struct ArrayView
+	{
+		Py_buffer view;
+		bool held;
+		cv::Mat mat;
+
+		ArrayView() : held(false) {}
+		~ArrayView()
+		{
+			if (held)
+				PyBuffer_Release(&view);
+		}
+
+		bool open(PyObject *object, int depth, const char *name)
+		{
+			if (PyObject_GetBuffer(object, &view, PyBUF_STRIDES | PyBUF_FORMAT) != 0)
+			{
+				return false;
+			}
+			held = true;
+
+			const char *format = view.format != NULL ? view.format : "B";
+			if (format[0] == '<' || format[0] == '=' || format[0] == '@')
+				++format;
+			const int channels = view.ndim == 3 ? (int)view.shape[2] : 1;
+			// rows may be padded but must not overlap or run backwards, cv::Mat has no negative steps
+			if (strcmp(format, formatOf(depth)) != 0 || (view.ndim != 2 && view.ndim != 3) ||
+				view.strides[1] != view.itemsize * channels || (view.ndim == 3 && view.strides[2] != view.itemsize) ||
+				view.strides[0] < view.shape[1] * view.strides[1])
+			{
+				PyErr_Format(PyExc_ValueError, "%s has wrong type or layout", name);
+				return false;
+			}
+			mat = cv::Mat((int)view.shape[0], (int)view.shape[1], CV_MAKETYPE(depth, channels), view.buf, (size_t)view.strides[0]);
+			return true;
+		}
+	};
+
+	PyObject *failure(HRESULT hr)
+	{
+		PyErr_Format(PyExc_RuntimeError, "Kinect2X call failed with HRESULT 0x%08lx", (unsigned long)hr);
+		return NULL;
+	}
+
+	// Raise the C++ exception being handled as MemoryError or RuntimeError, exceptions must not reach the interpreter
+	PyObject *raised()
+	{
+		try
+		{
+			throw;
+		}
+		catch (const std::bad_alloc &)
+		{
+			PyErr_NoMemory();
+		}
+		catch (const std::exception &e)
+		{
+			PyErr_SetString(PyExc_RuntimeError, e.what());
+		}
+		catch (...)
+		{
+			PyErr_SetString(PyExc_RuntimeError, "unknown C++ exception");
+		}
+		return NULL;
+	}
+
+	// Entry points of the module, C++ exceptions of \a Function are raised in Python
+	template<PyObject *(*Function)(PyObject*, PyObject*)>
+	PyObject *guarded(PyObject *self, PyObject *args)
+	{
+		try
+		{
+			return Function(self, args);
+		}
+		catch (...)
+		{
+			return raised();
+		}
+	}
+
+	template<PyObject *(*Function)(PyObject*, PyObject*, PyObject*)>
+	PyObject *guardedKeywords(PyObject *self, PyObject *args, PyObject *kwargs)
+	{
+		try
+		{
+			return Function(self, args, kwargs);
+		}
+		catch (...)
+		{
+			return raised();
+		}
+	}
+
+	// Releases the GIL for its scope, it is taken back also when an exception leaves the scope
+	class GilRelease
+	{
+	public:
+		GilRelease() : m_State(PyEval_SaveThread()) {}
+		~GilRelease() { PyEval_RestoreThread(m_State); }
+
+	private:
+		GilRelease(const GilRelease&);
+		GilRelease& operator=(const GilRelease&);
+
+		PyThreadState *m_State;
+	};
+
+	bool toWide(PyObject *object, std::wstring &value)
+	{
+		wchar_t *text = PyUnicode_AsWideCharString(object, NULL);
+		if (text == NULL)
+			return false;
+		value = text;
+		PyMem_Free(text);
+		return true;
+	}
+
+	// Levels of \a pyramid as a list of arrays, level 0 borrows the inputs and is copied
+	PyObject *toList(const KCV_pyramid &pyramid, bool camera)
+	{
+		PyObject *list = PyList_New(pyramid.levels());
+		if (list == NULL)
+			return NULL;
+		for (int level = 0; level < pyramid.levels(); ++level)
+		{
+			const cv::Mat &mat = camera ? pyramid.camera(level) : pyramid.depth(level);
+			PyObject *array = toArray(level == 0 ? mat.clone() : mat);
+			if (array == NULL)
+			{
+				Py_DECREF(list);
+				return NULL;
+			}
+			PyList_SET_ITEM(list, level, array);
+		}
+		return list;
+	}
+
+	// Set by init_sensor before the sensor is created, false keeps the device closed
+	bool g_OpenDevice = true;
+
+	KCV_sensor *sensor()
+	{
+		return KCV_sensor::getInstance(g_OpenDevice);
+	}
+
+	// Depth background model owned by the caller, calls on one object run one at a time without holding the GIL
+	struct Background
+	{
+		PyObject_HEAD
+		KCV_background *model;
+		KCV_foreground *foreground;		// of the last segment, used by the foreground align methods
+		std::mutex *mutex;
+	};
+
+	PyTypeObject BackgroundType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+	// Runs of \a foreground as Nx4 int32 rows (y, begin, end, blob)
+	PyObject *toRunArray(const KCV_foreground &foreground)
+	{
+		cv::Mat runs((int)foreground.runs.size(), 4, CV_32S);
+		for (size_t i = 0; i < foreground.runs.size(); ++i)
+		{
+			const KCV_run &run = foreground.runs[i];
+			int *p_Row = runs.ptr<int>((int)i);
+			p_Row[0] = run.y;
+			p_Row[1] = run.begin;
+			p_Row[2] = run.end;
+			p_Row[3] = run.blob;
+		}
+		return toArray(runs);
+	}
+
+	// Blobs of \a foreground as Nx5 int32 rows (x, y, width, height, area)
+	PyObject *toBlobArray(const KCV_foreground &foreground)
+	{
+		cv::Mat blobs((int)foreground.blobs.size(), 5, CV_32S);
+		for (size_t i = 0; i < foreground.blobs.size(); ++i)
+		{
+			const KCV_blob &blob = foreground.blobs[i];
+			int *p_Row = blobs.ptr<int>((int)i);
+			p_Row[0] = blob.box.x;
+			p_Row[1] = blob.box.y;
+			p_Row[2] = blob.box.width;
+			p_Row[3] = blob.box.height;
+			p_Row[4] = blob.area;
+		}
+		return toArray(blobs);
+	}
+}
+
+/*!
+init_sensor(c_width=1920, c_height=1080, d_width=512, d_height=424, open_device=True) -> HRESULT,
+with open_device False the device is not touched, map_coordinates works after load_calibration(directory, serial)
+*/
+static PyObject *kcv_init_sensor(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "c_width", "c_height", "d_width", "d_height", "open_device", NULL };
+	int cWidth = 1920, cHeight = 1080, dWidth = 512, dHeight = 424, openDevice = 1;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|iiiip", keywords, &cWidth, &cHeight, &dWidth, &dHeight, &openDevice))
+		return NULL;
+	g_OpenDevice = openDevice != 0;
+	if (openDevice)
+		sensor()->openDevice();
+	return PyLong_FromLong(sensor()->initSensor(cWidth, cHeight, dWidth, dHeight));
+}
+
+/*!
+is_available() -> bool
+*/
+static PyObject *kcv_is_available(PyObject *, PyObject *)
+{
+	return PyBool_FromLong(sensor()->isAvailable());
+}
+
+/*!
+acquire_images(map=True, infrared=False) -> (depth, color) or None while no new frame is ready,
+(depth, color, infrared, long_exposure) with infrared, images of streams that are off are None
+*/
+static PyObject *kcv_acquire_images(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "map", "infrared", NULL };
+	int map = 1, infrared = 0;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|pp", keywords, &map, &infrared))
+		return NULL;
+
+	cv::Mat depth, color, infraredFrame, longExposure;
+	HRESULT hr;
+	{
+		GilRelease release;
+		if (infrared)
+			hr = map ? sensor()->acquireImages(depth, color, infraredFrame, longExposure)
+				: sensor()->acquireRawImages(depth, color, infraredFrame, longExposure);
+		else
+			hr = map ? sensor()->acquireImages(depth, color) : sensor()->acquireRawImages(depth, color);
+	}
+	if (FAILED(hr))
+		Py_RETURN_NONE;
+
+	PyObject *depthArray = toArray(depth);
+	PyObject *colorArray = depthArray != NULL ? toStreamArray(color) : NULL;
+	if (colorArray == NULL)
+	{
+		Py_XDECREF(depthArray);
+		return NULL;
+	}
+	if (!infrared)
+		return Py_BuildValue("(NN)", depthArray, colorArray);
+
+	PyObject *infraredArray = toStreamArray(infraredFrame);
+	PyObject *longExposureArray = infraredArray != NULL ? toStreamArray(longExposure) : NULL;
+	if (longExposureArray == NULL)
+	{
+		Py_DECREF(depthArray);
+		Py_DECREF(colorArray);
+		Py_XDECREF(infraredArray);
+		return NULL;
+	}
+	return Py_BuildValue("(NNNN)", depthArray, colorArray, infraredArray, longExposureArray);
+}
+
+/*!
+map_coordinates(depth, color_width=1920, color_height=1080) -> (color_coordinates, depth_coordinates, camera_coordinates)
+Works on recorded frames without the device once a calibration is loaded.
+*/
+static PyObject *kcv_map_coordinates(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "depth", "color_width", "color_height", NULL };
+	PyObject *depthObject = NULL;
+	int colorWidth = 1920, colorHeight = 1080;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ii", keywords, &depthObject, &colorWidth, &colorHeight))
+		return NULL;
+
+	ArrayView depth;
+	if (!depth.open(depthObject, CV_16U, "depth"))
+		return NULL;
+	if (!depth.mat.isContinuous())
+	{
+		PyErr_SetString(PyExc_ValueError, "depth must be contiguous");
+		return NULL;
+	}
+
+	cv::Mat colorCoordinates, depthCoordinates, cameraCoordinates;
+	HRESULT hr;
+	{
+		GilRelease release;
+		hr = sensor()->mapCoordinates(depth.mat, colorWidth, colorHeight, colorCoordinates, depthCoordinates, cameraCoordinates);
+	}
+	if (FAILED(hr))
+		return failure(hr);
+
+	PyObject *colorArray = toArray(colorCoordinates);
+	PyObject *depthArray = colorArray != NULL ? toArray(depthCoordinates) : NULL;
+	PyObject *cameraArray = depthArray != NULL ? toArray(cameraCoordinates) : NULL;
+	if (cameraArray == NULL)
+	{
+		Py_XDECREF(colorArray);
+		Py_XDECREF(depthArray);
+		return NULL;
+	}
+	return Py_BuildValue("(NNN)", colorArray, depthArray, cameraArray);
+}
+
+/*!
+align_color(color_coordinates, color) -> color aligned to the depth grid
+*/
+static PyObject *kcv_align_color(PyObject *, PyObject *args)
+{
+	PyObject *coordinatesObject = NULL, *colorObject = NULL;
+	if (!PyArg_ParseTuple(args, "OO", &coordinatesObject, &colorObject))
+		return NULL;
+
+	ArrayView coordinates, color;
+	if (!coordinates.open(coordinatesObject, CV_32F, "color_coordinates") || !color.open(colorObject, CV_8U, "color"))
+		return NULL;
+	if (coordinates.mat.channels() != 2 || color.mat.channels() != 4 || !coordinates.mat.isContinuous() || !color.mat.isContinuous())
+	{
+		PyErr_SetString(PyExc_ValueError, "expected contiguous HxWx2 coordinates and HxWx4 color");
+		return NULL;
+	}
+
+	cv::Mat aligned;
+	HRESULT hr;
+	{
+		GilRelease release;
+		hr = sensor()->alignColorFrame(coordinates.mat, color.mat, aligned);
+	}
+	if (FAILED(hr))
+		return failure(hr);
+	return toArray(aligned);
+}
+
+/*!
+align_rgbd(color_coordinates, depth, color, camera_coordinates=None, infrared=None) -> HxWx8 uint8 KCV_rgbd records,
+HxWx20 KCV_rgbdPoint records with camera coordinates
+*/
+static PyObject *kcv_align_rgbd(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "color_coordinates", "depth", "color", "camera_coordinates", "infrared", NULL };
+	PyObject *coordinatesObject = NULL, *depthObject = NULL, *colorObject = NULL, *cameraObject = NULL, *infraredObject = NULL;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|OO", keywords, &coordinatesObject, &depthObject, &colorObject, &cameraObject,
+		&infraredObject))
+		return NULL;
+
+	ArrayView coordinates, depth, color, camera, infrared;
+	const bool withCamera = cameraObject != NULL && cameraObject != Py_None;
+	const bool withInfrared = infraredObject != NULL && infraredObject != Py_None;
+	if (!coordinates.open(coordinatesObject, CV_32F, "color_coordinates") || !depth.open(depthObject, CV_16U, "depth") ||
+		!color.open(colorObject, CV_8U, "color") || (withCamera && !camera.open(cameraObject, CV_32F, "camera_coordinates")) ||
+		(withInfrared && !infrared.open(infraredObject, CV_16U, "infrared")))
+		return NULL;
+	if (coordinates.mat.channels() != 2 || color.mat.channels() != 4 || !coordinates.mat.isContinuous() || !color.mat.isContinuous() ||
+		depth.mat.size() != coordinates.mat.size())
+	{
+		PyErr_SetString(PyExc_ValueError, "expected contiguous HxWx2 coordinates, HxW depth and HxWx4 color");
+		return NULL;
+	}
+	if (withCamera && (camera.mat.channels() != 3 || !camera.mat.isContinuous() || camera.mat.size() != coordinates.mat.size()))
+	{
+		PyErr_SetString(PyExc_ValueError, "expected contiguous HxWx3 camera coordinates");
+		return NULL;
+	}
+	if (withInfrared && infrared.mat.size() != coordinates.mat.size())
+	{
+		PyErr_SetString(PyExc_ValueError, "expected HxW infrared");
+		return NULL;
+	}
+
+	cv::Mat rgbd;
+	HRESULT hr;
+	{
+		GilRelease release;
+		hr = sensor()->alignRGBDFrame(coordinates.mat, camera.mat, depth.mat, color.mat, rgbd, infrared.mat);
+	}
+	if (FAILED(hr))
+		return failure(hr);
+	return toArray(rgbd);
+}
+
+/*!
+align_depth(depth_coordinates, depth) -> depth aligned to the color grid
+*/
+static PyObject *kcv_align_depth(PyObject *, PyObject *args)
+{
+	PyObject *coordinatesObject = NULL, *depthObject = NULL;
+	if (!PyArg_ParseTuple(args, "OO", &coordinatesObject, &depthObject))
+		return NULL;
+
+	ArrayView coordinates, depth;
+	if (!coordinates.open(coordinatesObject, CV_32F, "depth_coordinates") || !depth.open(depthObject, CV_16U, "depth"))
+		return NULL;
+	if (coordinates.mat.channels() != 2 || !coordinates.mat.isContinuous() || !depth.mat.isContinuous())
+	{
+		PyErr_SetString(PyExc_ValueError, "expected contiguous HxWx2 coordinates and HxW depth");
+		return NULL;
+	}
+
+	cv::Mat aligned;
+	HRESULT hr;
+	{
+		GilRelease release;
+		hr = sensor()->alignDepthFrame(coordinates.mat, depth.mat, aligned);
+	}
+	if (FAILED(hr))
+		return failure(hr);
+	return toArray(aligned);
+}
+
+/*!
+align_color_frame(depth, color) -> color aligned to the depth grid with the last published mapping, None while none is color mapped
+*/
+static PyObject *kcv_align_color_frame(PyObject *, PyObject *args)
+{
+	PyObject *depthObject = NULL, *colorObject = NULL;
+	if (!PyArg_ParseTuple(args, "OO", &depthObject, &colorObject))
+		return NULL;
+
+	ArrayView depth, color;
+	if (!depth.open(depthObject, CV_16U, "depth") || !color.open(colorObject, CV_8U, "color"))
+		return NULL;
+	if (color.mat.channels() != 4 || !depth.mat.isContinuous() || !color.mat.isContinuous())
+	{
+		PyErr_SetString(PyExc_ValueError, "expected contiguous HxW depth and HxWx4 color");
+		return NULL;
+	}
+	// the mapping buffers hold one 512x424 depth and one 1920x1080 color frame
+	if (depth.mat.cols != 512 || depth.mat.rows != 424 || color.mat.cols != 1920 || color.mat.rows != 1080)
+	{
+		PyErr_SetString(PyExc_ValueError, "expected 424x512 depth and 1080x1920x4 color");
+		return NULL;
+	}
+
+	cv::Mat aligned;
+	HRESULT hr;
+	{
+		GilRelease release;
+		hr = sensor()->alignColorFrame(reinterpret_cast<const UINT16*>(depth.mat.data), depth.mat.cols, depth.mat.rows,
+			reinterpret_cast<const RGBQUAD*>(color.mat.data), color.mat.cols, color.mat.rows, aligned);
+	}
+	if (hr == E_PENDING)
+		Py_RETURN_NONE;
+	if (FAILED(hr))
+		return failure(hr);
+	return toArray(aligned);
+}
+
+/*!
+align_depth_frame(depth, color_width=1920, color_height=1080) -> depth aligned to the color grid with the last published mapping, None while none is color mapped
+*/
+static PyObject *kcv_align_depth_frame(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "depth", "color_width", "color_height", NULL };
+	PyObject *depthObject = NULL;
+	int colorWidth = 1920, colorHeight = 1080;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ii", keywords, &depthObject, &colorWidth, &colorHeight))
+		return NULL;
+
+	ArrayView depth;
+	if (!depth.open(depthObject, CV_16U, "depth"))
+		return NULL;
+	if (!depth.mat.isContinuous())
+	{
+		PyErr_SetString(PyExc_ValueError, "depth must be contiguous");
+		return NULL;
+	}
+	// the mapping buffers hold one 512x424 depth and one 1920x1080 color frame
+	if (depth.mat.cols != 512 || depth.mat.rows != 424 || colorWidth != 1920 || colorHeight != 1080)
+	{
+		PyErr_SetString(PyExc_ValueError, "expected 424x512 depth and a 1920x1080 color grid");
+		return NULL;
+	}
+
+	cv::Mat aligned;
+	HRESULT hr;
+	{
+		GilRelease release;
+		hr = sensor()->alignDepthFrame(reinterpret_cast<const UINT16*>(depth.mat.data), depth.mat.cols, depth.mat.rows,
+			colorWidth, colorHeight, aligned);
+	}
+	if (hr == E_PENDING)
+		Py_RETURN_NONE;
+	if (FAILED(hr))
+		return failure(hr);
+	return toArray(aligned);
+}
+
+/*!
+visualise_depth(depth) -> BGR visualisation
+*/
+static PyObject *kcv_visualise_depth(PyObject *, PyObject *args)
+{
+	PyObject *depthObject = NULL;
+	if (!PyArg_ParseTuple(args, "O", &depthObject))
+		return NULL;
+
+	ArrayView depth;
+	if (!depth.open(depthObject, CV_16U, "depth"))
+		return NULL;
+
+	cv::Mat vis;
+	{
+		GilRelease release;
+		sensor()->visualiseDepthMap(depth.mat, vis);
+	}
+	return toArray(vis);
+}
+
+/*!
+get_point_in_depth(x, y, color_width=1920, color_height=1080, depth_width=512, depth_height=424) -> (x, y) or None
+*/
+static PyObject *kcv_get_point_in_depth(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "x", "y", "color_width", "color_height", "depth_width", "depth_height", NULL };
+	int x = 0, y = 0, colorWidth = 1920, colorHeight = 1080, depthWidth = 512, depthHeight = 424;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|iiii", keywords, &x, &y, &colorWidth, &colorHeight, &depthWidth, &depthHeight))
+		return NULL;
+
+	cv::Point depthPoint;
+	if (!sensor()->getPointInDepth(cv::Point(x, y), colorWidth, colorHeight, depthWidth, depthHeight, depthPoint))
+		Py_RETURN_NONE;
+	return Py_BuildValue("(ii)", depthPoint.x, depthPoint.y);
+}
+
+/*!
+get_point_in_real(x, y, depth_width=512, depth_height=424) -> (X, Y, Z) or None
+*/
+static PyObject *kcv_get_point_in_real(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "x", "y", "depth_width", "depth_height", NULL };
+	int x = 0, y = 0, depthWidth = 512, depthHeight = 424;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|ii", keywords, &x, &y, &depthWidth, &depthHeight))
+		return NULL;
+
+	cv::Point3f realPoint;
+	if (!sensor()->getPointInReal(cv::Point(x, y), depthWidth, depthHeight, realPoint))
+		Py_RETURN_NONE;
+	return Py_BuildValue("(fff)", realPoint.x, realPoint.y, realPoint.z);
+}
+
+/*!
+get_point_from_real(X, Y, Z, depth_width=512, depth_height=424) -> (x, y) or None
+*/
+static PyObject *kcv_get_point_from_real(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "X", "Y", "Z", "depth_width", "depth_height", NULL };
+	float X = 0.0f, Y = 0.0f, Z = 0.0f;
+	int depthWidth = 512, depthHeight = 424;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "fff|ii", keywords, &X, &Y, &Z, &depthWidth, &depthHeight))
+		return NULL;
+
+	cv::Point depthPoint;
+	if (!sensor()->getPointFromReal(cv::Point3f(X, Y, Z), depthWidth, depthHeight, depthPoint))
+		Py_RETURN_NONE;
+	return Py_BuildValue("(ii)", depthPoint.x, depthPoint.y);
+}
+
+/*!
+load_calibration(directory, serial="") -> HRESULT
+*/
+static PyObject *kcv_load_calibration(PyObject *, PyObject *args)
+{
+	PyObject *directoryObject = NULL, *serialObject = NULL;
+	if (!PyArg_ParseTuple(args, "U|U", &directoryObject, &serialObject))
+		return NULL;
+
+	std::wstring directory, serial;
+	if (!toWide(directoryObject, directory) || (serialObject != NULL && !toWide(serialObject, serial)))
+		return NULL;
+	return PyLong_FromLong(sensor()->loadCalibration(directory, serial));
+}
+
+/*!
+build_calibration() -> HRESULT
+*/
+static PyObject *kcv_build_calibration(PyObject *, PyObject *)
+{
+	return PyLong_FromLong(sensor()->buildCalibration());
+}
+
+/*!
+save_calibration(directory) -> HRESULT
+*/
+static PyObject *kcv_save_calibration(PyObject *, PyObject *args)
+{
+	PyObject *directoryObject = NULL;
+	if (!PyArg_ParseTuple(args, "U", &directoryObject))
+		return NULL;
+
+	std::wstring directory;
+	if (!toWide(directoryObject, directory))
+		return NULL;
+	return PyLong_FromLong(sensor()->saveCalibration(directory));
+}
+
+/*!
+estimate_normals(camera_coordinates, radius=2, curvature=False) -> normals or (normals, curvature)
+*/
+static PyObject *kcv_estimate_normals(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "camera_coordinates", "radius", "curvature", NULL };
+	PyObject *coordinatesObject = NULL;
+	int radius = 2, withCurvature = 0;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ip", keywords, &coordinatesObject, &radius, &withCurvature))
+		return NULL;
+
+	ArrayView coordinates;
+	if (!coordinates.open(coordinatesObject, CV_32F, "camera_coordinates"))
+		return NULL;
+	if (coordinates.mat.channels() != 3)
+	{
+		PyErr_SetString(PyExc_ValueError, "expected HxWx3 camera coordinates");
+		return NULL;
+	}
+
+	KCV_normals estimator(radius);
+	cv::Mat normals, curvature;
+	HRESULT hr;
+	{
+		GilRelease release;
+		if (withCurvature)
+			hr = estimator.compute(coordinates.mat, normals, curvature);
+		else
+			hr = estimator.compute(coordinates.mat, normals);
+	}
+	if (FAILED(hr))
+		return failure(hr);
+
+	PyObject *normalArray = toArray(normals);
+	if (!withCurvature || normalArray == NULL)
+		return normalArray;
+	PyObject *curvatureArray = toArray(curvature);
+	if (curvatureArray == NULL)
+	{
+		Py_DECREF(normalArray);
+		return NULL;
+	}
+	return Py_BuildValue("(NN)", normalArray, curvatureArray);
+}
+
+/*!
+depth_pyramid(depth, levels=3, mode="min", camera_coordinates=None) -> depth levels or (depth levels, camera levels)
+*/
+static PyObject *kcv_depth_pyramid(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "depth", "levels", "mode", "camera_coordinates", NULL };
+	PyObject *depthObject = NULL, *coordinatesObject = NULL;
+	int levels = 3;
+	const char *modeName = "min";
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|isO", keywords, &depthObject, &levels, &modeName, &coordinatesObject))
+		return NULL;
+
+	KCV_pyramidMode mode;
+	if (strcmp(modeName, "min") == 0)
+		mode = KCV_PYRAMID_MIN;
+	else if (strcmp(modeName, "median") == 0)
+		mode = KCV_PYRAMID_MEDIAN;
+	else if (strcmp(modeName, "mean") == 0)
+		mode = KCV_PYRAMID_MEAN;
+	else
+	{
+		PyErr_SetString(PyExc_ValueError, "mode must be min, median or mean");
+		return NULL;
+	}
+
+	ArrayView depth, coordinates;
+	const bool withCamera = coordinatesObject != NULL && coordinatesObject != Py_None;
+	if (!depth.open(depthObject, CV_16U, "depth") || (withCamera && !coordinates.open(coordinatesObject, CV_32F, "camera_coordinates")))
+		return NULL;
+	if (withCamera && coordinates.mat.channels() != 3)
+	{
+		PyErr_SetString(PyExc_ValueError, "expected HxWx3 camera coordinates");
+		return NULL;
+	}
+	// every level halves the size, the last one keeps at least one pixel
+	int maxLevels = 1;
+	for (int size = std::min(depth.mat.rows, depth.mat.cols); size >= 2; size /= 2)
+		++maxLevels;
+	if (levels < 1 || levels > maxLevels)
+	{
+		PyErr_Format(PyExc_ValueError, "levels must be between 1 and %d", maxLevels);
+		return NULL;
+	}
+
+	KCV_pyramid pyramid(levels, mode);
+	HRESULT hr;
+	{
+		GilRelease release;
+		hr = pyramid.build(depth.mat, coordinates.mat);
+	}
+	if (FAILED(hr))
+		return failure(hr);
+
+	PyObject *depthList = toList(pyramid, false);
+	if (!withCamera || depthList == NULL)
+		return depthList;
+	PyObject *cameraList = toList(pyramid, true);
+	if (cameraList == NULL)
+	{
+		Py_DECREF(depthList);
+		return NULL;
+	}
+	return Py_BuildValue("(NN)", depthList, cameraList);
+}
+
+/*!
+set_frame_budget(ms, color_interval=2) -> None, 0 ms processes every frame in full
+*/
+static PyObject *kcv_set_frame_budget(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "ms", "color_interval", NULL };
+	double ms = 0.0;
+	int colorInterval = 2;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "d|i", keywords, &ms, &colorInterval))
+		return NULL;
+	sensor()->getBudget().setColorInterval(colorInterval);
+	sensor()->getBudget().setBudget(ms);
+	Py_RETURN_NONE;
+}
+
+/*!
+budget_counters() -> dict with level, smoothed costs in ms and decision counters
+*/
+static PyObject *kcv_budget_counters(PyObject *, PyObject *)
+{
+	KCV_budgetCounters c = sensor()->getBudget().getCounters();
+	return Py_BuildValue("{s:i,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+		"level", c.level,
+		"frame_ms", c.frameMs,
+		"acquire_ms", c.costMs[KCV_COST_ACQUIRE],
+		"depth_to_color_ms", c.costMs[KCV_COST_DEPTH_TO_COLOR],
+		"color_to_depth_ms", c.costMs[KCV_COST_COLOR_TO_DEPTH],
+		"depth_to_camera_ms", c.costMs[KCV_COST_DEPTH_TO_CAMERA],
+		"normals_ms", c.costMs[KCV_COST_NORMALS],
+		"align_ms", c.costMs[KCV_COST_ALIGN],
+		"frames", c.frames,
+		"overruns", c.overruns,
+		"degradations", c.degradations,
+		"recoveries", c.recoveries,
+		"skipped_color_to_depth", c.skippedColorToDepth,
+		"skipped_color_frames", c.skippedColorFrames,
+		"reduced_alignments", c.reducedAlignments);
+}
+
+/*!
+set_frame_sources(color=True, infrared=False, long_exposure=False) -> None, depth is always read
+*/
+static PyObject *kcv_set_frame_sources(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "color", "infrared", "long_exposure", NULL };
+	int color = 1, infrared = 0, longExposure = 0;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ppp", keywords, &color, &infrared, &longExposure))
+		return NULL;
+
+	DWORD sources = FrameSourceTypes::FrameSourceTypes_Depth;
+	if (color)
+		sources |= FrameSourceTypes::FrameSourceTypes_Color;
+	if (infrared)
+		sources |= FrameSourceTypes::FrameSourceTypes_Infrared;
+	if (longExposure)
+		sources |= FrameSourceTypes::FrameSourceTypes_LongExposureInfrared;
+	HRESULT hr = sensor()->setFrameSources(sources);
+	if (FAILED(hr))
+		return failure(hr);
+	Py_RETURN_NONE;
+}
+
+/*!
+set_synthetic(enabled) -> None, frames of a synthetic scene in place of the device and their calibration in place of a loaded one
+*/
+static PyObject *kcv_set_synthetic(PyObject *, PyObject *args)
+{
+	int enabled = 0;
+	if (!PyArg_ParseTuple(args, "p", &enabled))
+		return NULL;
+	sensor()->setSynthetic(enabled != 0);
+	Py_RETURN_NONE;
+}
+
+/*!
+normalize_infrared(infrared, low=0, high=65535, gamma=1.0) -> uint8 image
+*/
+static PyObject *kcv_normalize_infrared(PyObject *, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "infrared", "low", "high", "gamma", NULL };
+	PyObject *infraredObject = NULL;
+	int low = 0, high = USHRT_MAX;
+	float gamma = 1.0f;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iif", keywords, &infraredObject, &low, &high, &gamma))
+		return NULL;
+	if (low < 0 || high < 0 || low > USHRT_MAX || high > USHRT_MAX)
+	{
+		PyErr_SetString(PyExc_ValueError, "low and high must be in 0 to 65535");
+		return NULL;
+	}
+
+	ArrayView infrared;
+	if (!infrared.open(infraredObject, CV_16U, "infrared"))
+		return NULL;
+	if (infrared.mat.channels() != 1)
+	{
+		PyErr_SetString(PyExc_ValueError, "expected HxW infrared");
+		return NULL;
+	}
+
+	KCV_infrared normalization((UINT16)low, (UINT16)high, gamma);
+	cv::Mat normalized;
+	HRESULT hr;
+	{
+		GilRelease release;
+		hr = normalization.normalize(infrared.mat, normalized);
+	}
+	if (FAILED(hr))
+		return failure(hr);
+	return toArray(normalized);
+}
+
+static PyObject *Background_new(PyTypeObject *type, PyObject *, PyObject *)
+{
+	Background *background = reinterpret_cast<Background*>(type->tp_alloc(type, 0));
+	if (background == NULL)
+		return NULL;
+	try
+	{
+		background->model = new KCV_background();
+		background->foreground = new KCV_foreground();
+		background->mutex = new std::mutex();
+	}
+	catch (...)
+	{
+		// members are zeroed by tp_alloc, dealloc deletes those created
+		Py_DECREF(background);
+		return raised();
+	}
+	return reinterpret_cast<PyObject*>(background);
+}
+
+static void Background_dealloc(PyObject *self)
+{
+	Background *background = reinterpret_cast<Background*>(self);
+	delete background->model;
+	delete background->foreground;
+	delete background->mutex;
+	Py_TYPE(self)->tp_free(self);
+}
+
+/*!
+Background(learn_frames=30, rate=0.01, deviations=2.0, margin=30.0, min_blob_area=64)
+*/
+static int Background_init(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "learn_frames", "rate", "deviations", "margin", "min_blob_area", NULL };
+	int learnFrames = 30, minBlobArea = 64;
+	float rate = 0.01f, deviations = 2.0f, margin = 30.0f;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ifffi", keywords, &learnFrames, &rate, &deviations, &margin, &minBlobArea))
+		return -1;
+
+	Background *background = reinterpret_cast<Background*>(self);
+	try
+	{
+		GilRelease release;
+		std::lock_guard<std::mutex> lock(*background->mutex);
+		*background->model = KCV_background(learnFrames, rate, deviations, margin, minBlobArea);
+		*background->foreground = KCV_foreground();
+	}
+	catch (...)
+	{
+		raised();
+		return -1;
+	}
+	return 0;
+}
+
+/*!
+reset() -> None, forget the background, the next frames are learned again
+*/
+static PyObject *Background_reset(PyObject *self, PyObject *)
+{
+	Background *background = reinterpret_cast<Background*>(self);
+	{
+		GilRelease release;
+		std::lock_guard<std::mutex> lock(*background->mutex);
+		background->model->reset();
+		*background->foreground = KCV_foreground();
+	}
+	Py_RETURN_NONE;
+}
+
+/*!
+segment(depth, update=True) -> (mask, runs, blobs), runs are Nx4 int32 (y, begin, end, blob),
+blobs Nx5 int32 (x, y, width, height, area)
+*/
+static PyObject *Background_segment(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "depth", "update", NULL };
+	PyObject *depthObject = NULL;
+	int update = 1;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|p", keywords, &depthObject, &update))
+		return NULL;
+
+	ArrayView depth;
+	if (!depth.open(depthObject, CV_16U, "depth"))
+		return NULL;
+	if (depth.mat.channels() != 1)
+	{
+		PyErr_SetString(PyExc_ValueError, "expected HxW depth");
+		return NULL;
+	}
+
+	Background *background = reinterpret_cast<Background*>(self);
+	KCV_foreground result;
+	HRESULT hr;
+	{
+		GilRelease release;
+		std::lock_guard<std::mutex> lock(*background->mutex);
+		hr = background->model->apply(depth.mat, *background->foreground, update != 0);
+		// the foreground is reused by the next frame
+		if (SUCCEEDED(hr))
+		{
+			result.mask = background->foreground->mask.clone();
+			result.runs = background->foreground->runs;
+			result.blobs = background->foreground->blobs;
+		}
+	}
+	if (FAILED(hr))
+		return failure(hr);
+
+	PyObject *maskArray = toArray(result.mask);
+	PyObject *runArray = maskArray != NULL ? toRunArray(result) : NULL;
+	PyObject *blobArray = runArray != NULL ? toBlobArray(result) : NULL;
+	if (blobArray == NULL)
+	{
+		Py_XDECREF(maskArray);
+		Py_XDECREF(runArray);
+		return NULL;
+	}
+	return Py_BuildValue("(NNN)", maskArray, runArray, blobArray);
+}
+
+/*!
+align_color(color_coordinates, color) -> color aligned to the foreground of the last segment
+*/
+static PyObject *Background_alignColor(PyObject *self, PyObject *args)
+{
+	PyObject *coordinatesObject = NULL, *colorObject = NULL;
+	if (!PyArg_ParseTuple(args, "OO", &coordinatesObject, &colorObject))
+		return NULL;
+
+	ArrayView coordinates, color;
+	if (!coordinates.open(coordinatesObject, CV_32F, "color_coordinates") || !color.open(colorObject, CV_8U, "color"))
+		return NULL;
+	if (coordinates.mat.channels() != 2 || color.mat.channels() != 4 || !coordinates.mat.isContinuous())
+	{
+		PyErr_SetString(PyExc_ValueError, "expected contiguous HxWx2 coordinates and HxWx4 color");
+		return NULL;
+	}
+
+	Background *background = reinterpret_cast<Background*>(self);
+	// a new output is zeroed, only the foreground is written
+	cv::Mat aligned;
+	bool segmented;
+	HRESULT hr = S_OK;
+	{
+		GilRelease release;
+		std::lock_guard<std::mutex> lock(*background->mutex);
+		segmented = coordinates.mat.size() == background->foreground->mask.size();
+		if (segmented)
+			hr = sensor()->alignColorFrame(*background->foreground, coordinates.mat, color.mat, aligned);
+	}
+	if (!segmented)
+	{
+		PyErr_SetString(PyExc_ValueError, "coordinates are not of the segmented depth");
+		return NULL;
+	}
+	if (FAILED(hr))
+		return failure(hr);
+	return toArray(aligned);
+}
+
+/*!
+align_depth(depth_coordinates, color_coordinates, depth) -> foreground depth of the last segment aligned to the color grid
+*/
+static PyObject *Background_alignDepth(PyObject *self, PyObject *args)
+{
+	PyObject *depthCoordinatesObject = NULL, *colorCoordinatesObject = NULL, *depthObject = NULL;
+	if (!PyArg_ParseTuple(args, "OOO", &depthCoordinatesObject, &colorCoordinatesObject, &depthObject))
+		return NULL;
+
+	ArrayView depthCoordinates, colorCoordinates, depth;
+	if (!depthCoordinates.open(depthCoordinatesObject, CV_32F, "depth_coordinates") ||
+		!colorCoordinates.open(colorCoordinatesObject, CV_32F, "color_coordinates") || !depth.open(depthObject, CV_16U, "depth"))
+		return NULL;
+	if (depthCoordinates.mat.channels() != 2 || colorCoordinates.mat.channels() != 2 ||
+		!depthCoordinates.mat.isContinuous() || !colorCoordinates.mat.isContinuous())
+	{
+		PyErr_SetString(PyExc_ValueError, "expected contiguous HxWx2 coordinates");
+		return NULL;
+	}
+
+	Background *background = reinterpret_cast<Background*>(self);
+	// a new output is zeroed, only the foreground is written
+	cv::Mat aligned;
+	bool segmented;
+	HRESULT hr = S_OK;
+	{
+		GilRelease release;
+		std::lock_guard<std::mutex> lock(*background->mutex);
+		segmented = colorCoordinates.mat.size() == background->foreground->mask.size() &&
+			depth.mat.size() == background->foreground->mask.size();
+		if (segmented)
+			hr = sensor()->alignDepthFrame(*background->foreground, depthCoordinates.mat, colorCoordinates.mat, depth.mat, aligned);
+	}
+	if (!segmented)
+	{
+		PyErr_SetString(PyExc_ValueError, "coordinates and depth are not of the segmented frame");
+		return NULL;
+	}
+	if (FAILED(hr))
+		return failure(hr);
+	return toArray(aligned);
+}
+
+static PyMethodDef Background_methods[] =
+{
+	{ "reset", guarded<Background_reset>, METH_NOARGS, "Forget the depth background." },
+	{ "segment", (PyCFunction)guardedKeywords<Background_segment>, METH_VARARGS | METH_KEYWORDS, "Foreground mask, runs and blobs of a depth frame." },
+	{ "align_color", guarded<Background_alignColor>, METH_VARARGS, "Align color to the depth grid on the last foreground only." },
+	{ "align_depth", guarded<Background_alignDepth>, METH_VARARGS, "Align foreground depth to the color grid." },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyMethodDef kcv_methods[] =
+{
+	{ "init_sensor", (PyCFunction)guardedKeywords<kcv_init_sensor>, METH_VARARGS | METH_KEYWORDS, "Allocate mapping buffers for given color and depth sizes." },
+	{ "is_available", guarded<kcv_is_available>, METH_NOARGS, "Returns if the sensor is available." },
+	{ "acquire_images", (PyCFunction)guardedKeywords<kcv_acquire_images>, METH_VARARGS | METH_KEYWORDS, "Acquire depth, color and optionally infrared, None while no new frame is ready." },
+	{ "map_coordinates", (PyCFunction)guardedKeywords<kcv_map_coordinates>, METH_VARARGS | METH_KEYWORDS, "Map a depth frame to color, depth and camera coordinates." },
+	{ "align_color", guarded<kcv_align_color>, METH_VARARGS, "Align color to the depth grid with per frame coordinates." },
+	{ "align_depth", guarded<kcv_align_depth>, METH_VARARGS, "Align depth to the color grid with per frame coordinates." },
+	{ "align_rgbd", (PyCFunction)guardedKeywords<kcv_align_rgbd>, METH_VARARGS | METH_KEYWORDS, "Depth, color, infrared and camera coordinates as one record per depth pixel." },
+	{ "align_color_frame", guarded<kcv_align_color_frame>, METH_VARARGS, "Align color to the depth grid with the last mapping." },
+	{ "align_depth_frame", (PyCFunction)guardedKeywords<kcv_align_depth_frame>, METH_VARARGS | METH_KEYWORDS, "Align depth to the color grid with the last mapping." },
+	{ "visualise_depth", guarded<kcv_visualise_depth>, METH_VARARGS, "Colorize a depth frame." },
+	{ "get_point_in_depth", (PyCFunction)guardedKeywords<kcv_get_point_in_depth>, METH_VARARGS | METH_KEYWORDS, "Depth pixel of a color pixel." },
+	{ "get_point_in_real", (PyCFunction)guardedKeywords<kcv_get_point_in_real>, METH_VARARGS | METH_KEYWORDS, "Camera space point of a depth pixel." },
+	{ "get_point_from_real", (PyCFunction)guardedKeywords<kcv_get_point_from_real>, METH_VARARGS | METH_KEYWORDS, "Depth pixel of a camera space point." },
+	{ "load_calibration", guarded<kcv_load_calibration>, METH_VARARGS, "Load calibration cache for offline mapping." },
+	{ "build_calibration", guarded<kcv_build_calibration>, METH_NOARGS, "Build calibration cache from the device." },
+	{ "save_calibration", guarded<kcv_save_calibration>, METH_VARARGS, "Save calibration cache." },
+	{ "estimate_normals", (PyCFunction)guardedKeywords<kcv_estimate_normals>, METH_VARARGS | METH_KEYWORDS, "Normals and curvature of camera coordinates." },
+	{ "depth_pyramid", (PyCFunction)guardedKeywords<kcv_depth_pyramid>, METH_VARARGS | METH_KEYWORDS, "Invalid aware depth and camera coordinate pyramid." },
+	{ "set_frame_budget", (PyCFunction)guardedKeywords<kcv_set_frame_budget>, METH_VARARGS | METH_KEYWORDS, "Set frame budget of acquire_images in ms." },
+	{ "budget_counters", guarded<kcv_budget_counters>, METH_NOARGS, "Frame budget level, costs and decisions." },
+	{ "set_frame_sources", (PyCFunction)guardedKeywords<kcv_set_frame_sources>, METH_VARARGS | METH_KEYWORDS, "Enable color, infrared and long exposure infrared streams." },
+	{ "set_synthetic", guarded<kcv_set_synthetic>, METH_VARARGS, "Acquire frames of a synthetic scene in place of the device." },
+	{ "normalize_infrared", (PyCFunction)guardedKeywords<kcv_normalize_infrared>, METH_VARARGS | METH_KEYWORDS, "Clip and gamma correct infrared to 8 bit." },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyModuleDef kcv_module =
+{
+	PyModuleDef_HEAD_INIT, "kcv", "Kinect v2 frames as NumPy arrays.", -1, kcv_methods
+};
+
+PyMODINIT_FUNC PyInit_kcv()
+{
+	MatBufferProcs.bf_getbuffer = MatBuffer_getbuffer;
+	MatBufferProcs.bf_releasebuffer = NULL;
+	MatBufferType.tp_name = "kcv.MatBuffer";
+	MatBufferType.tp_basicsize = sizeof(MatBuffer);
+	MatBufferType.tp_dealloc = MatBuffer_dealloc;
+	MatBufferType.tp_flags = Py_TPFLAGS_DEFAULT;
+	MatBufferType.tp_as_buffer = &MatBufferProcs;
+	MatBufferType.tp_doc = "cv::Mat exported through the buffer protocol.";
+	if (PyType_Ready(&MatBufferType) < 0)
+		return NULL;
+
+	BackgroundType.tp_name = "kcv.Background";
+	BackgroundType.tp_basicsize = sizeof(Background);
+	BackgroundType.tp_new = Background_new;
+	BackgroundType.tp_init = Background_init;
+	BackgroundType.tp_dealloc = Background_dealloc;
+	BackgroundType.tp_flags = Py_TPFLAGS_DEFAULT;
+	BackgroundType.tp_methods = Background_methods;
+	BackgroundType.tp_doc = "Learned depth background segmenting foreground, owned by the caller.";
+	if (PyType_Ready(&BackgroundType) < 0)
+		return NULL;
+
+	PyObject *numpy = PyImport_ImportModule("numpy");
+	if (numpy == NULL)
+		return NULL;
+	g_AsArray = PyObject_GetAttrString(numpy, "asarray");
+	Py_DECREF(numpy);
+	if (g_AsArray == NULL)
+		return NULL;
+
+	PyObject *module = PyModule_Create(&kcv_module);
+	if (module == NULL)
+		return NULL;
+	Py_INCREF(&BackgroundType);
+	PyModule_AddObject(module, "Background", reinterpret_cast<PyObject*>(&BackgroundType));
+	return module;
+}
@@ -0,0 +1,1182 @@
+//    File: Kinect2XTest.cpp
+
+// Self check of the library kernels, runs without the device. Returns the number of failed checks.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Kinect2X.h"
+#include "Kinect2XFusion.h"
+#include "Kinect2XShared.h"
+
+using namespace kcv;
+
+namespace
+{
+	const int KCV_DEPTH_WIDTH = 512;
+	const int KCV_DEPTH_HEIGHT = 424;
+	const int KCV_COLOR_WIDTH = 1920;
+	const int KCV_COLOR_HEIGHT = 1080;
+
+	// Allocations through operator new of the whole process, Mat storage comes from cv::fastMalloc instead
+	std::atomic<long> g_Allocations(0);
+	// Mat storage allocated by CountingAllocator
+	std::atomic<long> g_MatAllocations(0);
+	int g_Checks = 0;
+	int g_Failures = 0;
+
+	void check(bool condition, const char *name)
+	{
+		++g_Checks;
+		if (!condition)
+		{
+			printf("FAILED: %s\n", name);
+			++g_Failures;
+		}
+	}
+
+	// Mat allocator counting allocations, OpenCV 2.4 has no process wide allocator so it is set on the outputs checked
+	class CountingAllocator : public cv::MatAllocator
+	{
+	public:
+		void allocate(int dims, const int *sizes, int type, int *&refcount, uchar *&datastart, uchar *&data, size_t *step)
+		{
+			++g_MatAllocations;
+			size_t total = CV_ELEM_SIZE(type);
+			for (int i = dims - 1; i >= 0; --i)
+			{
+				step[i] = total;
+				total *= sizes[i];
+			}
+			total = cv::alignSize(total, (int)sizeof(*refcount));
+			datastart = data = reinterpret_cast<uchar*>(cv::fastMalloc(total + sizeof(*refcount)));
+			refcount = reinterpret_cast<int*>(data + total);
+			*refcount = 1;
+		}
+
+		void deallocate(int *, uchar *datastart, uchar *)
+		{
+			cv::fastFree(datastart);
+		}
+	};
+
+	CountingAllocator g_CountingAllocator;
+
+	// Depth to color and color to depth coordinates of a color camera covering the depth frame
+	void linearCoordinates(cv::Mat &color_coordinates, cv::Mat &depth_coordinates)
+	{
+		const float sx = (float)KCV_COLOR_WIDTH / KCV_DEPTH_WIDTH;
+		const float sy = (float)KCV_COLOR_HEIGHT / KCV_DEPTH_HEIGHT;
+		color_coordinates.create(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_32FC2);
+		for (int y = 0; y < KCV_DEPTH_HEIGHT; ++y)
+		{
+			cv::Vec2f *p_Row = color_coordinates.ptr<cv::Vec2f>(y);
+			for (int x = 0; x < KCV_DEPTH_WIDTH; ++x)
+				p_Row[x] = cv::Vec2f(x * sx, y * sy);
+		}
+		depth_coordinates.create(KCV_COLOR_HEIGHT, KCV_COLOR_WIDTH, CV_32FC2);
+		for (int y = 0; y < KCV_COLOR_HEIGHT; ++y)
+		{
+			cv::Vec2f *p_Row = depth_coordinates.ptr<cv::Vec2f>(y);
+			for (int x = 0; x < KCV_COLOR_WIDTH; ++x)
+				p_Row[x] = cv::Vec2f(x / sx, y / sy);
+		}
+	}
+
+	// Next synthetic frame acquired through \a sensor , waiting out the device frame rate the synthetic source keeps
+	HRESULT acquireNextFrame(KCV_sensor *sensor, cv::Mat &depth_frame, cv::Mat &color_frame)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(34));
+		return sensor->acquireImages(depth_frame, color_frame);
+	}
+
+	// Whole content of file \a path, empty when it cannot be read
+	std::vector<char> readFile(const std::wstring &path)
+	{
+		std::vector<char> bytes;
+		FILE *file = _wfopen(path.c_str(), L"rb");
+		if (file != NULL)
+		{
+			char buffer[65536];
+			size_t n;
+			while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+				bytes.insert(bytes.end(), buffer, buffer + n);
+			fclose(file);
+		}
+		return bytes;
+	}
+
+	void writeFile(const std::wstring &path, const std::vector<char> &bytes)
+	{
+		FILE *file = _wfopen(path.c_str(), L"wb");
+		if (file != NULL)
+		{
+			fwrite(&bytes[0], 1, bytes.size(), file);
+			fclose(file);
+		}
+	}
+
+	// Largest difference of the channels of \a a and \a b, equal infinities differ by 0
+	inline double difference(double a, double b)
+	{
+		return a == b ? 0.0 : std::fabs(a - b);
+	}
+
+	template <typename T, int n> double difference(const cv::Vec<T, n> &a, const cv::Vec<T, n> &b)
+	{
+		double largest = 0.0;
+		for (int i = 0; i < n; ++i)
+			largest = std::max(largest, difference(a[i], b[i]));
+		return largest;
+	}
+
+	/*!
+	Elements of the vectorized \a result differing from \a reference(y, x) by more than \a tolerance. The reference
+	evaluates one element at a time, so frames of a width that is no multiple of the vector width also cover the
+	remainder of the rows.
+	*/
+	template <typename T, typename Reference> int mismatches(const cv::Mat &result, const Reference &reference,
+		double tolerance = 0.0)
+	{
+		int count = 0;
+		for (int y = 0; y < result.rows; ++y)
+		{
+			for (int x = 0; x < result.cols; ++x)
+				count += !(difference(result.at<T>(y, x), reference(y, x)) <= tolerance);
+		}
+		return count;
+	}
+
+	/*!
+	Outputs kept by the caller are written in place: in steady state their allocator sees no allocation and the serial
+	align functions do not call operator new. Temporary Mats inside OpenCV are not counted.
+	*/
+	void testSteadyStateAlign(KCV_sensor *sensor)
+	{
+		cv::Mat depth(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_16U);
+		cv::Mat color(KCV_COLOR_HEIGHT, KCV_COLOR_WIDTH, CV_8UC4);
+		cv::Mat camera(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_32FC3, cv::Scalar::all(1.0));
+		cv::randu(depth, 500, 4500);
+		cv::randu(color, 0, 256);
+		cv::Mat colorCoordinates, depthCoordinates;
+		linearCoordinates(colorCoordinates, depthCoordinates);
+
+		// the first frame allocates the outputs
+		cv::Mat alignedColor, alignedDepth, rgbd, vis;
+		alignedColor.allocator = alignedDepth.allocator = rgbd.allocator = vis.allocator = &g_CountingAllocator;
+		const long firstMatAllocations = g_MatAllocations;
+		sensor->alignColorFrame(colorCoordinates, color, alignedColor);
+		sensor->alignDepthFrame(depthCoordinates, depth, alignedDepth);
+		sensor->alignRGBDFrame(colorCoordinates, camera, depth, color, rgbd);
+		sensor->visualiseDepthMap(depth, vis);
+		check(g_MatAllocations == firstMatAllocations + 4, "outputs allocated through their allocator");
+
+		const long allocations = g_Allocations;
+		const long matAllocations = g_MatAllocations;
+		sensor->alignColorFrame(colorCoordinates, color, alignedColor);
+		sensor->alignDepthFrame(depthCoordinates, depth, alignedDepth);
+		sensor->visualiseDepthMap(depth, vis);
+		check(g_Allocations == allocations, "steady state align calls operator new");
+
+		// parallel_for_ may call operator new in its backend, only the output storage is checked
+		sensor->alignRGBDFrame(colorCoordinates, camera, depth, color, rgbd);
+		check(g_MatAllocations == matAllocations, "steady state align reallocates outputs");
+
+		cv::Vec4b expected = color.at<cv::Vec4b>((int)(100 * (float)KCV_COLOR_HEIGHT / KCV_DEPTH_HEIGHT + 0.5f),
+			(int)(200 * (float)KCV_COLOR_WIDTH / KCV_DEPTH_WIDTH + 0.5f));
+		check(alignedColor.at<cv::Vec4b>(100, 200) == expected, "aligned color pixel");
+	}
+
+	/*!
+	Fused RGB-D records of a depth ramp mapped with the calibration of the synthetic cameras: a 365 px depth and
+	1060 px color pinhole 52 mm apart along x, centered on their frames. Each color pixel encodes its position, so a
+	record shows which pixel it sampled. Holes and saturated depth carry no depth, near rows are shifted furthest.
+	*/
+	void testRGBDRecords(KCV_sensor *sensor)
+	{
+		const float depthFocal = 365.0f, colorFocal = 1060.0f, baseline = 0.052f;
+		sensor->setSynthetic(true);
+
+		cv::Mat depth(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_16U), infrared(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_16U);
+		for (int y = 0; y < KCV_DEPTH_HEIGHT; ++y)
+		{
+			for (int x = 0; x < KCV_DEPTH_WIDTH; ++x)
+			{
+				depth.at<UINT16>(y, x) = x % 11 == 0 ? 0 : x % 53 == 0 ? USHRT_MAX : y % 17 == 0 ? 50 : (UINT16)(500 + 7 * x + 3 * y);
+				infrared.at<UINT16>(y, x) = (UINT16)(x * y);
+			}
+		}
+		cv::Mat color(KCV_COLOR_HEIGHT, KCV_COLOR_WIDTH, CV_8UC4);
+		for (int y = 0; y < KCV_COLOR_HEIGHT; ++y)
+		{
+			for (int x = 0; x < KCV_COLOR_WIDTH; ++x)
+				color.at<cv::Vec4b>(y, x) = cv::Vec4b((uchar)x, (uchar)y, (uchar)((x >> 8) << 3 | y >> 8), 255);
+		}
+
+		cv::Mat colorCoordinates, depthCoordinates, camera, rgbd;
+		check(SUCCEEDED(sensor->mapCoordinates(depth, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, colorCoordinates, depthCoordinates, camera)) &&
+			SUCCEEDED(sensor->alignRGBDFrame(colorCoordinates, camera, depth, color, rgbd, infrared)), "rgbd alignment");
+		check(rgbd.type() == KCV_RGBD_POINT_TYPE && rgbd.size() == depth.size(), "rgbd record type");
+
+		int depthMismatches = 0, colorMismatches = 0, pointMismatches = 0, infraredMismatches = 0, outside = 0;
+		for (int y = 0; y < rgbd.rows; ++y)
+		{
+			const KCV_rgbdPoint *p_Record = reinterpret_cast<const KCV_rgbdPoint*>(rgbd.ptr(y));
+			for (int x = 0; x < rgbd.cols; ++x)
+			{
+				const KCV_rgbd &record = p_Record[x].rgbd;
+				const UINT16 d = depth.at<UINT16>(y, x);
+				const bool measured = d != 0 && d != USHRT_MAX;
+				depthMismatches += record.depth != (measured ? d : 0) || ((record.flags & KCV_RGBD_DEPTH) != 0) != measured;
+				infraredMismatches += record.infrared != infrared.at<UINT16>(y, x) || (record.flags & KCV_RGBD_INFRARED) == 0;
+
+				// the camera table and the color lut of the synthetic calibration
+				const float rayX = (x - KCV_DEPTH_WIDTH / 2) / depthFocal, rayY = (KCV_DEPTH_HEIGHT / 2 - y) / depthFocal;
+				const bool point = (record.flags & KCV_RGBD_POINT) != 0;
+				const bool sampled = (record.flags & KCV_RGBD_COLOR) != 0;
+				if (d == 0)
+				{
+					pointMismatches += point || p_Record[x].z != -std::numeric_limits<float>::infinity();
+					colorMismatches += sampled;
+					continue;
+				}
+				const float z = d * 0.001f;
+				pointMismatches += !point || p_Record[x].x != rayX * z || p_Record[x].y != rayY * z || p_Record[x].z != z;
+
+				const float ax = KCV_COLOR_WIDTH / 2 + colorFocal * rayX, bx = -colorFocal * baseline * 1000.0f;
+				const float ay = KCV_COLOR_HEIGHT / 2 - colorFocal * rayY;
+				const int colorX = (int)(ax + bx * (1.0f / d) + 0.5f), colorY = (int)(ay + 0.5f);
+				const bool inside = colorX >= 0 && colorX < KCV_COLOR_WIDTH && colorY >= 0 && colorY < KCV_COLOR_HEIGHT;
+				outside += !inside;
+				if (sampled != inside)
+					++colorMismatches;
+				else if (inside)
+				{
+					const cv::Vec4b c = color.at<cv::Vec4b>(colorY, colorX);
+					colorMismatches += record.b != c[0] || record.g != c[1] || record.r != c[2];
+				}
+			}
+		}
+		check(depthMismatches == 0, "rgbd depth of holes and saturated pixels");
+		check(infraredMismatches == 0, "rgbd infrared");
+		check(pointMismatches == 0, "rgbd camera points differ from the calibration");
+		check(outside > 0 && colorMismatches == 0, "rgbd color sampled away from the calibrated pixel");
+
+		// mismatched inputs are rejected and leave the output as it is
+		const uchar *data = rgbd.data;
+		check(sensor->alignRGBDFrame(colorCoordinates, camera, depth.rowRange(0, 100), color, rgbd) == E_INVALIDARG &&
+			sensor->alignRGBDFrame(colorCoordinates, camera.colRange(0, 100), depth, color, rgbd) == E_INVALIDARG &&
+			sensor->alignRGBDFrame(colorCoordinates, camera, depth, depth, rgbd) == E_INVALIDARG && rgbd.data == data,
+			"rgbd alignment of mismatched frames");
+		sensor->setSynthetic(false);
+	}
+
+	/*!
+	Normals and curvature of a tilted plane z = 1.5 + 0.3 x - 0.2 y seen through a pinhole camera, 517 pixels wide so
+	the last block of each row overlaps the one before. Normals equal the plane normal facing the camera and
+	curvature is about zero, except at the borders and around a hole, which have no normal.
+	*/
+	void testNormals()
+	{
+		const int width = 517, height = 64, radius = 2, holeX = 200, holeY = 30;
+		const float f = 365.0f, cx = 258.0f, cy = 32.0f, a = 1.5f, b = 0.3f, c = -0.2f;
+		const float invalid = -std::numeric_limits<float>::infinity();
+		cv::Mat points(height, width, CV_32FC3);
+		for (int v = 0; v < height; ++v)
+		{
+			for (int u = 0; u < width; ++u)
+			{
+				const float rx = (u - cx) / f, ry = (v - cy) / f;
+				const float t = a / (1.0f - b * rx - c * ry);
+				points.at<cv::Vec3f>(v, u) = u == holeX && v == holeY ? cv::Vec3f(invalid, invalid, invalid) : cv::Vec3f(t * rx, t * ry, t);
+			}
+		}
+
+		KCV_normals estimator(radius, 0.05f);
+		cv::Mat normals, curvature;
+		check(SUCCEEDED(estimator.compute(points, normals, curvature)), "normals compute");
+		check(estimator.compute(points.colRange(0, 2 * radius + 3), normals) == E_INVALIDARG, "normals of a too narrow frame");
+
+		// pixels with a full window that does not reach the hole
+		const auto hasNormal = [&](int y, int x) -> bool
+		{
+			const bool border = x < radius || x >= width - radius || y < radius || y >= height - radius;
+			const bool hole = (y == holeY && (x == holeX || std::abs(x - holeX) == radius)) ||
+				(x == holeX && std::abs(y - holeY) == radius);
+			return !border && !hole;
+		};
+		const float length = std::sqrt(b * b + c * c + 1.0f);
+		const cv::Vec3f plane(b / length, c / length, -1.0f / length);
+		const auto planeNormal = [&](int y, int x) -> cv::Vec3f { return hasNormal(y, x) ? plane : cv::Vec3f(); };
+		const auto flat = [](int, int) -> float { return 0.0f; };
+		check(mismatches<cv::Vec3f>(normals, planeNormal, 1e-4) == 0, "normals differ from the plane normal");
+		check(mismatches<float>(curvature, flat, 0.05) == 0, "curvature of a plane");
+
+		const auto point = [&](int y, int x) -> cv::Vec3f { return points.at<cv::Vec3f>(y, x); };
+		const auto dot = [](const cv::Vec3f &p, const cv::Vec3f &q) -> float { return p[0] * q[0] + p[1] * q[1] + p[2] * q[2]; };
+		const auto scalarNormal = [&](int y, int x) -> cv::Vec3f
+		{
+			if (!hasNormal(y, x))
+				return cv::Vec3f();
+			const cv::Vec3f h = point(y, x + radius) - point(y, x - radius), v = point(y + radius, x) - point(y - radius, x);
+			const cv::Vec3f n(h[1] * v[2] - h[2] * v[1], h[2] * v[0] - h[0] * v[2], h[0] * v[1] - h[1] * v[0]);
+			return n * (dot(n, point(y, x)) > 0.0f ? -1.0f : 1.0f) * (1.0f / std::sqrt(dot(n, n)));
+		};
+		const auto scalarCurvature = [&](int y, int x) -> float
+		{
+			if (!hasNormal(y, x))
+				return 0.0f;
+			const cv::Vec3f p = point(y, x), l = point(y, x - radius), r = point(y, x + radius);
+			const cv::Vec3f u = point(y - radius, x), d = point(y + radius, x);
+			const cv::Vec3f mean = ((l + r) + (u + d)) * 0.25f;
+			const float spread = ((dot(l - p, l - p) + dot(r - p, r - p)) + (dot(u - p, u - p) + dot(d - p, d - p))) * 0.25f;
+			return 2.0f * dot(scalarNormal(y, x), p - mean) / spread;
+		};
+		check(mismatches<cv::Vec3f>(normals, scalarNormal, 1e-6) == 0, "normals SSE differ from scalar");
+		check(mismatches<float>(curvature, scalarCurvature, 1e-3) == 0, "curvature SSE differs from scalar");
+	}
+
+	/*!
+	KCV_fusion of a fronto-parallel wall 1.503 m in front of the camera, integrated twice from the identity pose. The
+	projective distance of the wall is its true distance, so the voxels hold (1.503 - z) / truncation up to 1 and
+	change sign at the wall. Raycasting from the same pose recovers the wall and meshing puts every vertex on it.
+	*/
+	void testFusion()
+	{
+		const int width = 160, height = 120;
+		const float fx = 140.0f, fy = 140.0f, cx = 80.0f, cy = 60.0f, wall = 1.503f;
+		cv::Mat points(height, width, CV_32FC3);
+		for (int v = 0; v < height; ++v)
+		{
+			for (int u = 0; u < width; ++u)
+				points.at<cv::Vec3f>(v, u) = cv::Vec3f((u - cx) / fx * wall, (v - cy) / fy * wall, wall);
+		}
+
+		KCV_fusion fusion;
+		const KCV_fusionConfig &config = fusion.config();
+		fusion.setIntrinsics(width, height, fx, fy, cx, cy);
+		check(SUCCEEDED(fusion.integrate(points)) && SUCCEEDED(fusion.integrate(points)), "fusion integrate");
+
+		// columns of voxels well inside the view, through the truncation band
+		const float voxelSize = config.voxelSize;
+		int observed = 0, wrongDistance = 0, wrongSign = 0, wrongCrossing = 0;
+		for (int y = -40; y <= 40; ++y)
+		{
+			for (int x = -60; x <= 60; ++x)
+			{
+				float previousTsdf = 0.0f, crossing = 0.0f;
+				bool previous = false;
+				for (int z = (int)((wall - 2.0f * config.truncation) / voxelSize); z <= (int)((wall + 2.0f * config.truncation) / voxelSize); ++z)
+				{
+					const float sdf = wall - z * voxelSize;
+					float tsdf, weight;
+					if (!fusion.voxelAt(x, y, z, tsdf, weight) || weight == 0.0f)
+					{
+						// the band is observed, voxels in front of it may not be allocated and behind it are not updated
+						wrongDistance += std::fabs(sdf) <= config.truncation;
+						previous = false;
+						continue;
+					}
+					++observed;
+					wrongDistance += weight != 2.0f || std::fabs(tsdf - std::min(1.0f, sdf / config.truncation)) > 1e-4f;
+					wrongSign += (tsdf < 0.0f) != (sdf < 0.0f);
+					if (previous && previousTsdf >= 0.0f && tsdf < 0.0f)
+						crossing = (z - 1 + previousTsdf / (previousTsdf - tsdf)) * voxelSize;
+					previousTsdf = tsdf;
+					previous = true;
+				}
+				wrongCrossing += std::fabs(crossing - wall) > 1e-3f;
+			}
+		}
+		check(observed > 121 * 81 * 8, "fusion observes the truncation band");
+		check(wrongDistance == 0, "fusion TSDF differs from the distance to the wall");
+		check(wrongSign == 0, "fusion TSDF sign in front of and behind the wall");
+		check(wrongCrossing == 0, "fusion zero crossing away from the wall");
+
+		// the view of the integrating camera, away from the borders of the observed volume
+		cv::Mat raycastPoints, raycastNormals;
+		check(SUCCEEDED(fusion.raycast(cv::Matx44f::eye(), raycastPoints, raycastNormals)), "fusion raycast");
+		const cv::Rect inner(16, 12, width - 32, height - 24);
+		const auto wallPoint = [&](int v, int u) -> cv::Vec3f { return points.at<cv::Vec3f>(v + inner.y, u + inner.x); };
+		const auto wallNormal = [](int, int) -> cv::Vec3f { return cv::Vec3f(0.0f, 0.0f, -1.0f); };
+		check(mismatches<cv::Vec3f>(raycastPoints(inner), wallPoint, 1e-3) == 0, "fusion raycast depth differs from the wall");
+		check(mismatches<cv::Vec3f>(raycastNormals(inner), wallNormal, 1e-2) == 0, "fusion raycast normals differ from the wall");
+
+		std::vector<cv::Point3f> vertices;
+		std::vector<cv::Vec3i> triangles;
+		check(SUCCEEDED(fusion.extractMesh(vertices, triangles)), "fusion extract mesh");
+		int offPlane = 0;
+		for (size_t i = 0; i < vertices.size(); ++i)
+			offPlane += std::fabs(vertices[i].z - wall) > 1e-3f;
+		check(vertices.size() > 121 * 81 && triangles.size() > vertices.size(), "fusion mesh covers the wall");
+		check(offPlane == 0, "fusion mesh vertices off the wall");
+	}
+
+	// Scalar reduction of the valid depths \a d of a 2x2 block in \a mode
+	UINT16 reduceBlock(const UINT16 *d, KCV_pyramidMode mode)
+	{
+		UINT16 valid[4];
+		int n = 0;
+		unsigned int sum = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (d[i] != 0 && d[i] != USHRT_MAX)
+			{
+				valid[n++] = d[i];
+				sum += d[i];
+			}
+		}
+		if (n == 0)
+			return 0;
+		std::sort(valid, valid + n);
+		if (mode == KCV_PYRAMID_MIN)
+			return valid[0];
+		if (mode == KCV_PYRAMID_MEDIAN)
+			return valid[(n - 1) / 2];
+		return (UINT16)((sum + n / 2) / n);
+	}
+
+	/*!
+	KCV_pyramid levels of a 517x424 frame with invalid 0 and USHRT_MAX depths and the extremes 1 and USHRT_MAX - 1
+	halve the size rounding down and equal the scalar reduction of each block. An invalid 8x8 region stays invalid
+	on every level and a single valid depth in another survives down to the last level in every mode.
+	*/
+	void testPyramid()
+	{
+		const int width = 517, height = 424;
+		cv::Mat depth(height, width, CV_16U), camera(height, width, CV_32FC3);
+		cv::RNG rng(1);
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				const int kind = rng.uniform(0, 10);
+				UINT16 d = kind == 0 ? 0 : kind == 1 ? USHRT_MAX : kind == 2 ? USHRT_MAX - 1 : kind == 3 ? 1 : (UINT16)rng.uniform(500, 4500);
+				if (x >= 64 && x < 72 && y >= 64 && y < 72)
+					d = (x + y) % 2 == 0 ? 0 : USHRT_MAX;
+				else if (x >= 128 && x < 136 && y >= 128 && y < 136)
+					d = x == 129 && y == 130 ? 3000 : 0;
+				depth.at<UINT16>(y, x) = d;
+				camera.at<cv::Vec3f>(y, x) = cv::Vec3f((float)x, (float)y, (float)d);
+			}
+		}
+
+		const KCV_pyramidMode modes[3] = { KCV_PYRAMID_MIN, KCV_PYRAMID_MEDIAN, KCV_PYRAMID_MEAN };
+		for (int m = 0; m < 3; ++m)
+		{
+			KCV_pyramid pyramid(4, modes[m]);
+			check(SUCCEEDED(pyramid.build(depth, camera)), "pyramid build");
+			check(pyramid.depth(1).size() == cv::Size(258, 212) && pyramid.depth(2).size() == cv::Size(129, 106) &&
+				pyramid.depth(3).size() == cv::Size(64, 53) && pyramid.camera(3).size() == cv::Size(64, 53), "pyramid level sizes");
+
+			int cameraMismatches = 0;
+			for (int level = 1; level < pyramid.levels(); ++level)
+			{
+				const cv::Mat &source = pyramid.depth(level - 1);
+				const cv::Mat &reduced = pyramid.depth(level);
+				const auto scalar = [&](int y, int x) -> UINT16
+				{
+					const UINT16 block[4] = { source.at<UINT16>(2 * y, 2 * x), source.at<UINT16>(2 * y, 2 * x + 1),
+						source.at<UINT16>(2 * y + 1, 2 * x), source.at<UINT16>(2 * y + 1, 2 * x + 1) };
+					return reduceBlock(block, modes[m]);
+				};
+				check(mismatches<UINT16>(reduced, scalar) == 0, "pyramid SSE reduction differs from scalar");
+
+				// min and median keep the point of the chosen depth, invalid depth has no point
+				for (int y = 0; y < reduced.rows; ++y)
+				{
+					for (int x = 0; x < reduced.cols; ++x)
+					{
+						const UINT16 d = reduced.at<UINT16>(y, x);
+						const float z = pyramid.camera(level).at<cv::Vec3f>(y, x)[2];
+						cameraMismatches += d != 0 ? modes[m] != KCV_PYRAMID_MEAN && z != d : z != -std::numeric_limits<float>::infinity();
+					}
+				}
+
+				const int scale = 1 << level;
+				const cv::Mat invalid = reduced(cv::Rect(64 / scale, 64 / scale, 8 / scale, 8 / scale));
+				check(cv::countNonZero(invalid) == 0, "pyramid fills an invalid region");
+				check(reduced.at<UINT16>(130 / scale, 129 / scale) == 3000 &&
+					cv::countNonZero(reduced(cv::Rect(128 / scale, 128 / scale, 8 / scale, 8 / scale))) == 1,
+					"pyramid loses a single valid depth");
+			}
+			check(cameraMismatches == 0, "pyramid camera coordinates differ from depth");
+		}
+	}
+
+	/*!
+	KCV_infrared of a ramp 1027 pixels wide through the whole 16 bit range and of a synthetic infrared frame, for
+	several clippings, linear and with gamma. Intensities up to low are black and from high on white, output grows
+	with intensity and gamma brightens it. Clipping given in reverse is swapped.
+	*/
+	void testInfraredNormalize()
+	{
+		cv::Mat ramp(4, 1027, CV_16U);
+		for (int y = 0; y < ramp.rows; ++y)
+		{
+			for (int x = 0; x < ramp.cols; ++x)
+				ramp.at<UINT16>(y, x) = (UINT16)std::min(x * 64 + y * 16, (int)USHRT_MAX);
+		}
+		KCV_syntheticSource source;
+		cv::Mat depth, color, infrared;
+		check(SUCCEEDED(source.acquire(depth, color, &infrared, NULL, false)), "synthetic infrared frame");
+
+		const cv::Mat frames[3] = { ramp, infrared, infrared(cv::Rect(3, 0, 509, 400)) };
+		const UINT16 lows[3] = { 0, 100, 1000 };
+		const UINT16 highs[3] = { USHRT_MAX, 4000, 1010 };
+		int clipped = 0, decreasing = 0, darkened = 0, reversed = 0;
+		for (int c = 0; c < 3; ++c)
+		{
+			cv::Mat linear;
+			for (int g = 0; g < 2; ++g)
+			{
+				const float gamma = g == 0 ? 1.0f : 2.2f;
+				const KCV_infrared normalizer(lows[c], highs[c], gamma);
+				const float levels = gamma != 1.0f ? (float)(KCV_GAMMA_LEVELS - 1) : 255.0f;
+				const float scale = levels / std::max(highs[c] - lows[c], 1);
+				for (int f = 0; f < 3; ++f)
+				{
+					const cv::Mat &frame = frames[f];
+					const auto scalar = [&](int y, int x) -> UCHAR
+					{
+						const int level = cvRound((std::min(std::max(frame.at<UINT16>(y, x), lows[c]), highs[c]) - lows[c]) * scale);
+						return gamma != 1.0f ? (UCHAR)cvRound(255.0 * std::pow(level / (double)(KCV_GAMMA_LEVELS - 1), 1.0 / gamma)) : (UCHAR)level;
+					};
+					cv::Mat normalized;
+					check(SUCCEEDED(normalizer.normalize(frame, normalized)) && normalized.type() == CV_8U &&
+						normalized.size() == frame.size(), "infrared normalize");
+					check(mismatches<UCHAR>(normalized, scalar) == 0, "infrared SSE normalization differs from scalar");
+				}
+
+				cv::Mat normalized, swapped;
+				normalizer.normalize(ramp, normalized);
+				KCV_infrared(highs[c], lows[c], gamma).normalize(ramp, swapped);
+				reversed += cv::countNonZero(normalized != swapped);
+				for (int y = 0; y < ramp.rows; ++y)
+				{
+					for (int x = 0; x < ramp.cols; ++x)
+					{
+						const UINT16 value = ramp.at<UINT16>(y, x);
+						const UCHAR out = normalized.at<UCHAR>(y, x);
+						clipped += (value <= lows[c] && out != 0) || (value >= highs[c] && out != 255);
+						decreasing += x > 0 && out < normalized.at<UCHAR>(y, x - 1);
+						darkened += g == 1 && out < linear.at<UCHAR>(y, x);
+					}
+				}
+				linear = normalized;
+			}
+		}
+		check(clipped == 0, "infrared outside of the clipping is not black or white");
+		check(decreasing == 0, "infrared output decreases with intensity");
+		check(darkened == 0, "infrared gamma darkens");
+		check(reversed == 0, "infrared clipping given in reverse");
+
+		cv::Mat normalized;
+		check(KCV_infrared().normalize(depth.reshape(2), normalized) == E_INVALIDARG, "infrared normalize of another type");
+	}
+
+	/*!
+	With the color stream disabled acquireImages maps depth frames to camera space only: the published mapping is not
+	color mapped, has no color grid and functions needing color maps return E_PENDING. Infrared shares the depth grid.
+	Enabling color again maps the next frame in full.
+	*/
+	void testInfraredMapping(KCV_sensor *sensor)
+	{
+		sensor->initSensor(KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT);
+		sensor->setSynthetic(true);
+		const DWORD sources = sensor->getFrameSources();
+		sensor->setFrameSources(FrameSourceTypes::FrameSourceTypes_Depth | FrameSourceTypes::FrameSourceTypes_Infrared);
+
+		cv::Mat depth, color, infrared, longExposure, aligned;
+		check(SUCCEEDED(sensor->acquireImages(depth, color, infrared, longExposure)) && color.empty() && longExposure.empty() &&
+			infrared.size() == depth.size(), "acquire depth and infrared only");
+		{
+			KCV_mappingView mapping = sensor->acquireMapping();
+			const int center = KCV_DEPTH_HEIGHT / 2 * KCV_DEPTH_WIDTH + KCV_DEPTH_WIDTH / 2;
+			check(mapping.isValid() && !mapping.isColorMapped() && mapping.colorSize() == cv::Size() &&
+				mapping.cameraCoordinates()[center].Z == depth.at<UINT16>(KCV_DEPTH_HEIGHT / 2, KCV_DEPTH_WIDTH / 2) * 0.001f,
+				"frame without color is mapped to camera space only");
+		}
+		check(sensor->alignDepthFrame(reinterpret_cast<const UINT16*>(depth.data), KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT,
+			KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, aligned) == E_PENDING, "align without color maps");
+
+		sensor->setFrameSources(sources);
+		check(SUCCEEDED(acquireNextFrame(sensor, depth, color)) && !color.empty() && sensor->acquireMapping().isColorMapped() &&
+			sensor->acquireMapping().colorSize() == color.size(), "color mapped again");
+
+		sensor->closeAll();
+		sensor->setSynthetic(false);
+	}
+
+	/*!
+	Synthetic frames mapped with the calibration loaded by setSynthetic: depth pixels inside the sphere take its red
+	color and wall pixels away from it the gray checker. Mapping again into the same outputs does not allocate.
+	*/
+	void testSyntheticMapping(KCV_sensor *sensor)
+	{
+		sensor->setSynthetic(true);
+		check(sensor->isCalibrated(), "synthetic calibration loaded");
+
+		KCV_syntheticSource source;
+		cv::Mat depth, color;
+		source.acquire(depth, color, NULL, NULL, true);
+		cv::Mat colorCoordinates, depthCoordinates, camera;
+		colorCoordinates.allocator = depthCoordinates.allocator = camera.allocator = &g_CountingAllocator;
+		check(SUCCEEDED(sensor->mapCoordinates(depth, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, colorCoordinates, depthCoordinates, camera)),
+			"map synthetic frame");
+		const long allocations = g_Allocations;
+		const long matAllocations = g_MatAllocations;
+		sensor->mapCoordinates(depth, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, colorCoordinates, depthCoordinates, camera);
+		check(g_Allocations == allocations && g_MatAllocations == matAllocations, "steady state mapping allocates");
+
+		// without color only the depth grid is mapped
+		cv::Mat depthOnlyColor, depthOnlyDepth, depthOnlyCamera;
+		check(SUCCEEDED(sensor->mapCoordinates(depth, 0, 0, depthOnlyColor, depthOnlyDepth, depthOnlyCamera)) &&
+			depthOnlyDepth.empty() && cv::countNonZero(depthOnlyCamera.reshape(1) != camera.reshape(1)) == 0,
+			"depth only mapping");
+
+		cv::Mat rgbd;
+		sensor->alignRGBDFrame(colorCoordinates, camera, depth, color, rgbd);
+
+		// the sphere is nearer than the wall, wall pixels left of it are hidden from the color camera
+		const UINT16 sphereDepth = 2500;
+		int checked = 0, mismatches = 0;
+		for (int y = 1; y < KCV_DEPTH_HEIGHT - 1; ++y)
+		{
+			const KCV_rgbdPoint *p_Record = reinterpret_cast<const KCV_rgbdPoint*>(rgbd.ptr(y));
+			for (int x = 0; x < KCV_DEPTH_WIDTH; ++x)
+			{
+				const UINT16 d = depth.at<UINT16>(y, x);
+				if (d == 0 || (p_Record[x].rgbd.flags & KCV_RGBD_COLOR) == 0)
+					continue;
+
+				const bool sphere = d < sphereDepth;
+				const int reach = sphere ? 1 : 8;
+				bool interior = true;
+				for (int j = -1; j <= 1; ++j)
+				{
+					for (int i = -reach; i <= reach; ++i)
+					{
+						const UINT16 e = depth.at<UINT16>(y + j, std::min(std::max(x + i, 0), KCV_DEPTH_WIDTH - 1));
+						interior = interior && e != 0 && (e < sphereDepth) == sphere;
+					}
+				}
+				if (!interior)
+					continue;
+
+				++checked;
+				const bool red = p_Record[x].rgbd.r > p_Record[x].rgbd.g + 20;
+				mismatches += red != sphere || p_Record[x].z != d * 0.001f;
+			}
+		}
+		check(checked > 100000, "synthetic frame maps into the color frame");
+		check(mismatches == 0, "synthetic depth and color are not aligned");
+
+		sensor->setSynthetic(false);
+		check(!sensor->isCalibrated(), "synthetic calibration released");
+	}
+
+	/*!
+	Views held across acquisitions keep their frame and never block the acquiring thread, with every spare slot held
+	acquireImages returns E_PENDING. Mapping the published depth frame again keeps its color maps, another depth frame
+	has none. closeAll() leaves the mapping buffers to views still held.
+	*/
+	void testMappingViews(KCV_sensor *sensor)
+	{
+		sensor->initSensor(KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT);
+		sensor->setSynthetic(true);
+
+		cv::Mat depth, color, aligned;
+		check(SUCCEEDED(acquireNextFrame(sensor, depth, color)), "acquire first synthetic frame");
+		KCV_mappingView first = sensor->acquireMapping();
+		const cv::Mat firstCamera = cv::Mat(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_32FC3,
+			const_cast<CameraSpacePoint*>(first.cameraCoordinates())).clone();
+		check(SUCCEEDED(acquireNextFrame(sensor, depth, color)), "acquire with one view held");
+		KCV_mappingView second = sensor->acquireMapping();
+		check(second.sequence() > first.sequence(), "second view of a newer frame");
+
+		// both spare slots are held by this thread, waiting for them would never end
+		check(SUCCEEDED(acquireNextFrame(sensor, depth, color)), "acquire into the last spare slot");
+		KCV_mappingView third = sensor->acquireMapping();
+		check(acquireNextFrame(sensor, depth, color) == E_PENDING, "acquire with every spare slot held");
+		check(sensor->acquireMapping().sequence() == third.sequence(), "pending frame is not published");
+		check(cv::countNonZero(cv::Mat(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_32FC3,
+			const_cast<CameraSpacePoint*>(first.cameraCoordinates())).reshape(1) != firstCamera.reshape(1)) == 0 &&
+			first.depthFrame().size() == depth.size(), "held view overwritten");
+		first.release();
+		check(SUCCEEDED(acquireNextFrame(sensor, depth, color)), "acquire after releasing a view");
+		second.release();
+		third.release();
+
+		// camera space mapping of the published depth frame keeps the color maps
+		check(SUCCEEDED(sensor->mapDepthFrameToCameraSpace(depth, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT)) &&
+			sensor->acquireMapping().isColorMapped(), "same depth frame keeps color maps");
+		check(SUCCEEDED(sensor->alignColorFrame(reinterpret_cast<const UINT16*>(depth.data), KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT,
+			reinterpret_cast<const RGBQUAD*>(color.data), KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, aligned)) &&
+			aligned.size() == depth.size(), "align after camera space mapping");
+		check(sensor->alignDepthFrame(reinterpret_cast<const UINT16*>(depth.data), KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT,
+			KCV_COLOR_WIDTH / 2, KCV_COLOR_HEIGHT / 2, aligned) == E_INVALIDARG, "align to another color grid");
+
+		cv::Mat other = depth.clone();
+		other.at<UINT16>(KCV_DEPTH_HEIGHT / 2, KCV_DEPTH_WIDTH / 2) += 10;
+		cv::Point depthPoint;
+		check(SUCCEEDED(sensor->mapDepthFrameToCameraSpace(other, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT)) &&
+			!sensor->acquireMapping().isColorMapped(), "another depth frame has no color maps");
+		check(sensor->alignColorFrame(reinterpret_cast<const UINT16*>(other.data), KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT,
+			reinterpret_cast<const RGBQUAD*>(color.data), KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, aligned) == E_PENDING &&
+			!sensor->getPointInDepth(cv::Point(KCV_COLOR_WIDTH / 2, KCV_COLOR_HEIGHT / 2), KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT,
+			KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT, depthPoint), "align without color maps");
+
+		KCV_mappingView held = sensor->acquireMapping();
+		check(sensor->closeAll() == 1 && held.isValid() && sensor->acquireMapping().isValid(), "close with a view held");
+		held.release();
+		check(sensor->closeAll() == 0 && !sensor->acquireMapping().isValid(), "close after releasing the views");
+
+		sensor->setSynthetic(false);
+	}
+
+	/*!
+	Frame budget of 10 ms fed with synthetic timings: frames of 5 ms are processed in full, from the first frame
+	over budget the smoothed cost exceeds it on the second and three such frames degrade to reusing the color to depth
+	mapping, refreshed every fourth frame. Frames of 1 ms recover full processing, discarded frames are not counted.
+	*/
+	void testBudgetController()
+	{
+		KCV_budget budget;
+		budget.setBudget(10.0);
+		int skipped = 0, fullAtSkipLevel = 0, firstSkip = -1;
+		// over budget until every level settled, its savings are measured under the same load
+		for (int frame = 0; frame < 66; ++frame)
+		{
+			budget.beginFrame();
+			const KCV_budgetCounters counters = budget.getCounters();
+			const bool skip = budget.skipColorToDepth();
+			budget.record(KCV_COST_COLOR_TO_DEPTH, frame < 6 ? 5.0 : 20.0);
+			skipped += skip;
+			if (firstSkip < 0 && skip)
+				firstSkip = frame;
+			// frames counts the finished ones, every fourth mapping is done in full
+			if (counters.level >= KCV_LEVEL_SKIP_COLOR_TO_DEPTH)
+				fullAtSkipLevel += skip == (counters.frames % 4 == 0);
+			else
+				check(!skip, "color to depth skipped at full level");
+		}
+		check(firstSkip == 6 + 4, "degrades after three smoothed frames over budget");
+		check(fullAtSkipLevel == 0, "color to depth refresh every fourth frame");
+		check(budget.getCounters().skippedColorToDepth == (unsigned long long)skipped, "skipped color to depth counter");
+
+		const unsigned long long frames = budget.getCounters().frames;
+		budget.beginFrame();
+		budget.record(KCV_COST_ACQUIRE, 100.0);
+		budget.discardFrame();
+		budget.beginFrame();
+		check(budget.getCounters().frames == frames + 1 && budget.getCounters().frameMs < 20.1, "discarded frame is accounted");
+
+		for (int frame = 0; frame < 200; ++frame)
+		{
+			budget.beginFrame();
+			budget.record(KCV_COST_COLOR_TO_DEPTH, 1.0);
+		}
+		const KCV_budgetCounters recovered = budget.getCounters();
+		check(recovered.level == KCV_LEVEL_FULL && recovered.recoveries == recovered.degradations && !budget.skipColorToDepth(),
+			"recovers full processing");
+	}
+
+	/*!
+	Over budget acquireImages reuses the color to depth mapping of the previous slot, only when that slot was color
+	mapped. A slot published by mapDepthFrameToCameraSpace has none, the next frame is mapped in full then.
+	*/
+	void testBudgetReuse(KCV_sensor *sensor)
+	{
+		sensor->initSensor(KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT);
+		sensor->setSynthetic(true);
+		KCV_budget &budget = sensor->getBudget();
+		budget.reset();
+		budget.setBudget(0.001);
+
+		cv::Mat depth, color, colorCoordinates, depthCoordinates, camera;
+		const size_t bytes = KCV_COLOR_WIDTH * KCV_COLOR_HEIGHT * sizeof(DepthSpacePoint);
+		// every frame is over budget, the skip level is reached within a few frames
+		for (int frame = 0; frame < 6; ++frame)
+			acquireNextFrame(sensor, depth, color);
+
+		int reused = 0, wrong = 0;
+		for (int frame = 0; frame < 8; ++frame)
+		{
+			KCV_mappingView previous = sensor->acquireMapping();
+			const unsigned long long skipped = budget.getCounters().skippedColorToDepth;
+			check(SUCCEEDED(acquireNextFrame(sensor, depth, color)), "acquire over budget");
+			KCV_mappingView current = sensor->acquireMapping();
+			sensor->mapCoordinates(depth, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, colorCoordinates, depthCoordinates, camera);
+			if (budget.getCounters().skippedColorToDepth != skipped)
+			{
+				++reused;
+				wrong += memcmp(current.depthCoordinates(), previous.depthCoordinates(), bytes) != 0;
+			}
+			else
+				wrong += memcmp(current.depthCoordinates(), depthCoordinates.data, bytes) != 0;
+		}
+		check(reused >= 5 && wrong == 0, "color to depth reused from the previous frame");
+
+		int skippedAfterCamera = 0;
+		wrong = 0;
+		for (int frame = 0; frame < 8; ++frame)
+		{
+			cv::Mat other = depth.clone();
+			other.at<UINT16>(0, 0) += 1;
+			sensor->mapDepthFrameToCameraSpace(other, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT);
+			const unsigned long long skipped = budget.getCounters().skippedColorToDepth;
+			check(SUCCEEDED(acquireNextFrame(sensor, depth, color)), "acquire after camera space mapping");
+			skippedAfterCamera += budget.getCounters().skippedColorToDepth != skipped;
+			sensor->mapCoordinates(depth, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, colorCoordinates, depthCoordinates, camera);
+			wrong += memcmp(sensor->acquireMapping().depthCoordinates(), depthCoordinates.data, bytes) != 0;
+		}
+		check(skippedAfterCamera == 0 && wrong == 0, "color to depth reused from a slot without color maps");
+
+		budget.setBudget(0.0);
+		budget.reset();
+		sensor->closeAll();
+		sensor->setSynthetic(false);
+	}
+
+	/*!
+	Background segmentation: an object entering a learned wall is foreground, depth 0 and USHRT_MAX never is and pixels
+	first measured after learning join the background. Blobs below the minimum area are removed from the mask, the runs
+	cover the mask exactly and lie inside the box of their blob. A frame of odd width segmented in strips narrower than
+	eight pixels gives the same mask and model. Foreground alignment writes foreground pixels only, a reused output keeps
+	the others, and rejects masks of another size.
+	*/
+	void testBackground(KCV_sensor *sensor)
+	{
+		const int width = 517, height = 64, strip = 7, learnFrames = 4;
+		const cv::Rect object(100, 10, 40, 30), small(200, 20, 5, 5), late(300, 0, 40, height);
+		KCV_background whole(learnFrames, 0.05f, 2.0f, 30.0f, 1), filtered(learnFrames, 0.05f, 2.0f, 30.0f, 64);
+		std::vector<KCV_background> strips((width + strip - 1) / strip, KCV_background(learnFrames, 0.05f, 2.0f, 30.0f, 1));
+		KCV_foreground foreground, filteredForeground, stripForeground;
+		cv::Mat depth(height, width, CV_16U);
+		cv::RNG rng(3);
+
+		int maskMismatches = 0, invalidForeground = 0;
+		for (int frame = 0; frame < 16; ++frame)
+		{
+			for (int y = 0; y < height; ++y)
+			{
+				for (int x = 0; x < width; ++x)
+				{
+					// a wall with holes, objects entering after learning and a region measured only after learning
+					const cv::Point p(x, y);
+					const int kind = rng.uniform(0, 16);
+					UINT16 d = (UINT16)(2000 + rng.uniform(-10, 11));
+					if (late.contains(p))
+						d = frame < 6 ? 0 : d;
+					else if (object.contains(p) || small.contains(p))
+						d = frame >= 8 ? 1200 : d;
+					else
+						d = kind == 0 ? 0 : kind == 1 ? USHRT_MAX : d;
+					depth.at<UINT16>(y, x) = d;
+				}
+			}
+
+			check(SUCCEEDED(whole.apply(depth, foreground)), "background apply");
+			check(SUCCEEDED(filtered.apply(depth, filteredForeground)), "background apply with a minimum blob area");
+			for (int s = 0; s < (int)strips.size(); ++s)
+			{
+				const int x0 = s * strip, x1 = std::min(x0 + strip, width);
+				strips[s].apply(depth.colRange(x0, x1), stripForeground);
+				maskMismatches += mismatches<UCHAR>(foreground.mask.colRange(x0, x1),
+					[&](int y, int x) -> UCHAR { return stripForeground.mask.at<UCHAR>(y, x); });
+			}
+			invalidForeground += mismatches<UCHAR>(foreground.mask, [&](int y, int x) -> UCHAR
+			{
+				const UINT16 d = depth.at<UINT16>(y, x);
+				return d == 0 || d == USHRT_MAX ? 0 : foreground.mask.at<UCHAR>(y, x);
+			});
+		}
+		check(maskMismatches == 0, "background mask of strips differs from the whole frame");
+		check(invalidForeground == 0, "background reports invalid depth as foreground");
+
+		int modelMismatches = 0;
+		for (int s = 0; s < (int)strips.size(); ++s)
+		{
+			const int x0 = s * strip, x1 = std::min(x0 + strip, width);
+			modelMismatches += mismatches<float>(whole.nearest().colRange(x0, x1),
+				[&](int y, int x) -> float { return strips[s].nearest().at<float>(y, x); }) +
+				mismatches<float>(whole.variance().colRange(x0, x1),
+				[&](int y, int x) -> float { return strips[s].variance().at<float>(y, x); });
+		}
+		check(modelMismatches == 0, "background model of strips differs from the whole frame");
+
+		// the object and the small blob are the foreground, the late region joined the background
+		check(mismatches<UCHAR>(foreground.mask, [&](int y, int x) -> UCHAR
+			{ return object.contains(cv::Point(x, y)) || small.contains(cv::Point(x, y)) ? 255 : 0; }) == 0,
+			"background foreground is not the objects");
+		check(foreground.blobs.size() == 2 && foreground.blobs[0].box == object && foreground.blobs[0].area == object.area() &&
+			foreground.blobs[1].box == small && foreground.blobs[1].area == small.area() &&
+			foreground.pixels == object.area() + small.area(), "background blobs of the objects");
+		check(mismatches<UCHAR>(filteredForeground.mask, [&](int y, int x) -> UCHAR
+			{ return small.contains(cv::Point(x, y)) ? 0 : foreground.mask.at<UCHAR>(y, x); }) == 0 &&
+			filteredForeground.blobs.size() == 1 && filteredForeground.blobs[0].box == object &&
+			filteredForeground.pixels == object.area(), "background keeps blobs below the minimum area");
+
+		// runs are maximal, row major and cover the mask
+		cv::Mat covered = cv::Mat::zeros(height, width, CV_8U);
+		std::vector<int> blobArea(foreground.blobs.size(), 0);
+		int badRuns = 0, runPixels = 0;
+		for (size_t i = 0; i < foreground.runs.size(); ++i)
+		{
+			const KCV_run &run = foreground.runs[i];
+			if (run.y < 0 || run.y >= height || run.begin < 0 || run.begin >= run.end || run.end > width ||
+				run.blob < 0 || run.blob >= (int)foreground.blobs.size() ||
+				(i > 0 && (run.y < foreground.runs[i - 1].y ||
+				(run.y == foreground.runs[i - 1].y && run.begin <= foreground.runs[i - 1].end))))
+			{
+				++badRuns;
+				continue;
+			}
+			const cv::Rect extent(run.begin, run.y, run.end - run.begin, 1);
+			const UCHAR *p_Mask = foreground.mask.ptr<UCHAR>(run.y);
+			badRuns += (extent & foreground.blobs[run.blob].box) != extent ||
+				(run.begin > 0 && p_Mask[run.begin - 1] != 0) || (run.end < width && p_Mask[run.end] != 0);
+			covered(extent).setTo(255);
+			blobArea[run.blob] += extent.width;
+			runPixels += extent.width;
+		}
+		check(badRuns == 0, "background runs are not maximal runs inside their blob");
+		check(mismatches<UCHAR>(covered, [&](int y, int x) -> UCHAR { return foreground.mask.at<UCHAR>(y, x); }) == 0 &&
+			runPixels == foreground.pixels, "background runs do not cover the mask");
+		int areaMismatches = 0;
+		for (size_t b = 0; b < blobArea.size(); ++b)
+			areaMismatches += blobArea[b] != foreground.blobs[b].area;
+		check(areaMismatches == 0, "background blob area differs from its runs");
+
+		// a box entering a flat wall on the depth grid, aligned through linear coordinates
+		const cv::Rect box(200, 150, 60, 80);
+		KCV_background model(1, 0.05f, 2.0f, 30.0f, 1);
+		KCV_foreground boxForeground;
+		cv::Mat frame(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_16U, cv::Scalar(2000));
+		model.apply(frame, boxForeground);
+		model.apply(frame, boxForeground);
+		frame(box).setTo(1200);
+		check(SUCCEEDED(model.apply(frame, boxForeground)) && boxForeground.blobs.size() == 1 &&
+			boxForeground.blobs[0].box == box, "background of the depth grid");
+
+		cv::Mat colorCoordinates, depthCoordinates;
+		linearCoordinates(colorCoordinates, depthCoordinates);
+		cv::Mat color(KCV_COLOR_HEIGHT, KCV_COLOR_WIDTH, CV_8UC4);
+		for (int y = 0; y < KCV_COLOR_HEIGHT; ++y)
+		{
+			for (int x = 0; x < KCV_COLOR_WIDTH; ++x)
+				color.at<cv::Vec4b>(y, x) = cv::Vec4b((UCHAR)x, (UCHAR)y, (UCHAR)((x >> 8) | (y >> 8) << 4), 255);
+		}
+		const cv::Vec4b kept(7, 7, 7, 7);
+		auto alignedColor = [&](int y, int x, const cv::Vec4b &other) -> cv::Vec4b
+		{
+			if (boxForeground.mask.at<UCHAR>(y, x) == 0)
+				return other;
+			const cv::Vec2f p = colorCoordinates.at<cv::Vec2f>(y, x);
+			return color.at<cv::Vec4b>(static_cast<int>(p[1] + 0.5f), static_cast<int>(p[0] + 0.5f));
+		};
+
+		cv::Mat aligned;
+		check(SUCCEEDED(sensor->alignColorFrame(boxForeground, colorCoordinates, color, aligned)) &&
+			mismatches<cv::Vec4b>(aligned, [&](int y, int x) -> cv::Vec4b { return alignedColor(y, x, cv::Vec4b()); }) == 0,
+			"foreground color of a new output");
+		aligned.setTo(cv::Scalar::all(7));
+		check(SUCCEEDED(sensor->alignColorFrame(boxForeground, colorCoordinates, color, aligned)) &&
+			mismatches<cv::Vec4b>(aligned, [&](int y, int x) -> cv::Vec4b { return alignedColor(y, x, kept); }) == 0,
+			"foreground color of a reused output");
+
+		cv::Mat alignedDepth;
+		check(SUCCEEDED(sensor->alignDepthFrame(boxForeground, depthCoordinates, colorCoordinates, frame, alignedDepth)) &&
+			mismatches<UINT16>(alignedDepth, [&](int y, int x) -> UINT16
+			{
+				const cv::Vec2f p = depthCoordinates.at<cv::Vec2f>(y, x);
+				const int depthX = static_cast<int>(p[0] + 0.5f), depthY = static_cast<int>(p[1] + 0.5f);
+				return depthX < KCV_DEPTH_WIDTH && depthY < KCV_DEPTH_HEIGHT && boxForeground.mask.at<UCHAR>(depthY, depthX) != 0 ?
+					frame.at<UINT16>(depthY, depthX) : 0;
+			}) == 0, "foreground depth on the color grid");
+
+		// masks and frames of another size leave the output untouched
+		check(sensor->alignColorFrame(foreground, colorCoordinates, color, aligned) == E_INVALIDARG &&
+			mismatches<cv::Vec4b>(aligned, [&](int y, int x) -> cv::Vec4b { return alignedColor(y, x, kept); }) == 0,
+			"foreground color of another mask size");
+		check(sensor->alignDepthFrame(boxForeground, depthCoordinates, colorCoordinates, depth, alignedDepth) == E_INVALIDARG,
+			"foreground depth of another frame size");
+		check(sensor->alignColorFrame(foreground, color, aligned) == E_INVALIDARG &&
+			sensor->alignDepthFrame(foreground, depth, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT, alignedDepth) == E_INVALIDARG,
+			"live foreground alignment of a mask not of the depth frame");
+	}
+
+	// Writes \a bytes as cache file \a path and loads it for device \a serial into \a calibration
+	HRESULT loadCacheFile(KCV_calibration &calibration, const std::wstring &path, const std::wstring &serial,
+		const std::vector<char> &bytes)
+	{
+		writeFile(path, bytes);
+		return calibration.load(path, serial, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT);
+	}
+
+	/*!
+	Calibration cache: assigned tables survive save and load, mapping through the loaded tables follows the camera
+	table and color = a + b / depth, and caches of another device or frame size, with a wrong magic or version,
+	truncated or with table offsets wrapping around the file size are rejected.
+	*/
+	void testCalibrationCache()
+	{
+		const std::wstring serial = L"kcv_test";
+		const int count = KCV_DEPTH_WIDTH * KCV_DEPTH_HEIGHT;
+		const float invalid = -std::numeric_limits<float>::infinity();
+		std::vector<PointF> cameraTable(count);
+		std::vector<KCV_colorLut> colorLut(count);
+		for (int y = 0; y < KCV_DEPTH_HEIGHT; ++y)
+		{
+			for (int x = 0; x < KCV_DEPTH_WIDTH; ++x)
+			{
+				const int i = y * KCV_DEPTH_WIDTH + x;
+				cameraTable[i].X = (x - KCV_DEPTH_WIDTH / 2) / 365.0f;
+				cameraTable[i].Y = (KCV_DEPTH_HEIGHT / 2 - y) / 365.0f;
+				// the left column does not reach the color camera
+				colorLut[i].ax = x == 0 ? invalid : 3.75f * x;
+				colorLut[i].bx = -55000.0f;
+				colorLut[i].ay = 2.5f * y;
+				colorLut[i].by = 0.0f;
+			}
+		}
+		CameraIntrinsics intrinsics = { 365.0f, 365.0f, 256.0f, 212.0f, 0.0f, 0.0f, 0.0f };
+
+		KCV_calibration calibration;
+		check(SUCCEEDED(calibration.assign(serial, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT,
+			intrinsics, cameraTable, colorLut)), "calibration assign");
+		WCHAR directory[MAX_PATH];
+		GetTempPathW(MAX_PATH, directory);
+		const std::wstring path = KCV_calibration::cacheFileName(directory, serial);
+		check(SUCCEEDED(calibration.save(path)), "calibration save");
+
+		KCV_calibration loaded;
+		check(SUCCEEDED(loaded.load(path, serial, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT)),
+			"calibration load");
+		check(loaded.isLoaded() && loaded.serial() == serial && loaded.depthIntrinsics().FocalLengthX == 365.0f &&
+			memcmp(loaded.cameraTable(), &cameraTable[0], count * sizeof(PointF)) == 0, "calibration round trip");
+
+		cv::Mat depth(KCV_DEPTH_HEIGHT, KCV_DEPTH_WIDTH, CV_16U);
+		cv::randu(depth, 0, 4500);
+		depth.setTo(0, depth < 500);
+		std::vector<ColorSpacePoint> colorPoints(count);
+		std::vector<CameraSpacePoint> cameraPoints(count);
+		check(SUCCEEDED(loaded.mapDepthFrameToColorSpace(depth.ptr<UINT16>(0), &colorPoints[0])) &&
+			SUCCEEDED(loaded.mapDepthFrameToCameraSpace(depth.ptr<UINT16>(0), &cameraPoints[0])), "calibrated mapping");
+		int mismatches = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			const UINT16 d = depth.ptr<UINT16>(0)[i];
+			const bool colored = d != 0 && i % KCV_DEPTH_WIDTH != 0;
+			mismatches += colored ? std::fabs(colorPoints[i].X - (colorLut[i].ax - 55000.0f / d)) > 1e-3f ||
+				colorPoints[i].Y != colorLut[i].ay : colorPoints[i].X != invalid || colorPoints[i].Y != invalid;
+			mismatches += d != 0 ? std::fabs(cameraPoints[i].X - cameraTable[i].X * d / 1000.0f) > 1e-5f ||
+				std::fabs(cameraPoints[i].Y - cameraTable[i].Y * d / 1000.0f) > 1e-5f ||
+				std::fabs(cameraPoints[i].Z - d / 1000.0f) > 1e-5f : cameraPoints[i].Z != invalid;
+		}
+		check(mismatches == 0, "calibrated mapping differs from the assigned tables");
+
+		check(FAILED(loaded.load(path, L"kcv_other", KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT, KCV_COLOR_WIDTH, KCV_COLOR_HEIGHT)) &&
+			!loaded.isLoaded(), "calibration of another device loaded");
+		check(FAILED(loaded.load(path, serial, KCV_DEPTH_WIDTH, KCV_DEPTH_HEIGHT, 1280, 720)),
+			"calibration of another frame size loaded");
+
+		const std::vector<char> file = readFile(path);
+		KCV_calibrationHeader header;
+		memcpy(&header, &file[0], sizeof(header));
+		std::vector<char> corrupt[6] = { file, file, file, file, file, file };
+		corrupt[0][0] = 'X';
+		reinterpret_cast<KCV_calibrationHeader*>(&corrupt[1][0])->version = KCV_CALIBRATION_VERSION + 1;
+		reinterpret_cast<KCV_calibrationHeader*>(&corrupt[2][0])->colorHeight = -KCV_COLOR_HEIGHT;
+		reinterpret_cast<KCV_calibrationHeader*>(&corrupt[3][0])->cameraTableOffset = ~(UINT64)0 - 15;
+		reinterpret_cast<KCV_calibrationHeader*>(&corrupt[4][0])->colorLutOffset = header.colorLutOffset + 16;
+		corrupt[5].resize(file.size() - 1);
+		const char *names[6] = { "calibration with wrong magic loaded", "calibration with wrong version loaded",
+			"calibration with negative size loaded", "calibration with wrapping offset loaded",
+			"calibration with table past the end loaded", "truncated calibration loaded" };
+		for (int i = 0; i < 6; ++i)
+		{
+			check(FAILED(loadCacheFile(loaded, path, serial, corrupt[i])) && !loaded.isLoaded(), names[i]);
+		}
+		check(SUCCEEDED(loadCacheFile(loaded, path, serial, file)), "calibration reload");
+		loaded.release();
+		DeleteFileW(path.c_str());
+	}
+
+	/*!
+	A second publisher of a live ring is refused and the first keeps publishing. Once the first closed, the ring kept
+	by a subscriber is taken over, its sequence continues and the closed publisher is refused in turn.
+	*/
+	void testPublisherOwner()
+	{
+		const std::wstring name = L"test_" + std::to_wstring((unsigned long long)GetCurrentProcessId());
+		const cv::Size depthSize(64, 48), colorSize(96, 54);
+		const cv::Mat depth(depthSize, CV_16U, cv::Scalar::all(1000));
+		const HRESULT taken = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+
+		KCV_publisher first, second;
+		KCV_subscriber subscriber;
+		check(SUCCEEDED(first.create(name, depthSize, colorSize)) && SUCCEEDED(subscriber.open(name)), "create shared ring");
+		check(second.create(name, depthSize, colorSize) == taken && !second.isOpen(), "second publisher of a live ring");
+		check(SUCCEEDED(first.publish(depth, cv::Mat(), cv::Mat(), cv::Mat())) && first.sequence() == 1,
+			"publish after a refused publisher");
+
+		first.close();
+		check(SUCCEEDED(second.create(name, depthSize, colorSize)) && second.sequence() == 1, "take over a closed publisher");
+		check(first.create(name, depthSize, colorSize) == taken, "closed publisher of a taken ring");
+		KCV_sharedFrame frame;
+		check(SUCCEEDED(second.publish(depth, cv::Mat(), cv::Mat(), cv::Mat())) && SUCCEEDED(subscriber.latestFrame(frame)) &&
+			frame.sequence == 2 && frame.depth.at<UINT16>(0, 0) == 1000, "subscriber reads the new publisher");
+	}
+}
+
+// Counting allocation functions, the array forms forward to these
+void *operator new(size_t size)
+{
+	++g_Allocations;
+	void *p = malloc(size != 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p)
+{
+	free(p);
+}
+
+int main()
+{
+	// mapping and the kernels work without the device
+	KCV_sensor *sensor = KCV_sensor::getInstance(false);
+
+	testSteadyStateAlign(sensor);
+	testRGBDRecords(sensor);
+	testNormals();
+	testFusion();
+	testPyramid();
+	testInfraredNormalize();
+	testInfraredMapping(sensor);
+	testSyntheticMapping(sensor);
+	testMappingViews(sensor);
+	testBudgetController();
+	testBudgetReuse(sensor);
+	testBackground(sensor);
+	testCalibrationCache();
+	testPublisherOwner();
+
+	printf("%d checks, %d failed\n", g_Checks, g_Failures);
+	return g_Failures;
+}